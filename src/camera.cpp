@@ -1,11 +1,24 @@
 #include "camera.h"
 
 // singleton
-Camera *Camera::_pCamera = NULL;
+SINGLETON_STORAGE Camera *Camera::_pCamera = NULL;
+// 自動調整時のパケットサイズ候補(大きい順)
+static const uint16_t AUTO_PACKET_SIZES[] = {512, 384, 256, 128, 64};
+static constexpr size_t AUTO_PACKET_SIZE_NUM =
+    sizeof(AUTO_PACKET_SIZES) / sizeof(AUTO_PACKET_SIZES[0]);
+// 切り替え候補のボーレート(速い順)
+static const CameraBaudRate CAMERA_BAUD_RATES[] = {
+    {921600, 0x01, 0x01},
+    {460800, 0x03, 0x01},
+    {230400, 0x07, 0x01},
+};
 
 /**
  * 画像を撮影し指定したファイル名を含むパスに保存
  * パスを指定しないとデフォルトのパスに保存
+ * 撮影は段階毎に期限とリトライ回数を設けた状態遷移で実行し、
+ * 失敗した段階と各段階の所要時間を撮影結果として残す
+ * 撮影準備済みの場合は SYNC, INITIAL を省略して SNAPSHOT から開始する
  */
 bool Camera::saveCameraData(String path) {
     DEBUG_MSG_LN("saveCameraData");
@@ -13,18 +26,140 @@ bool Camera::saveCameraData(String path) {
         DEBUG_MSG_LN("delete old image");
         SPIFFS.remove(path);
     }
-    _resolution == NON_SET ? preCapture(OV528_SIZE_QVGA) : preCapture(_resolution);
-    unsigned long dataLen = capture();
-    return readAndSaveCaptureData(path, dataLen);
+    _captureResult = CaptureResult();
+    uint16_t packetSize = getPacketSize();
+    unsigned long dataLen = 0;
+    CaptureStage stage = isPrepared() ? CAPTURE_SNAPSHOT : CAPTURE_SYNC;
+    while (stage != CAPTURE_DONE) {
+        unsigned long stageStart = millis();
+        bool success = false;
+        switch (stage) {
+        case CAPTURE_SYNC:
+            success = sync(CAPTURE_SYNC_TIMEOUT);
+            break;
+        case CAPTURE_INITIAL:
+            success = preCapture(_resolution == NON_SET ? OV528_SIZE_QVGA : _resolution) &&
+                      setPackageSize(packetSize);
+            break;
+        case CAPTURE_SNAPSHOT:
+            success = snapshot();
+            break;
+        case CAPTURE_GET_PICTURE:
+            success = getPicture(dataLen);
+            _captureResult.dataLen = dataLen;
+            break;
+        case CAPTURE_DATA:
+            success = readAndSaveCaptureData(path, dataLen, packetSize);
+            break;
+        default:
+            break;
+        }
+        _captureResult.stageTime[stage] = millis() - stageStart;
+        DEBUG_MSG_F("capture stage %s:%lu[msec]\n", getCaptureStageName(stage),
+                    _captureResult.stageTime[stage]);
+        if (!success) {
+            _captureResult.error = stage;
+            DEBUG_MSG_F("capture failed at %s\n", getCaptureStageName(stage));
+            break;
+        }
+        stage = static_cast<CaptureStage>(stage + 1);
+    }
+    bool success = stage == CAPTURE_DONE;
+    // 失敗した場合はカメラの状態が分からないので次回は SYNC からやり直す
+    _isPrepared = success;
+    _preparedResolution = _resolution == NON_SET ? OV528_SIZE_QVGA : _resolution;
+    _preparedPacketSize = packetSize;
+    tunePacketSize(_captureResult.error);
+    return success;
+}
+
+/**
+ * 撮影準備
+ * 予め SYNC, INITIAL, SET_PACKAGE_SIZE を済ませておき、撮影指示から画像取得までの時間を短くする
+ * 解像度が未設定の場合は QVGA で準備する
+ */
+bool Camera::prepare() {
+    DEBUG_MSG_LN("prepare camera");
+    if (_resolution == NON_SET) {
+        _resolution = OV528_SIZE_QVGA;
+    }
+    uint16_t packetSize = getPacketSize();
+    _isPrepared = sync(CAPTURE_SYNC_TIMEOUT) && preCapture(_resolution) &&
+                  setPackageSize(packetSize);
+    _preparedResolution = _resolution;
+    _preparedPacketSize = packetSize;
+    return _isPrepared;
+}
+
+/**
+ * 撮影段階名
+ */
+const char *Camera::getCaptureStageName(CaptureStage stage) {
+    switch (stage) {
+    case CAPTURE_SYNC:
+        return "SYNC";
+    case CAPTURE_INITIAL:
+        return "INITIAL";
+    case CAPTURE_SNAPSHOT:
+        return "SNAPSHOT";
+    case CAPTURE_GET_PICTURE:
+        return "GET_PICTURE";
+    case CAPTURE_DATA:
+        return "DATA";
+    default:
+        return "NONE";
+    }
+}
+
+/**
+ * 使用するパケットサイズ
+ */
+uint16_t Camera::getPacketSize() {
+    if (_packetSize == CAMERA_PACKET_SIZE_AUTO) {
+        return AUTO_PACKET_SIZES[_autoPacketSizeIndex];
+    }
+    return _packetSize;
 }
 
+/**
+ * パケットサイズ自動調整
+ * DATA 段階で失敗するかエラー率が閾値を超えたらパケットサイズを 1 段階小さくする
+ * パケットサイズと関係ない段階(SYNC, ACK 待ちなど)の失敗では変えない
+ * エラー率が閾値以下の撮影が CAMERA_PACKET_PROBE_NUM 回続いたら 1 段階大きくしてみる
+ */
+void Camera::tunePacketSize(CaptureStage error) {
+    if (_packetSize != CAMERA_PACKET_SIZE_AUTO) {
+        return;
+    }
+    if (error != CAPTURE_DONE && error != CAPTURE_DATA) {
+        return;
+    }
+    if (error == CAPTURE_DATA || _packetStats.isErrorRateOver(CAMERA_PACKET_ERROR_RATE)) {
+        _cleanCaptureNum = 0;
+        if ((size_t)_autoPacketSizeIndex + 1 < AUTO_PACKET_SIZE_NUM) {
+            ++_autoPacketSizeIndex;
+            DEBUG_MSG_F("packet size tuned down:%u\n", AUTO_PACKET_SIZES[_autoPacketSizeIndex]);
+        }
+        return;
+    }
+    if (++_cleanCaptureNum < CAMERA_PACKET_PROBE_NUM) {
+        return;
+    }
+    _cleanCaptureNum = 0;
+    if (_autoPacketSizeIndex > 0) {
+        --_autoPacketSizeIndex;
+        DEBUG_MSG_F("packet size probe up:%u\n", AUTO_PACKET_SIZES[_autoPacketSizeIndex]);
+    }
+}
+
+#ifdef CAMERA_LEGACY_UART
 /**
  * バッファクリア
  */
 void Camera::clearRxBuf() {
-    while (_camSerial.available()) {
+    while (_camSerial->available()) {
         TASK_DELAY(1);
-        _camSerial.read();
+        _camSerial->read();
     }
 }
 
@@ -34,7 +169,7 @@ void Camera::clearRxBuf() {
 void Camera::sendCmd(char cmd[], int cmd_len) {
     for (int i = 0; i < cmd_len; i++) {
         TASK_DELAY(1);
-        _camSerial.write(cmd[i]);
+        _camSerial->write((const uint8_t *)&cmd[i], 1);
     }
 }
 
@@ -45,30 +180,94 @@ uint16_t Camera::readBytes(uint8_t buf[], uint16_t len, uint16_t timeout_ms) {
     unsigned long current = millis();
     int bufIndex = 0;
     for (bufIndex = 0; bufIndex < len; bufIndex++) {
-        while (!_camSerial.available()) {
+        while (!_camSerial->available()) {
             if (millis() - current > timeout_ms) {
                 DEBUG_MSG_LN("read Buffer timeout.");
                 return bufIndex;
             }
             TASK_DELAY(1);
         }
-        buf[bufIndex] = _camSerial.read();
+        buf[bufIndex] = _camSerial->read();
         current = millis();
     }
     return bufIndex;
 }
+#else
+/**
+ * バッファクリア
+ */
+void Camera::clearRxBuf() {
+    while (_camSerial->available()) {
+        _camSerial->read();
+    }
+}
+
+/**
+ * カメラモジュールに任意のコマンドを送信
+ * コマンドはまとめて送信バッファに書き込む
+ */
+void Camera::sendCmd(char cmd[], int cmd_len) { _camSerial->write((const uint8_t *)cmd, cmd_len); }
+
+/**
+ * UART のバッファから読み出し
+ * 1byte 毎に待たず、指定長に達するかバイト間のタイムアウトまでまとめて読み出す
+ */
+uint16_t Camera::readBytes(uint8_t buf[], uint16_t len, uint16_t timeout_ms) {
+    uint16_t readLen = _camSerial->readBytes(buf, len, timeout_ms);
+    if (readLen != len) {
+        DEBUG_MSG_LN("read Buffer timeout.");
+    }
+    return readLen;
+}
+#endif
 
 /**
  * 初期化
+ * 同期後、使用可能な最も速いボーレートに切り替える
+ * DeepSleep 中もカメラの電源が入ったままだと前回切り替えたボーレートのままなので、
+ * 起動時のボーレートで同期できなければ切り替え候補のボーレートでも同期を試す
  */
 bool Camera::initialize() {
     DEBUG_MSG_LN("initializing camera");
+    if (sync(INITIALIZE_TIMEOUT)) {
+        DEBUG_MSG_LN("\nCamera initialization done.");
+        return negotiateBaudRate();
+    }
+    if (syncAtCandidateBaudRates()) {
+        DEBUG_MSG_F("Camera initialization done at %u\n", _baudRate);
+        return true;
+    }
+    DEBUG_MSG_LN("\nCamera Not found.");
+    return false;
+}
+
+/**
+ * 切り替え候補のボーレートで順に同期を試し、同期できたボーレートを使用する
+ * どれでも同期できなければ現在のボーレートに戻す
+ */
+bool Camera::syncAtCandidateBaudRates() {
+    for (auto &baudRate : CAMERA_BAUD_RATES) {
+        DEBUG_MSG_F("\ntry sync at %u\n", baudRate.baud);
+        _camSerial->updateBaudRate(baudRate.baud);
+        if (sync(CAMERA_BAUD_SYNC_TIMEOUT)) {
+            _baudRate = baudRate.baud;
+            return true;
+        }
+    }
+    _camSerial->updateBaudRate(_baudRate);
+    return false;
+}
+
+/**
+ * 同期
+ */
+bool Camera::sync(unsigned long timeout) {
     clearRxBuf();
     char cmd[] = {0xaa, 0x0d | _cameraAddr, 0x00, 0x00, 0x00, 0x00};
     unsigned char resp[6];
 
     unsigned long current = millis();
-    while (millis() - current < INITIALIZE_TIMEOUT) {
+    while (millis() - current < timeout) {
         TASK_DELAY(1);
         sendCmd(cmd, 6);
         if (readBytes((uint8_t *)resp, 6, 500) != 6) {
@@ -85,12 +284,63 @@ bool Camera::initialize() {
                 cmd[1] = 0x0e | _cameraAddr;
                 cmd[2] = 0x0d;
                 sendCmd(cmd, 6);
-                DEBUG_MSG_LN("\nCamera initialization done.");
                 return true;
             }
         }
     }
-    DEBUG_MSG_LN("\nCamera Not found.");
+    return false;
+}
+
+/**
+ * ボーレート切り替え
+ * 速いボーレートから順に試し、同期できなければ次のボーレートを試す
+ * 切り替えに失敗した場合は現在のボーレートのまま使用する
+ * SET_BAUD の ACK 後にカメラだけ切り替わっている場合もあるので、元のボーレートで同期できなければ
+ * 候補のボーレートを探し直し、見つかったボーレートを使用する
+ */
+bool Camera::negotiateBaudRate() {
+    for (auto &baudRate : CAMERA_BAUD_RATES) {
+        if (setBaudRate(baudRate)) {
+            break;
+        }
+        if (sync(CAMERA_BAUD_SYNC_TIMEOUT)) {
+            continue;
+        }
+        if (!syncAtCandidateBaudRates()) {
+            DEBUG_MSG_LN("\nCamera lost after baud rate change.");
+            return false;
+        }
+        break;
+    }
+    DEBUG_MSG_F("Camera baud rate:%u\n", _baudRate);
+    return true;
+}
+
+/**
+ * ボーレート設定
+ * カメラが ACK を返したらこちらもボーレートを切り替えて同期を確認する
+ * 同期できなければ元のボーレートに戻す
+ */
+bool Camera::setBaudRate(const CameraBaudRate &baudRate) {
+    DEBUG_MSG_F("try baud rate:%u\n", baudRate.baud);
+    char cmd[] = {0xaa, 0x07 | _cameraAddr, baudRate.firstDivider, baudRate.secondDivider, 0x00,
+                  0x00};
+    unsigned char resp[6];
+    clearRxBuf();
+    sendCmd(cmd, 6);
+    if (readBytes((uint8_t *)resp, 6, 500) != 6 || resp[0] != 0xaa ||
+        resp[1] != (0x0e | _cameraAddr) || resp[2] != 0x07 || resp[4] != 0 || resp[5] != 0) {
+        return false;
+    }
+    // ACK 送信完了を待ってから切り替える
+    _camSerial->flush();
+    TASK_DELAY(10);
+    _camSerial->updateBaudRate(baudRate.baud);
+    if (sync(CAMERA_BAUD_SYNC_TIMEOUT)) {
+        _baudRate = baudRate.baud;
+        return true;
+    }
+    _camSerial->updateBaudRate(_baudRate);
     return false;
 }
 
@@ -125,24 +375,21 @@ void Camera::setResolution(int resolution) {
 }
 
 /**
- * キャプチャ準備
+ * コマンドを送信して ACK を待つ
+ * 期限内かつリトライ回数内で ACK が返るまで再送する
  */
-bool Camera::preCapture(int picFmt) {
-    DEBUG_MSG_LN("preCapture");
-    char cmd[] = {0xaa, 0x01 | _cameraAddr, 0x00, 0x07, 0x00, picFmt};
+bool Camera::sendCmdWithAck(char cmd[], unsigned long timeout, uint8_t retry) {
     unsigned char resp[6];
-
-    unsigned long timeout = 3000;
     unsigned long current = millis();
-    while (millis() - current < timeout) {
+    for (uint8_t i = 0; i <= retry && millis() - current < timeout; ++i) {
         TASK_DELAY(1);
         clearRxBuf();
         sendCmd(cmd, 6);
-        if (readBytes((uint8_t *)resp, 6, 500) != 6) {
+        if (readBytes((uint8_t *)resp, 6, DEF_CAMERA_TIMEOUT) != 6) {
             continue;
         }
-        if (resp[0] == 0xaa && resp[1] == (0x0e | _cameraAddr) && resp[2] == 0x01 && resp[4] == 0 &&
-            resp[5] == 0) {
+        if (resp[0] == 0xaa && resp[1] == (0x0e | _cameraAddr) && resp[2] == (cmd[1] & 0x1f) &&
+            resp[4] == 0 && resp[5] == 0) {
             return true;
         }
     }
@@ -150,103 +397,199 @@ bool Camera::preCapture(int picFmt) {
 }
 
 /**
- * キャプチャ
+ * キャプチャ準備(INITIAL)
  */
-unsigned long Camera::capture() {
-    DEBUG_MSG_LN("capture");
-    char cmd[] = {0xaa, 0x06 | _cameraAddr, 0x08, PIC_PKT_LEN & 0xff, (PIC_PKT_LEN >> 8) & 0xff, 0};
-    unsigned char resp[6];
+bool Camera::preCapture(int picFmt) {
+    DEBUG_MSG_LN("preCapture");
+    char cmd[] = {0xaa, 0x01 | _cameraAddr, 0x00, 0x07, 0x00, picFmt};
+    return sendCmdWithAck(cmd, CAPTURE_CMD_TIMEOUT, CAPTURE_CMD_RETRY);
+}
 
-    while (1) {
-        TASK_DELAY(1);
-        clearRxBuf();
-        sendCmd(cmd, 6);
-        if (readBytes((uint8_t *)resp, 6, 500) != 6)
-            continue;
-        if (resp[0] == 0xaa && resp[1] == (0x0e | _cameraAddr) && resp[2] == 0x06 && resp[4] == 0 &&
-            resp[5] == 0)
-            break;
-    }
-    cmd[1] = 0x05 | _cameraAddr;
-    cmd[2] = 0;
-    cmd[3] = 0;
-    cmd[4] = 0;
-    cmd[5] = 0;
-    while (1) {
-        TASK_DELAY(1);
-        clearRxBuf();
-        sendCmd(cmd, 6);
-        if (readBytes((uint8_t *)resp, 6, 500) != 6)
+/**
+ * パケットサイズ設定(SET_PACKAGE_SIZE)
+ */
+bool Camera::setPackageSize(uint16_t packetSize) {
+    DEBUG_MSG_LN("setPackageSize");
+    char cmd[] = {0xaa, 0x06 | _cameraAddr, 0x08, packetSize & 0xff, (packetSize >> 8) & 0xff, 0};
+    return sendCmdWithAck(cmd, CAPTURE_CMD_TIMEOUT, CAPTURE_CMD_RETRY);
+}
+
+/**
+ * 撮影(SNAPSHOT)
+ */
+bool Camera::snapshot() {
+    DEBUG_MSG_LN("snapshot");
+    char cmd[] = {0xaa, 0x05 | _cameraAddr, 0, 0, 0, 0};
+    return sendCmdWithAck(cmd, CAPTURE_CMD_TIMEOUT, CAPTURE_CMD_RETRY);
+}
+
+/**
+ * 撮影データ長取得(GET_PICTURE)
+ */
+bool Camera::getPicture(unsigned long &dataLen) {
+    DEBUG_MSG_LN("getPicture");
+    char cmd[] = {0xaa, 0x04 | _cameraAddr, 0x1, 0, 0, 0};
+    unsigned char resp[6];
+    unsigned long current = millis();
+    for (uint8_t i = 0; i <= CAPTURE_CMD_RETRY && millis() - current < CAPTURE_CMD_TIMEOUT; ++i) {
+        if (!sendCmdWithAck(cmd, CAPTURE_CMD_TIMEOUT - (millis() - current), 0)) {
             continue;
-        if (resp[0] == 0xaa && resp[1] == (0x0e | _cameraAddr) && resp[2] == 0x05 && resp[4] == 0 &&
-            resp[5] == 0)
-            break;
-    }
-    cmd[1] = 0x04 | _cameraAddr;
-    cmd[2] = 0x1;
-    unsigned long dataLen = 0;
-    while (1) {
-        clearRxBuf();
-        sendCmd(cmd, 6);
-        if (readBytes((uint8_t *)resp, 6, 500) != 6)
+        }
+        if (readBytes((uint8_t *)resp, 6, 1000) != 6) {
             continue;
-        if (resp[0] == 0xaa && resp[1] == (0x0e | _cameraAddr) && resp[2] == 0x04 && resp[4] == 0 &&
-            resp[5] == 0) {
-            if (readBytes((uint8_t *)resp, 6, 1000) != 6) {
-                continue;
-            }
-            if (resp[0] == 0xaa && resp[1] == (0x0a | _cameraAddr) && resp[2] == 0x01) {
-                dataLen = (resp[3]) | (resp[4] << 8) | (resp[5] << 16);
-                DEBUG_MSG("DataLen:");
-                DEBUG_MSG_LN(dataLen);
-                break;
-            }
+        }
+        if (resp[0] == 0xaa && resp[1] == (0x0a | _cameraAddr) && resp[2] == 0x01) {
+            dataLen = (resp[3]) | (resp[4] << 8) | (resp[5] << 16);
+            DEBUG_MSG("DataLen:");
+            DEBUG_MSG_LN(dataLen);
+            return dataLen > 0;
         }
     }
-    return dataLen;
+    return false;
 }
 
 /**
  * キャプチャしたデータをバッファから読み出し
  * 指定したパスへ保存する
+ * 読み出したパケットはリングバッファ経由で別コアの書き込みタスクに渡し、
+ * SPIFFS への書き込み中に次のパケットを要求する
  */
-bool Camera::readAndSaveCaptureData(String fileName, unsigned long dataLen) {
+bool Camera::readAndSaveCaptureData(String fileName, unsigned long dataLen, uint16_t packetSize) {
     DEBUG_MSG_LN("readAndSaveCaptureData");
     File myFile = SPIFFS.open(fileName, "w");
     if (!myFile) {
         DEBUG_MSG_LN("myFile open fail...");
         return false;
     }
+    if (_ringBuf == NULL) {
+        _ringBuf = xRingbufferCreate(CAMERA_RINGBUF_SIZE, RINGBUF_TYPE_NOSPLIT);
+        if (_ringBuf == NULL) {
+            DEBUG_MSG_LN("ring buffer create fail...");
+            myFile.close();
+            return false;
+        }
+    }
+    if (_writeDoneSem == NULL) {
+        _writeDoneSem = xSemaphoreCreateBinary();
+        if (_writeDoneSem == NULL) {
+            DEBUG_MSG_LN("write semaphore create fail...");
+            myFile.close();
+            return false;
+        }
+    }
+    // 前回中断時の残りデータを破棄
+    size_t itemSize;
+    void *item;
+    while ((item = xRingbufferReceive(_ringBuf, &itemSize, 0)) != NULL) {
+        vRingbufferReturnItem(_ringBuf, item);
+    }
+    _writeFile = myFile;
+    _writeLen = dataLen;
+    _isReadAborted = false;
+    _isWriteSuccess = false;
+    _isWriteFailed = false;
+    if (xTaskCreatePinnedToCore(Camera::writeCaptureDataTask, CAMERA_WRITE_TASK_NAME, TASK_MEMORY,
+                                this, 2, NULL, 1) != pdPASS) {
+        DEBUG_MSG_LN("write task create fail...");
+        myFile.close();
+        return false;
+    }
 
     char cmd[] = {0xaa, 0x0e | _cameraAddr, 0x00, 0x00, 0x00, 0x00};
-    unsigned char pkt[PIC_PKT_LEN];
+    unsigned char pkt[CAMERA_PACKET_SIZE_MAX];
     unsigned long readLen = 0;
-    for (int ii = 0; readLen < dataLen; ++ii) {
+    uint8_t retry = 0;
+    unsigned long start = millis();
+    _packetStats = CameraPacketStats();
+    for (int ii = 0; readLen < dataLen && !_isWriteFailed; ++ii) {
+        if (millis() - start > CAPTURE_DATA_TIMEOUT) {
+            DEBUG_MSG_LN("capture data timeout");
+            break;
+        }
         cmd[4] = ii & 0xff;
         cmd[5] = (ii >> 8) & 0xff;
 
-        // delay(10);
+        unsigned long packetStart = micros();
+#ifdef CAMERA_LEGACY_UART
         TASK_DELAY(1);
+#endif
         clearRxBuf();
         sendCmd(cmd, 6);
-        uint16_t cnt = readBytes((uint8_t *)pkt, PIC_PKT_LEN, 500);
-        // 読み込んだデータが正常かチェック
-        if (cnt == 0) {
-            break;
-        }
+        // 最終パケットは短いので残りデータ長だけ読み出す(タイムアウトまで待たない)
+        uint16_t pktLen = min((unsigned long)packetSize, dataLen - readLen + 6);
+        uint16_t cnt = readBytes((uint8_t *)pkt, pktLen, 500);
+        // 読み込んだデータが正常かチェックし、異常なら同じパケットを再要求する
         unsigned char sum = 0;
         for (int y = 0; y < cnt - 2; y++) {
             sum += pkt[y];
         }
-        if (sum != pkt[cnt - 2]) {
+        if (cnt < 6 || sum != pkt[cnt - 2]) {
+            ++_packetStats.errors;
+            if (++retry > CAMERA_PACKET_RETRY) {
+                break;
+            }
+            --ii;
+            continue;
+        }
+        retry = 0;
+        // 書き込みは書き込みタスクに任せて次のパケットを読み出す
+        if (xRingbufferSend(_ringBuf, &pkt[4], cnt - 6, pdMS_TO_TICKS(CAMERA_WRITE_TIMEOUT)) !=
+            pdTRUE) {
+            DEBUG_MSG_LN("ring buffer send timeout");
             break;
         }
         readLen += cnt - 6;
-        myFile.write((uint8_t *)&pkt[4], cnt - 6);
+        _packetStats.add(micros() - packetStart);
     }
+    DEBUG_MSG_F("packet size:%u num:%u errors:%u latency[usec] min:%lu max:%lu avg:%lu\n",
+                packetSize, _packetStats.count, _packetStats.errors, _packetStats.minLatency,
+                _packetStats.maxLatency, _packetStats.average());
     cmd[4] = 0xf0;
     cmd[5] = 0xf0;
     sendCmd(cmd, 6);
+    // 書き込み完了待ち
+    if (readLen != dataLen) {
+        _isReadAborted = true;
+    }
+    if (xSemaphoreTake(_writeDoneSem, pdMS_TO_TICKS(CAMERA_WRITE_TIMEOUT)) != pdTRUE) {
+        DEBUG_MSG_LN("write task timeout");
+        _isReadAborted = true;
+        // 書き込みタスクが終了するまで待つ
+        xSemaphoreTake(_writeDoneSem, portMAX_DELAY);
+    }
     myFile.close();
-    return readLen == dataLen;
+    return readLen == dataLen && _isWriteSuccess;
+}
+
+/**
+ * 撮影データ書き込みタスク
+ * リングバッファに積まれたパケットを SPIFFS へ書き込む
+ */
+void Camera::writeCaptureDataTask(void *arg) {
+    Camera *pCamera = (Camera *)arg;
+    unsigned long writeLen = 0;
+    bool success = true;
+    while (writeLen < pCamera->_writeLen) {
+        size_t size;
+        uint8_t *item = (uint8_t *)xRingbufferReceive(pCamera->_ringBuf, &size,
+                                                      pdMS_TO_TICKS(CAMERA_RINGBUF_WAIT));
+        if (item == NULL) {
+            if (pCamera->_isReadAborted) {
+                success = false;
+                break;
+            }
+            continue;
+        }
+        success = pCamera->_writeFile.write(item, size) == size;
+        vRingbufferReturnItem(pCamera->_ringBuf, item);
+        if (!success) {
+            DEBUG_MSG_LN("capture data write fail...");
+            pCamera->_isWriteFailed = true;
+            break;
+        }
+        writeLen += size;
+    }
+    pCamera->_isWriteSuccess = success && writeLen == pCamera->_writeLen;
+    xSemaphoreGive(pCamera->_writeDoneSem);
+    vTaskDelete(NULL);
 }
\ No newline at end of file
@@ -1,17 +1,34 @@
 #ifndef INCLUDE_GUARD_CAMERA
 #define INCLUDE_GUARD_CAMERA
 
+#include "cameraPort.h"
 #include "trapCommon.h"
-#include <HardwareSerial.h>
+#include <freertos/ringbuf.h>
+#include <freertos/semphr.h>
 
-#define PIC_PKT_LEN 500
 #define CAM_ADDR 0
-// camera swSerial UART2 (default GPIO RX=16, TX=17)
-#define CAMEARA_RX 16
-#define CAMERA_TX 17
 // 初期化タイムアウト[msec]
 #define INITIALIZE_TIMEOUT 1500
 #define DEF_CAMERA_TIMEOUT 500
+// ボーレート
+#define CAMERA_DEF_BAUD 115200         // OV528 起動時のボーレート
+#define CAMERA_BAUD_SYNC_TIMEOUT 500   // ボーレート変更後の同期確認タイムアウト[msec]
+// 撮影データ書き込み用リングバッファ
+#define CAMERA_RINGBUF_SIZE (4 * (CAMERA_PACKET_SIZE_MAX + 8)) // パケット 4 つ分(ヘッダ 8byte 込み)
+#define CAMERA_RINGBUF_WAIT 100   // 書き込みタスクの受信待ち時間[msec]
+#define CAMERA_WRITE_TIMEOUT 3000 // 書き込み完了待ちタイムアウト[msec]
+// 撮影段階毎の期限とリトライ数
+#define CAPTURE_SYNC_TIMEOUT 1000  // SYNC の期限[msec]
+#define CAPTURE_CMD_TIMEOUT 2000   // INITIAL, SNAPSHOT, GET_PICTURE の各コマンドの期限[msec]
+#define CAPTURE_CMD_RETRY 3        // 各コマンドのリトライ数
+#define CAPTURE_DATA_TIMEOUT 30000 // DATA の期限[msec]
+// パケット読み出し
+#define CAMERA_PACKET_RETRY 3       // 1 パケットの読み出しリトライ数
+#define CAMERA_PACKET_ERROR_RATE 5  // 自動調整時に許容するパケットエラー率[%]
+#define CAMERA_PACKET_PROBE_NUM 10  // 自動調整時にパケットサイズを大きくしてみるまでの正常撮影数
+// UART 読み書き方式
+// 1byte 毎に 1msec 待つ旧方式とパケット読み出し時間を比較する場合に有効化する
+// #define CAMERA_LEGACY_UART
 
 enum CameraResolution {
     NON_SET = 0,
@@ -21,13 +38,79 @@ enum CameraResolution {
     OV528_SIZE_VGA = 7    // 640x480
 };
 
+// 撮影段階
+enum CaptureStage {
+    CAPTURE_SYNC = 0,
+    CAPTURE_INITIAL,     // INITIAL, SET_PACKAGE_SIZE
+    CAPTURE_SNAPSHOT,
+    CAPTURE_GET_PICTURE,
+    CAPTURE_DATA,
+    CAPTURE_DONE
+};
+
+// 撮影結果
+struct CaptureResult {
+    CaptureStage error = CAPTURE_DONE;           // 失敗した段階(成功時は CAPTURE_DONE)
+    unsigned long stageTime[CAPTURE_DONE] = {0}; // 段階毎の所要時間[msec]
+    unsigned long dataLen = 0;                   // 画像サイズ[byte]
+};
+
+// OV528 SET_BAUD の分周値
+// ボーレート = 14.7456MHz / 4 / (first + 1) / (second + 1)
+struct CameraBaudRate {
+    uint32_t baud;
+    uint8_t firstDivider;
+    uint8_t secondDivider;
+};
+
+// パケット読み出し時間計測(コマンド送信から読み出し完了まで)
+struct CameraPacketStats {
+    uint16_t count = 0;
+    uint16_t errors = 0; // チェックサムエラー・タイムアウト数
+    unsigned long minLatency = ULONG_MAX; // [usec]
+    unsigned long maxLatency = 0;         // [usec]
+    unsigned long total = 0;              // [usec]
+
+    void add(unsigned long latency) {
+        ++count;
+        total += latency;
+        minLatency = latency < minLatency ? latency : minLatency;
+        maxLatency = latency > maxLatency ? latency : maxLatency;
+    }
+    unsigned long average() { return count == 0 ? 0 : total / count; }
+    bool isErrorRateOver(uint8_t rate) { return errors * 100 > (count + errors) * rate; }
+};
+
 class Camera {
   private:
-    HardwareSerial _camSerial = HardwareSerial(2);
-    static Camera *_pCamera;
+    HardwareSerialPort _serialPort;
+    CameraPort *_camSerial = &_serialPort;
+    static SINGLETON_STORAGE Camera *_pCamera;
 
     int _resolution = NON_SET;
     byte _cameraAddr = (CAM_ADDR << 5); // addr
+    uint32_t _baudRate = CAMERA_DEF_BAUD;
+    uint16_t _packetSize = DEF_CAMERA_PACKET_SIZE; // 0 の場合は自動調整
+    uint8_t _autoPacketSizeIndex = 0;
+    uint8_t _cleanCaptureNum = 0; // パケットエラー率が閾値以下の連続撮影数(自動調整用)
+    // 撮影準備(SYNC, INITIAL 済み)状態
+    bool _isPrepared = false;
+    int _preparedResolution = NON_SET;
+    uint16_t _preparedPacketSize = 0;
+
+    // 撮影データ書き込みタスク関連
+    RingbufHandle_t _ringBuf = NULL;
+    // 書き込み完了通知(撮影タスクの通知は撮影要求専用なので別に持つ)
+    SemaphoreHandle_t _writeDoneSem = NULL;
+    File _writeFile;
+    unsigned long _writeLen = 0;
+    volatile bool _isReadAborted = false;
+    volatile bool _isWriteSuccess = false;
+    volatile bool _isWriteFailed = false;
+    // パケット読み出し時間
+    CameraPacketStats _packetStats;
+    // 撮影結果
+    CaptureResult _captureResult;
 
   public:
     static Camera *getInstance() {
@@ -46,24 +129,49 @@ class Camera {
 
     bool cameraSerialBegin() {
         DEBUG_MSG_LN("cameraSerialBegin");
-        _camSerial.begin(115200, SERIAL_8N1, CAMEARA_RX, CAMERA_TX);
+        _baudRate = CAMERA_DEF_BAUD;
+        _camSerial->begin(_baudRate);
+        return true;
     }
+    // 通信路の差し替え(cameraSerialBegin の前に呼ぶ)
+    void setPort(CameraPort *port) { _camSerial = port == NULL ? &_serialPort : port; }
     bool initialize();
+    uint32_t getBaudRate() { return _baudRate; }
     bool saveCameraData(String path = DEF_IMG_PATH);
+    bool prepare();
+    bool isPrepared() {
+        return _isPrepared && _preparedResolution == _resolution &&
+               _preparedPacketSize == getPacketSize();
+    }
     bool isSetResolution() {
         _resolution == NON_SET ? DEBUG_MSG_LN("resolution no set") : DEBUG_MSG_LN("resolution set");
         return _resolution != NON_SET;
     }
     void setResolution(int resolution);
+    int getResolution() { return _resolution; }
+    const CameraPacketStats &getPacketStats() { return _packetStats; }
+    const CaptureResult &getCaptureResult() { return _captureResult; }
+    static const char *getCaptureStageName(CaptureStage stage);
+    void setPacketSize(uint16_t packetSize) { _packetSize = packetSize; }
+    uint16_t getPacketSize();
 
   private:
     Camera(){};
     void clearRxBuf();
     void sendCmd(char cmd[], int cmd_len);
     uint16_t readBytes(uint8_t buf[], uint16_t len, uint16_t timeout_ms = DEF_CAMERA_TIMEOUT);
+    bool sync(unsigned long timeout);
+    bool syncAtCandidateBaudRates();
+    bool negotiateBaudRate();
+    bool setBaudRate(const CameraBaudRate &baudRate);
+    bool sendCmdWithAck(char cmd[], unsigned long timeout, uint8_t retry);
     bool preCapture(int picFmt);
-    unsigned long capture();
-    bool readAndSaveCaptureData(String fileName, unsigned long dataLen);
+    bool setPackageSize(uint16_t packetSize);
+    bool snapshot();
+    bool getPicture(unsigned long &dataLen);
+    bool readAndSaveCaptureData(String fileName, unsigned long dataLen, uint16_t packetSize);
+    void tunePacketSize(CaptureStage error);
+    static void writeCaptureDataTask(void *arg);
 };
 
 #endif // INCLUDE_GUARD_CAMERA
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef INCLUDE_GUARD_CAMERA_PORT
+#define INCLUDE_GUARD_CAMERA_PORT
+
+#include "trapCommon.h"
+#include <HardwareSerial.h>
+
+// camera swSerial UART2 (default GPIO RX=16, TX=17)
+#define CAMEARA_RX 16
+#define CAMERA_TX 17
+#define CAMERA_RX_BUF_SIZE 1024 // 高速ボーレートでも 1 パケット分溢れないようにする
+
+/**
+ * カメラとの通信路
+ * Camera は UART を直接扱わずこのインターフェース経由で読み書きするので、
+ * 実機以外の通信路(OV528 の応答を模擬するものなど)に差し替えられる
+ */
+class CameraPort {
+  public:
+    virtual ~CameraPort(){};
+    virtual void begin(uint32_t baud) = 0;
+    virtual void updateBaudRate(uint32_t baud) = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual size_t write(const uint8_t *buf, size_t len) = 0;
+    // 指定長に達するかバイト間のタイムアウトまで読み出す
+    virtual size_t readBytes(uint8_t *buf, size_t len, unsigned long timeout) = 0;
+    // 送信完了待ち
+    virtual void flush() = 0;
+};
+
+/**
+ * HardwareSerial(UART2) による通信路
+ */
+class HardwareSerialPort : public CameraPort {
+  private:
+    HardwareSerial _serial = HardwareSerial(2);
+
+  public:
+    void begin(uint32_t baud) {
+        _serial.setRxBufferSize(CAMERA_RX_BUF_SIZE);
+        _serial.begin(baud, SERIAL_8N1, CAMEARA_RX, CAMERA_TX);
+    }
+    void updateBaudRate(uint32_t baud) { _serial.updateBaudRate(baud); }
+    int available() { return _serial.available(); }
+    int read() { return _serial.read(); }
+    size_t write(const uint8_t *buf, size_t len) { return _serial.write(buf, len); }
+    size_t readBytes(uint8_t *buf, size_t len, unsigned long timeout) {
+        _serial.setTimeout(timeout);
+        return _serial.readBytes(buf, len);
+    }
+    void flush() { _serial.flush(); }
+};
+
+#endif // INCLUDE_GUARD_CAMERA_PORT
@@ -0,0 +1,225 @@
+#include "fleetTable.h"
+
+// DeepSleep 中も保持される
+RTC_DATA_ATTR static FleetSnapshot rtcSnapshot;
+// SPIFFS に保存済みの複製の CRC(0 は未保存)
+RTC_DATA_ATTR static uint32_t rtcPersistedCrc = 0;
+
+/**
+ * モジュール状態でテーブルを更新する
+ */
+void FleetTable::update(const ModuleState &state, time_t current) {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    int16_t index = findOrInsert(state.nodeId);
+    FleetEntry &entry = _entries[index];
+    entry.lastSeen = current;
+    entry.battery = state.batery;
+    entry.trapFire = state.trapFire;
+    entry.cameraEnable = state.cameraEnable;
+    entry.batteryDead = state.batteryDead;
+    xSemaphoreGive(_mutex);
+}
+
+/**
+ * メッシュのトポロジ(subConnectionJson を解析したもの)からホップ数を更新する
+ */
+void FleetTable::updateHops(JsonVariant meshGraph) {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    for (uint8_t i = 0; i < _size; ++i) {
+        _entries[i].hop = FLEET_HOP_UNKNOWN;
+    }
+    // 配列の場合は直接接続しているモジュールの一覧、オブジェクトの場合は自身が根
+    walkMeshGraph(meshGraph, meshGraph.is<JsonArray>() ? 1 : 0);
+    xSemaphoreGive(_mutex);
+}
+
+/**
+ * periodJson 形式で出力する
+ * 子モジュール数が多くても JSON バッファに収まるよう文字列を直接組み立てる
+ */
+void FleetTable::printTo(String &json, uint32_t parentId, time_t current) {
+    char buf[160];
+    snprintf(buf, sizeof(buf), "{\"%s\":%u,\"%s\":%ld,\"modules\":[", KEY_PARENT_NODE_ID,
+             parentId, KEY_CURRENT_TIME, (long)current);
+    json.reserve(json.length() + strlen(buf) + _size * sizeof(buf) / 2);
+    json += buf;
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    bool isFirst = true;
+    for (uint8_t i = 0; i < _size; ++i) {
+        const FleetEntry &entry = _entries[i];
+        if (entry.lastSeen == 0) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf),
+                 "%s{\"%s\":%u,\"%s\":%.2f,\"%s\":%s,\"%s\":%s,\"%s\":%s,\"%s\":%u,\"%s\":%d}",
+                 isFirst ? "" : ",", KEY_NODE_ID, _nodeIds[i], KEY_CURRENT_BATTERY,
+                 REAL_BATTERY_VALUE((double)entry.battery), KEY_TRAP_FIRE,
+                 entry.trapFire ? "true" : "false", KEY_CAMERA_ENABLE,
+                 entry.cameraEnable ? "true" : "false", KEY_BATTERY_DEAD,
+                 entry.batteryDead ? "true" : "false", KEY_LAST_SEEN, entry.lastSeen, KEY_HOP,
+                 entry.hop == FLEET_HOP_UNKNOWN ? -1 : entry.hop);
+        json += buf;
+        isFirst = false;
+    }
+    xSemaphoreGive(_mutex);
+    json += "]}";
+}
+
+/**
+ * NodeId の位置を検索し、無ければ追加する
+ * テーブルが一杯の場合は最も長く受信していないモジュールを置き換える
+ */
+int16_t FleetTable::findOrInsert(uint32_t nodeId) {
+    for (uint8_t i = 0; i < _size; ++i) {
+        if (_nodeIds[i] == nodeId) {
+            return i;
+        }
+    }
+    uint8_t index = _size;
+    if (_size < FLEET_TABLE_SIZE) {
+        ++_size;
+    } else {
+        index = 0;
+        for (uint8_t i = 1; i < _size; ++i) {
+            if (_entries[i].lastSeen < _entries[index].lastSeen) {
+                index = i;
+            }
+        }
+    }
+    _nodeIds[index] = nodeId;
+    _entries[index] = FleetEntry();
+    return index;
+}
+
+/**
+ * トポロジを辿ってホップ数を設定する
+ */
+void FleetTable::walkMeshGraph(JsonVariant node, uint8_t hop) {
+    if (node.is<JsonArray>()) {
+        for (JsonVariant sub : node.as<JsonArray>()) {
+            walkMeshGraph(sub, hop);
+        }
+        return;
+    }
+    if (!node.is<JsonObject>()) {
+        return;
+    }
+    JsonObject &obj = node.as<JsonObject>();
+    uint32_t nodeId = obj["nodeId"];
+    if (nodeId != 0) {
+        _entries[findOrInsert(nodeId)].hop = hop;
+    }
+    if (obj.containsKey("subs")) {
+        JsonVariant subs = obj["subs"];
+        walkMeshGraph(subs, hop + 1);
+    }
+}
+
+/**
+ * メッセージログ追加
+ * 古いものから上書きする
+ */
+void FleetTable::logMessage(uint32_t from, MessageLogType type, time_t current) {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _log[_logHead].time = current;
+    _log[_logHead].from = from;
+    _log[_logHead].type = type;
+    _logHead = (_logHead + 1) % FLEET_LOG_SIZE;
+    xSemaphoreGive(_mutex);
+}
+
+/**
+ * メッセージログを古い順に [時刻, 送信元, 種別] の配列で取得
+ */
+void FleetTable::collectLog(JsonArray &log) {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    for (uint8_t i = 0; i < FLEET_LOG_SIZE; ++i) {
+        const MessageLogEntry &entry = _log[(_logHead + i) % FLEET_LOG_SIZE];
+        if (entry.type == LOG_NONE) {
+            continue;
+        }
+        JsonArray &item = log.createNestedArray();
+        item.add(entry.time);
+        item.add(entry.from);
+        item.add((uint8_t)entry.type);
+    }
+    xSemaphoreGive(_mutex);
+}
+
+/**
+ * テーブル復元
+ * RTC メモリの内容が正しければそれを使い、壊れている場合(電源投入時など)は SPIFFS から読み出す
+ */
+bool FleetTable::loadSnapshot() {
+    if (restore(rtcSnapshot)) {
+        DEBUG_MSG_F("fleet table restored from rtc:%u\n", _size);
+        return true;
+    }
+    File file = SPIFFS.open(FLEET_SNAPSHOT_PATH, "r");
+    if (!file) {
+        DEBUG_MSG_LN("fleet snapshot not found");
+        return false;
+    }
+    bool success = file.size() == sizeof(rtcSnapshot) &&
+                   file.read((uint8_t *)&rtcSnapshot, sizeof(rtcSnapshot)) == sizeof(rtcSnapshot) &&
+                   restore(rtcSnapshot);
+    file.close();
+    rtcPersistedCrc = success ? rtcSnapshot.crc : 0;
+    DEBUG_MSG_F("fleet table restored from spiffs:%d\n", success);
+    return success;
+}
+
+/**
+ * テーブル保存
+ * isPersist の場合は RTC メモリに加えて、電源断に備えて SPIFFS にも保存する
+ * Flash の書き込み回数を抑えるため SPIFFS の複製と同じ内容なら書き込まない
+ */
+void FleetTable::saveSnapshot(bool isPersist) {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    rtcSnapshot.magic = FLEET_SNAPSHOT_MAGIC;
+    rtcSnapshot.size = _size;
+    rtcSnapshot.logHead = _logHead;
+    memcpy(rtcSnapshot.nodeIds, _nodeIds, sizeof(_nodeIds));
+    memcpy(rtcSnapshot.entries, _entries, sizeof(_entries));
+    memcpy(rtcSnapshot.log, _log, sizeof(_log));
+    xSemaphoreGive(_mutex);
+    rtcSnapshot.crc = calcCrc(rtcSnapshot);
+    if (!isPersist || rtcSnapshot.crc == rtcPersistedCrc) {
+        return;
+    }
+    File file = SPIFFS.open(FLEET_SNAPSHOT_PATH, "w");
+    if (!file) {
+        DEBUG_MSG_LN("fleet snapshot open fail...");
+        return;
+    }
+    bool success = file.write((const uint8_t *)&rtcSnapshot, sizeof(rtcSnapshot)) ==
+                   sizeof(rtcSnapshot);
+    file.close();
+    rtcPersistedCrc = success ? rtcSnapshot.crc : 0;
+}
+
+/**
+ * CRC32 計算(magic, crc を除く)
+ */
+uint32_t FleetTable::calcCrc(const FleetSnapshot &snapshot) {
+    const uint8_t *data = (const uint8_t *)&snapshot.size;
+    return crc32_le(0, data, sizeof(FleetSnapshot) - offsetof(FleetSnapshot, size));
+}
+
+/**
+ * 複製から復元
+ */
+bool FleetTable::restore(const FleetSnapshot &snapshot) {
+    if (snapshot.magic != FLEET_SNAPSHOT_MAGIC || snapshot.size > FLEET_TABLE_SIZE ||
+        snapshot.logHead >= FLEET_LOG_SIZE || snapshot.crc != calcCrc(snapshot)) {
+        return false;
+    }
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _size = snapshot.size;
+    _logHead = snapshot.logHead;
+    memcpy(_nodeIds, snapshot.nodeIds, sizeof(_nodeIds));
+    memcpy(_entries, snapshot.entries, sizeof(_entries));
+    memcpy(_log, snapshot.log, sizeof(_log));
+    xSemaphoreGive(_mutex);
+    return true;
+}
@@ -0,0 +1,92 @@
+#ifndef INCLUDE_GUARD_FLEET_TABLE
+#define INCLUDE_GUARD_FLEET_TABLE
+
+#include "jsonArena.h"
+#include "moduleConfig.h"
+#include "trapCommon.h"
+#include <freertos/semphr.h>
+#include <rom/crc.h>
+
+#define FLEET_TABLE_SIZE 64    // 管理できる子モジュール数
+#define FLEET_HOP_UNKNOWN 0xff // ホップ数不明
+#define FLEET_LOG_SIZE 16      // メッセージログ数
+#define FLEET_SNAPSHOT_MAGIC 0x464c5431 // "FLT1"
+#define FLEET_SNAPSHOT_PATH "/fleet.bin"
+
+// メッセージログの種別
+enum MessageLogType : uint8_t {
+    LOG_NONE = 0,
+    LOG_MODULE_STATE,
+    LOG_CONFIG_UPDATE,
+    LOG_REQUEST_MODULE_STATE,
+    LOG_SYNC_SLEEP,
+    LOG_SYNC_SLEEP_ACK
+};
+
+// メッセージログ
+struct MessageLogEntry {
+    uint32_t time; // 受信時刻
+    uint32_t from; // 送信元 NodeId
+    MessageLogType type;
+};
+
+// 子モジュールの状態
+struct FleetEntry {
+    uint32_t lastSeen = 0;          // 最終受信時刻(0 の場合は状態未受信)
+    uint16_t battery = 0;           // analogRead の値
+    uint8_t hop = FLEET_HOP_UNKNOWN; // 親モジュールからのホップ数
+    bool trapFire = false;
+    bool cameraEnable = false;
+    bool batteryDead = false;
+};
+
+// DeepSleep 中も保持するテーブルの複製(RTC メモリに置くのでコンストラクタを持たない型のみ)
+struct FleetSnapshot {
+    uint32_t magic;
+    uint32_t crc; // magic, crc 以降の CRC32
+    uint8_t size;
+    uint8_t logHead;
+    uint32_t nodeIds[FLEET_TABLE_SIZE];
+    uint8_t entries[FLEET_TABLE_SIZE * sizeof(FleetEntry)];
+    MessageLogEntry log[FLEET_LOG_SIZE];
+};
+
+/**
+ * 親モジュールが受信したモジュール状態を NodeId 毎に保持する固定長テーブル
+ * NodeId は検索用に別配列にまとめて連続領域を走査する
+ * メッシュのループで更新し Web サーバから読み出すので排他する
+ * DeepSleep 前に RTC メモリへ退避し、復帰時はそこから復元する(電源投入時のみ SPIFFS から読む)
+ * SPIFFS へは親モジュールのみ、前回書き込んだ内容から変わった場合だけ書き込む
+ */
+class FleetTable {
+  private:
+    uint32_t _nodeIds[FLEET_TABLE_SIZE] = {0};
+    FleetEntry _entries[FLEET_TABLE_SIZE];
+    uint8_t _size = 0;
+    MessageLogEntry _log[FLEET_LOG_SIZE] = {};
+    uint8_t _logHead = 0; // 次に書き込む位置
+    SemaphoreHandle_t _mutex;
+
+  public:
+    FleetTable() { _mutex = xSemaphoreCreateMutex(); };
+    ~FleetTable() { vSemaphoreDelete(_mutex); };
+
+    void update(const ModuleState &state, time_t current);
+    void updateHops(JsonVariant meshGraph);
+    void printTo(String &json, uint32_t parentId, time_t current);
+    uint8_t size() { return _size; };
+    // メッセージログ
+    void logMessage(uint32_t from, MessageLogType type, time_t current);
+    void collectLog(JsonArray &log);
+    // DeepSleep 前後の保存と復元
+    bool loadSnapshot();
+    void saveSnapshot(bool isPersist);
+
+  private:
+    int16_t findOrInsert(uint32_t nodeId);
+    void walkMeshGraph(JsonVariant node, uint8_t hop);
+    static uint32_t calcCrc(const FleetSnapshot &snapshot);
+    bool restore(const FleetSnapshot &snapshot);
+};
+
+#endif // INCLUDE_GUARD_FLEET_TABLE
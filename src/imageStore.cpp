@@ -0,0 +1,183 @@
+#include "imageStore.h"
+// singleton
+SINGLETON_STORAGE ImageStore *ImageStore::_pImageStore = NULL;
+
+/**
+ * インデックスファイル読み込み
+ * ファイルが無い場合や壊れている場合は空のリングとして扱う
+ */
+bool ImageStore::loadIndex() {
+    DEBUG_MSG_LN("loadImageIndex");
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    for (auto &entry : _entries) {
+        entry = ImageEntry();
+    }
+    _lastSeq = 0;
+    File file = SPIFFS.open(IMAGE_INDEX_PATH, "r");
+    bool success = file && file.size() == sizeof(_entries) &&
+                   file.read((uint8_t *)_entries, sizeof(_entries)) == sizeof(_entries);
+    if (file) {
+        file.close();
+    }
+    if (!success) {
+        DEBUG_MSG_LN("image index not found");
+        for (auto &entry : _entries) {
+            entry = ImageEntry();
+        }
+    }
+    for (int8_t i = 0; i < IMAGE_RING_SIZE; ++i) {
+        // インデックスに対応する画像が無ければ空にする
+        if (_entries[i].state != IMAGE_EMPTY && !SPIFFS.exists(getPath(i))) {
+            _entries[i] = ImageEntry();
+        }
+        _lastSeq = max(_lastSeq, _entries[i].seq);
+    }
+    xSemaphoreGive(_mutex);
+    return success;
+}
+
+/**
+ * 撮影画像の書き込み開始
+ * 空きが無ければ最も古い送信済み画像、それも無ければ最も古い未送信画像を上書きする
+ * 送信中の画像は上書きしない
+ * 書き込み位置の決定と書き込み中の設定を排他した中で行い、書き込み中の画像は送信対象にしない
+ */
+int8_t ImageStore::beginWrite() {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    int8_t slot = -1;
+    for (int8_t i = 0; i < IMAGE_RING_SIZE; ++i) {
+        if (i == _sendingSlot) {
+            continue;
+        }
+        if (slot < 0) {
+            slot = i;
+            continue;
+        }
+        bool isUnsent = _entries[i].state == IMAGE_UNSENT;
+        bool isSlotUnsent = _entries[slot].state == IMAGE_UNSENT;
+        if (isUnsent != isSlotUnsent ? !isUnsent : _entries[i].seq < _entries[slot].seq) {
+            slot = i;
+        }
+    }
+    if (_entries[slot].state == IMAGE_UNSENT) {
+        DEBUG_MSG_F("overwrite unsent image %d\n", slot);
+    }
+    if (_entries[slot].state != IMAGE_EMPTY) {
+        _entries[slot] = ImageEntry();
+        _isIndexDirty = true;
+    }
+    _writingSlot = slot;
+    xSemaphoreGive(_mutex);
+    return slot;
+}
+
+/**
+ * 撮影画像を登録
+ */
+void ImageStore::commit(int8_t slot, uint32_t size, uint8_t resolution) {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _entries[slot].seq = ++_lastSeq;
+    _entries[slot].timestamp = now();
+    _entries[slot].size = size;
+    _entries[slot].resolution = resolution;
+    _entries[slot].state = IMAGE_UNSENT;
+    _isIndexDirty = true;
+    if (_writingSlot == slot) {
+        _writingSlot = -1;
+    }
+    xSemaphoreGive(_mutex);
+}
+
+/**
+ * 撮影・送信に失敗した画像を破棄
+ */
+void ImageStore::discard(int8_t slot) {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _entries[slot] = ImageEntry();
+    SPIFFS.remove(getPath(slot));
+    _isIndexDirty = true;
+    if (_writingSlot == slot) {
+        _writingSlot = -1;
+    }
+    if (_sendingSlot == slot) {
+        _sendingSlot = -1;
+    }
+    xSemaphoreGive(_mutex);
+}
+
+/**
+ * 未送信画像があるか
+ */
+bool ImageStore::hasUnsent() {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    bool hasUnsent = findOldestUnsent() >= 0;
+    xSemaphoreGive(_mutex);
+    return hasUnsent;
+}
+
+/**
+ * 画像の送信開始
+ * 最も古い未送信画像を送信中にして返し、未送信画像が無ければ -1 を返す
+ * 送信対象の決定と送信中の設定を排他した中で行うので、撮影タスクに上書きされない
+ */
+int8_t ImageStore::beginSend() {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    int8_t slot = findOldestUnsent();
+    _sendingSlot = slot;
+    xSemaphoreGive(_mutex);
+    return slot;
+}
+
+/**
+ * 画像の送信終了
+ * 成功した場合は送信済みにする
+ */
+void ImageStore::endSend(bool success) {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    if (success && _sendingSlot >= 0 && _entries[_sendingSlot].state == IMAGE_UNSENT) {
+        _entries[_sendingSlot].state = IMAGE_SENT;
+        _isIndexDirty = true;
+    }
+    _sendingSlot = -1;
+    xSemaphoreGive(_mutex);
+}
+
+/**
+ * インデックスファイル保存
+ * 撮影や送信の度には書き込まず、変更があった場合のみまとめて書き込む
+ */
+bool ImageStore::flushIndex() {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    if (!_isIndexDirty) {
+        xSemaphoreGive(_mutex);
+        return true;
+    }
+    File file = SPIFFS.open(IMAGE_INDEX_PATH, "w");
+    bool success = file;
+    if (success) {
+        success = file.write((const uint8_t *)_entries, sizeof(_entries)) == sizeof(_entries);
+        file.close();
+    } else {
+        DEBUG_MSG_LN("image index open fail...");
+    }
+    _isIndexDirty = !success;
+    xSemaphoreGive(_mutex);
+    return success;
+}
+
+/**
+ * 最も古い未送信画像(書き込み中の画像を除く)
+ * 未送信画像が無ければ -1 を返す(排他した中で呼ぶ)
+ */
+int8_t ImageStore::findOldestUnsent() {
+    int8_t slot = -1;
+    for (int8_t i = 0; i < IMAGE_RING_SIZE; ++i) {
+        if (_entries[i].state != IMAGE_UNSENT || i == _writingSlot) {
+            continue;
+        }
+        if (slot < 0 || _entries[i].seq < _entries[slot].seq) {
+            slot = i;
+        }
+    }
+    return slot;
+}
@@ -0,0 +1,70 @@
+#ifndef INCLUDE_GUARD_IMAGE_STORE
+#define INCLUDE_GUARD_IMAGE_STORE
+
+#include "trapCommon.h"
+#include <TimeLib.h>
+#include <freertos/semphr.h>
+
+// 画像の状態
+enum ImageState : uint8_t { IMAGE_EMPTY = 0, IMAGE_UNSENT, IMAGE_SENT };
+
+// インデックスファイルに保存する画像情報
+struct ImageEntry {
+    uint32_t seq = 0;        // 撮影順の通し番号
+    uint32_t timestamp = 0;  // 撮影時刻
+    uint32_t size = 0;       // 画像サイズ[byte]
+    uint8_t resolution = 0;  // 解像度
+    ImageState state = IMAGE_EMPTY;
+};
+
+/**
+ * SPIFFS 上の固定数の画像ファイルをリングバッファとして管理する
+ * 撮影時は最も古い画像を上書きし、送信時は最も古い未送信画像から送る
+ * カメラタスクとメッシュのループから呼ばれるので排他する
+ */
+class ImageStore {
+  private:
+    static SINGLETON_STORAGE ImageStore *_pImageStore;
+
+    ImageEntry _entries[IMAGE_RING_SIZE];
+    uint32_t _lastSeq = 0;
+    int8_t _sendingSlot = -1; // 送信中の画像(上書きしない)
+    int8_t _writingSlot = -1; // 書き込み中の画像(送信しない)
+    bool _isIndexDirty = false; // インデックスファイルに未反映の変更がある
+    SemaphoreHandle_t _mutex;
+
+  public:
+    static ImageStore *getInstance() {
+        if (_pImageStore == NULL) {
+            _pImageStore = new ImageStore();
+        }
+        return _pImageStore;
+    }
+    static void deleteInstance() {
+        if (_pImageStore == NULL) {
+            return;
+        }
+        delete _pImageStore;
+        _pImageStore = NULL;
+    }
+
+    bool loadIndex();
+    bool flushIndex();
+    // 撮影
+    int8_t beginWrite();
+    void commit(int8_t slot, uint32_t size, uint8_t resolution);
+    void discard(int8_t slot);
+    // 送信
+    bool hasUnsent();
+    int8_t beginSend();
+    void endSend(bool success);
+    int8_t getSendingSlot() { return _sendingSlot; }
+    static String getPath(int8_t slot) { return String("/img_") + String(slot) + ".jpg"; }
+
+  private:
+    ImageStore() { _mutex = xSemaphoreCreateMutex(); };
+    ~ImageStore() { vSemaphoreDelete(_mutex); };
+    int8_t findOldestUnsent();
+};
+
+#endif // INCLUDE_GUARD_IMAGE_STORE
@@ -0,0 +1,71 @@
+#ifndef INCLUDE_GUARD_JSON_ARENA
+#define INCLUDE_GUARD_JSON_ARENA
+
+#include "trapCommon.h"
+#include <ArduinoJson.h>
+#include <esp_heap_caps.h>
+#include <freertos/semphr.h>
+
+/**
+ * 使い回す JSON バッファ
+ * メッセージ毎にバッファを確保・解放するとヒープが断片化するので、
+ * 実行コンテキスト(メッシュのループ、Web サーバ)毎に 1 つ確保して使い回す
+ * 使用時は JsonArenaLock で排他し、使用前にクリアする
+ * バッファサイズは各コンテキストで組み立てる JSON の最大サイズに合わせる
+ */
+template <size_t SIZE> class JsonArena {
+  private:
+    StaticJsonBuffer<SIZE> _jsonBuf;
+    SemaphoreHandle_t _mutex;
+    const char *_name;
+
+  public:
+    JsonArena(const char *name) : _name(name) { _mutex = xSemaphoreCreateMutex(); };
+
+    template <size_t> friend class JsonArenaLock;
+};
+
+/**
+ * JsonArena の排他と使用前のクリアを行う
+ * スコープを抜けると解放される
+ */
+template <size_t SIZE> class JsonArenaLock {
+  private:
+    JsonArena<SIZE> &_arena;
+
+  public:
+    JsonArenaLock(JsonArena<SIZE> &arena) : _arena(arena) {
+        xSemaphoreTake(_arena._mutex, portMAX_DELAY);
+        _arena._jsonBuf.clear();
+    };
+    ~JsonArenaLock() { xSemaphoreGive(_arena._mutex); };
+    StaticJsonBuffer<SIZE> &buffer() { return _arena._jsonBuf; };
+    /**
+     * バッファが溢れたか
+     * ArduinoJson は確保に失敗した要素を黙って捨てるので、残りが 1 要素分未満なら
+     * 途中で確保に失敗した(JSON が欠けている)可能性がある
+     */
+    bool isOverflowed() {
+        if (_arena._jsonBuf.size() + JSON_OBJECT_SIZE(1) <= SIZE) {
+            return false;
+        }
+        DEBUG_MSG_F("json arena %s overflowed:%u/%u\n", _arena._name, _arena._jsonBuf.size(),
+                    SIZE);
+        return true;
+    };
+};
+
+// メッシュのループ用
+typedef JsonArena<JSON_BUF_NUM> MeshJsonArena;
+typedef JsonArenaLock<JSON_BUF_NUM> MeshJsonArenaLock;
+typedef StaticJsonBuffer<JSON_BUF_NUM> ArenaJsonBuffer;
+
+/**
+ * ヒープ状態(空き容量と最大連続空き領域)のログ出力
+ */
+inline void logHeap(const char *tag) {
+    DEBUG_MSG_F("heap %s free:%u largest:%u\n", tag, ESP.getFreeHeap(),
+                (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
+
+#endif // INCLUDE_GUARD_JSON_ARENA
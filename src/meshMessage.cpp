@@ -0,0 +1,73 @@
+#include "meshMessage.h"
+
+/**
+ * ヘッダ読み出し
+ */
+bool MeshMessage::readHeader(const String &msg, MeshMessageHeader &header) {
+    uint8_t data[MESH_MSG_DEC_BUF_LEN];
+    if (decode(msg, data) < (int)sizeof(MeshMessageHeader)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(MeshMessageHeader));
+    return true;
+}
+
+/**
+ * モジュール状態メッセージ作成
+ */
+String MeshMessage::encodeModuleState(const ModuleState &state) {
+    PackedModuleState packed;
+    packed.header.version = MESH_MSG_VERSION;
+    packed.header.type = MESH_MSG_MODULE_STATE;
+    packed.battery = state.batery;
+    packed.flags = (state.trapFire ? MODULE_STATE_TRAP_FIRE : 0) |
+                   (state.cameraEnable ? MODULE_STATE_CAMERA_ENABLE : 0) |
+                   (state.batteryDead ? MODULE_STATE_BATTERY_DEAD : 0);
+    return encode((const uint8_t *)&packed, sizeof(packed));
+}
+
+/**
+ * モジュール状態メッセージ解析
+ * 新しいバージョンで後ろにフィールドが追加されていても既知の部分だけ読み出す
+ */
+bool MeshMessage::decodeModuleState(uint32_t from, const String &msg, ModuleState &state) {
+    uint8_t data[MESH_MSG_DEC_BUF_LEN];
+    if (decode(msg, data) < (int)sizeof(PackedModuleState)) {
+        return false;
+    }
+    PackedModuleState packed;
+    memcpy(&packed, data, sizeof(packed));
+    if (packed.header.type != MESH_MSG_MODULE_STATE) {
+        return false;
+    }
+    state.nodeId = from;
+    state.batery = packed.battery;
+    state.trapFire = packed.flags & MODULE_STATE_TRAP_FIRE;
+    state.cameraEnable = packed.flags & MODULE_STATE_CAMERA_ENABLE;
+    state.batteryDead = packed.flags & MODULE_STATE_BATTERY_DEAD;
+    return true;
+}
+
+/**
+ * 識別文字 + Base64
+ */
+String MeshMessage::encode(const uint8_t *data, int len) {
+    char enc[MESH_MSG_ENC_LEN + 1];
+    int encLen = base64_encode(enc, (char *)data, len);
+    enc[encLen] = '\0';
+    return String(MESH_MSG_PREFIX) + enc;
+}
+
+/**
+ * Base64 デコード
+ * data は MESH_MSG_DEC_BUF_LEN 以上の長さが必要
+ * デコード後の長さを返す(バイナリメッセージでない場合、MESH_MSG_MAX_LEN を超える場合は -1)
+ */
+int MeshMessage::decode(const String &msg, uint8_t *data) {
+    int inputLen = msg.length() - 1;
+    if (!isBinary(msg) || inputLen <= 0 || inputLen > MESH_MSG_ENC_LEN) {
+        return -1;
+    }
+    int len = base64_decode((char *)data, (char *)msg.c_str() + 1, inputLen);
+    return len > MESH_MSG_MAX_LEN ? -1 : len;
+}
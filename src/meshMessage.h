@@ -0,0 +1,54 @@
+#ifndef INCLUDE_GUARD_MESH_MESSAGE
+#define INCLUDE_GUARD_MESH_MESSAGE
+
+#include "moduleConfig.h"
+#include "trapCommon.h"
+#include <ArduinoBase64.h>
+
+// バイナリメッセージ
+// painlessMesh は String でメッセージを送るので、ヘッダとペイロードを Base64 にして先頭に識別文字を付ける
+#define MESH_MSG_PREFIX '~'
+#define MESH_MSG_VERSION 1   // バイナリ形式のバージョン(0 の場合は JSON のみ対応)
+#define MESH_MSG_MAX_LEN 32  // デコード後の最大長[byte]
+#define MESH_MSG_ENC_LEN ((MESH_MSG_MAX_LEN + 2) / 3 * 4) // Base64 エンコード後の最大長
+// デコード先バッファ長(MESH_MSG_ENC_LEN 文字のデコード結果と base64_decode が付ける終端文字)
+#define MESH_MSG_DEC_BUF_LEN (MESH_MSG_ENC_LEN / 4 * 3 + 1)
+
+// メッセージ種別
+enum MeshMessageType : uint8_t { MESH_MSG_MODULE_STATE = 1 };
+
+// 共通ヘッダ
+struct __attribute__((packed)) MeshMessageHeader {
+    uint8_t version;
+    uint8_t type;
+};
+
+// モジュール状態(送信元 NodeId はメッシュから分かるので含めない)
+#define MODULE_STATE_TRAP_FIRE 0x01
+#define MODULE_STATE_CAMERA_ENABLE 0x02
+#define MODULE_STATE_BATTERY_DEAD 0x04
+struct __attribute__((packed)) PackedModuleState {
+    MeshMessageHeader header;
+    uint16_t battery; // analogRead の値
+    uint8_t flags;
+};
+
+/**
+ * バイナリ形式のメッシュメッセージの作成と解析
+ * 解析はスタック上のバッファで行いヒープを使わない
+ */
+class MeshMessage {
+  public:
+    static bool isBinary(const String &msg) {
+        return msg.length() > 0 && msg[0] == MESH_MSG_PREFIX;
+    };
+    static bool readHeader(const String &msg, MeshMessageHeader &header);
+    static String encodeModuleState(const ModuleState &state);
+    static bool decodeModuleState(uint32_t from, const String &msg, ModuleState &state);
+
+  private:
+    static String encode(const uint8_t *data, int len);
+    static int decode(const String &msg, uint8_t *data);
+};
+
+#endif // INCLUDE_GUARD_MESH_MESSAGE
@@ -0,0 +1,63 @@
+#include "messageDispatcher.h"
+
+/**
+ * ハンドラ登録
+ * キーは文字列リテラルなど登録後も有効なものを渡すこと
+ */
+bool MessageDispatcher::on(const char *key, MessageHandler handler) {
+    if (_handlers.size() >= MESSAGE_HANDLER_MAX || _index.count(key) != 0) {
+        DEBUG_MSG_F("handler register fail:%s\n", key);
+        return false;
+    }
+    _index[key] = _handlers.size();
+    HandlerEntry entry;
+    entry.key = key;
+    entry.handler = handler;
+    _handlers.push_back(entry);
+    return true;
+}
+
+/**
+ * メッセージに含まれるキーのハンドラを呼び出す
+ * 呼び出したハンドラ数を返す
+ */
+uint8_t MessageDispatcher::dispatch(uint32_t from, JsonObject &msg) {
+    uint32_t matched = 0;
+    for (JsonPair &pair : msg) {
+        auto it = _index.find(pair.key);
+        if (it != _index.end()) {
+            matched |= 1UL << it->second;
+        }
+    }
+    uint8_t handled = 0;
+    for (uint8_t i = 0; matched != 0; ++i, matched >>= 1) {
+        if ((matched & 1) == 0) {
+            continue;
+        }
+        HandlerEntry &entry = _handlers[i];
+        unsigned long start = micros();
+        entry.handler(from, msg);
+        unsigned long elapsed = micros() - start;
+        ++entry.stats.count;
+        entry.stats.total += elapsed;
+        entry.stats.maxTime = max(entry.stats.maxTime, elapsed);
+        ++handled;
+    }
+    return handled;
+}
+
+/**
+ * ハンドラ毎の処理統計を取得
+ * 呼び出されていないハンドラは含めない
+ */
+void MessageDispatcher::collectStats(JsonObject &stats) {
+    for (HandlerEntry &entry : _handlers) {
+        if (entry.stats.count == 0) {
+            continue;
+        }
+        JsonObject &handlerStats = stats.createNestedObject(entry.key);
+        handlerStats[KEY_HANDLER_COUNT] = entry.stats.count;
+        handlerStats[KEY_HANDLER_AVERAGE] = entry.stats.total / entry.stats.count;
+        handlerStats[KEY_HANDLER_MAX] = entry.stats.maxTime;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef INCLUDE_GUARD_MESSAGE_DISPATCHER
+#define INCLUDE_GUARD_MESSAGE_DISPATCHER
+
+#include "trapCommon.h"
+#include <ArduinoJson.h>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#define MESSAGE_HANDLER_MAX 32 // 登録できるハンドラ数
+
+typedef std::function<void(uint32_t from, JsonObject &msg)> MessageHandler;
+
+/**
+ * メッセージのキーのハッシュ値(FNV-1a)
+ * case ラベルにも使えるようにコンパイル時に計算できる形で書く
+ */
+constexpr uint32_t messageKeyHash(const char *key, uint32_t hash = 2166136261u) {
+    return *key == '\0' ? hash : messageKeyHash(key + 1, (hash ^ (uint8_t)*key) * 16777619u);
+}
+
+// ハンドラ毎の処理統計
+struct MessageHandlerStats {
+    uint32_t count = 0;         // 呼び出し回数
+    unsigned long total = 0;    // 合計処理時間[usec]
+    unsigned long maxTime = 0;  // 最大処理時間[usec]
+};
+
+/**
+ * メッセージのキーに対応するハンドラを呼び出す
+ * メッセージのフィールドを 1 度だけ走査し、各キーのハンドラをハッシュで引く
+ * 1 つのメッセージに複数のキーが含まれる場合は登録順に呼び出す
+ */
+class MessageDispatcher {
+  private:
+    struct KeyHash {
+        size_t operator()(const char *key) const { return messageKeyHash(key); }
+    };
+    struct KeyEqual {
+        bool operator()(const char *a, const char *b) const { return strcmp(a, b) == 0; }
+    };
+    struct HandlerEntry {
+        const char *key;
+        MessageHandler handler;
+        MessageHandlerStats stats;
+    };
+    std::vector<HandlerEntry> _handlers;
+    std::unordered_map<const char *, uint8_t, KeyHash, KeyEqual> _index;
+
+  public:
+    bool on(const char *key, MessageHandler handler);
+    uint8_t dispatch(uint32_t from, JsonObject &msg);
+    void collectStats(JsonObject &stats);
+};
+
+#endif // INCLUDE_GUARD_MESSAGE_DISPATCHER
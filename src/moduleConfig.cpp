@@ -1,6 +1,11 @@
 #include "moduleConfig.h"
 // singleton
-ModuleConfig *ModuleConfig::_pModuleConfig = NULL;
+SINGLETON_STORAGE ModuleConfig *ModuleConfig::_pModuleConfig = NULL;
+// DeepSleep 中も保持される設定値
+RTC_DATA_ATTR static ConfigRecord rtcConfig;
+// 設定値の書き込み回数と、変更が無く書き込みを省略した回数(DeepSleep 中も保持される)
+RTC_DATA_ATTR static uint32_t configWriteNum = 0;
+RTC_DATA_ATTR static uint32_t configWriteAvoidedNum = 0;
 
 /***********************************
  * module method
@@ -17,9 +22,13 @@ void ModuleConfig::collectModuleInfo(painlessMesh &mesh, JsonObject &moduleInfo)
     moduleInfo[KEY_GPS_LON] = _lon;
     moduleInfo[KEY_ACTIVE_START] = _activeStart;
     moduleInfo[KEY_ACTIVE_END] = _activeEnd;
+    moduleInfo[KEY_WAKE_SCHEDULE] = getWakeScheduleHex();
     moduleInfo[KEY_CAMERA_ENABLE] = _cameraEnable;
+    moduleInfo[KEY_CAMERA_PACKET_SIZE] = _cameraPacketSize;
     moduleInfo[KEY_PARENT_NODE_ID] = _parentNodeId;
     moduleInfo[KEY_CURRENT_TIME] = now();
+    moduleInfo[KEY_CONFIG_WRITE_NUM] = configWriteNum;
+    moduleInfo[KEY_CONFIG_WRITE_AVOIDED_NUM] = configWriteAvoidedNum;
     // モジュールリスト
     JsonArray &nodeList = moduleInfo.createNestedArray(KEY_NODE_LIST);
     SimpleList<uint32_t> nodes = mesh.getNodeList();
@@ -35,11 +44,13 @@ void ModuleConfig::collectModuleInfo(painlessMesh &mesh, JsonObject &moduleInfo)
 void ModuleConfig::collectModuleConfig(JsonObject &moduleConfig) {
     moduleConfig[KEY_ACTIVE_START] = _activeStart;
     moduleConfig[KEY_ACTIVE_END] = _activeEnd;
+    moduleConfig[KEY_WAKE_SCHEDULE] = getWakeScheduleHex();
     moduleConfig[KEY_PARENT_NODE_ID] = _parentNodeId;
     moduleConfig[KEY_GPS_LAT] = _lat;
     moduleConfig[KEY_GPS_LON] = _lon;
     moduleConfig[KEY_WAKE_TIME] = _wakeTime;
     moduleConfig[KEY_TRAP_MODE] = _trapMode;
+    moduleConfig[KEY_CAMERA_PACKET_SIZE] = _cameraPacketSize;
 }
 
 /**
@@ -54,6 +65,17 @@ void ModuleConfig::collectModuleState(JsonObject &state) {
     state[KEY_CURRENT_BATTERY] = realBattery;
 }
 
+/**
+ * モジュール状態を取得(バイナリ形式での送信用)
+ */
+void ModuleConfig::collectModuleState(ModuleState &state) {
+    state.nodeId = _nodeId;
+    state.batery = analogRead(A0);
+    state.batteryDead = _isBatteryDead;
+    state.trapFire = _trapFire;
+    state.cameraEnable = _cameraEnable;
+}
+
 /**
  * デフォルト設定を書き込む
  */
@@ -68,17 +90,125 @@ void ModuleConfig::setDefaultModuleConfig() {
     _parentNodeId = DEF_NODEID;
     _nodeNum = DEF_NODE_NUM;
     _wakeTime = DEF_WAKE_TIME;
+    _cameraPacketSize = DEF_CAMERA_PACKET_SIZE;
+    setWakeScheduleRange(DEF_ACTIVE_START, DEF_ACTIVE_END);
+    // 保存されている設定値が無いので全項目を保存対象にする
+    _dirtyFields = CONFIG_ALL;
 }
 
 /**
  * モジュールに保存してある設定を読み出す
- * ファイルが存在しない場合や（初回起動時）読み込みエラーのとき
- * はデフォルト値の設定ファイルを作成する
+ * DeepSleep からの復帰時は RTC メモリ、電源投入時は NVS のバイナリ形式の設定値を使う
+ * どちらも無い場合は旧形式の設定ファイル(JSON)から読み込んでバイナリ形式に移行する
+ */
+bool ModuleConfig::loadModuleConfig() {
+    DEBUG_MSG_LN("loadModuleConfig");
+    unsigned long start = micros();
+    ConfigRecord record;
+    bool isFromRtc = false;
+    bool success = loadConfigRecord(record, isFromRtc);
+    if (success) {
+        applyConfigRecord(record, isFromRtc);
+    } else {
+        success = loadModuleConfigJson();
+    }
+    _configLoadTime = micros() - start;
+    DEBUG_MSG_F("config load time:%lu[usec]\n", _configLoadTime);
+    return success;
+}
+
+/**
+ * バイナリ形式の設定値読み出し
+ * RTC メモリの内容が正しければそれを使い、壊れている場合は NVS から読み出す
+ * NVS には A/B 2 つの領域に交互に書き込んでいるので、正しいもののうち通し番号が大きい方を使う
+ * 書き込み中に電源が落ちて片方が壊れていても、もう片方の前回の設定値で起動できる
+ */
+bool ModuleConfig::loadConfigRecord(ConfigRecord &record, bool &isFromRtc) {
+    isFromRtc = isValidRecord(rtcConfig);
+    if (isFromRtc) {
+        DEBUG_MSG_LN("config loaded from rtc");
+        record = rtcConfig;
+        _configSeq = record.seq;
+        return true;
+    }
+    Preferences prefs;
+    if (!prefs.begin(CONFIG_NVS_NAMESPACE, true)) {
+        return false;
+    }
+    ConfigRecord recordB;
+    bool isValidA = readConfigRecord(prefs, CONFIG_NVS_KEY_A, record);
+    bool isValidB = readConfigRecord(prefs, CONFIG_NVS_KEY_B, recordB);
+    prefs.end();
+    if (!isValidA && !isValidB) {
+        DEBUG_MSG_LN("config record not found");
+        return false;
+    }
+    // 通し番号の比較は桁あふれを考慮して差で行う
+    if (!isValidA || (isValidB && (int32_t)(recordB.seq - record.seq) > 0)) {
+        record = recordB;
+    }
+    DEBUG_MSG_F("config loaded from nvs seq:%u(A:%d B:%d)\n", record.seq, isValidA, isValidB);
+    _configSeq = record.seq;
+    rtcConfig = record;
+    return true;
+}
+
+/**
+ * NVS の指定領域から設定値を読み出す
+ */
+bool ModuleConfig::readConfigRecord(Preferences &prefs, const char *key, ConfigRecord &record) {
+    return prefs.getBytes(key, &record, sizeof(record)) == sizeof(record) && isValidRecord(record);
+}
+
+/**
+ * バイナリ形式の設定値を反映
  * 設置モード強制起動の場合は親モジュール情報をクリアして設定情報を保存する
+ * 起動時刻は RTC メモリにのみ保存しているので、NVS から読んだ値で現在時刻は合わせない
  */
-bool ModuleConfig::loadModuleConfigFile() {
-    DEBUG_MSG_LN("loadModuleConfigFile");
-    File file = SPIFFS.open("/config.json", "r");
+void ModuleConfig::applyConfigRecord(const ConfigRecord &record, bool isFromRtc) {
+    _trapMode = record.trapMode;
+    memcpy(_lat, record.lat, GPS_STR_LEN);
+    memcpy(_lon, record.lon, GPS_STR_LEN);
+    _lat[GPS_STR_LEN - 1] = '\0';
+    _lon[GPS_STR_LEN - 1] = '\0';
+    _activeStart = record.activeStart;
+    _activeEnd = record.activeEnd;
+    _nodeNum = record.nodeNum;
+    _cameraPacketSize = record.cameraPacketSize;
+    memcpy(_wakeSchedule, record.wakeSchedule, sizeof(_wakeSchedule));
+    // 設置モードでの起動時は親モジュール情報などは読み込まない
+    if (_trapMode) {
+        _parentNodeId = record.parentNodeId;
+        _trapFire = record.trapFire;
+        _wakeTime = record.wakeTime;
+        // DeepSleep から罠モードで起動した場合は現在時刻を起動時刻と同時刻にセット
+        // 電源投入時の NVS の起動時刻は古いので、親モジュールからの時刻同期を待つ
+        if (isFromRtc) {
+            setTime(_wakeTime);
+        }
+    }
+    // 保存されている値と同じなので保存対象の項目は無い
+    _dirtyFields = 0;
+    // 強制設置モード起動
+    // 罠モードから強制設置モードで起動しても、設定値更新せず電源を切ると
+    // 再度罠モードで起動してしまうのでここで一旦設定値を保存する(罠モードだった場合のみ書き込まれる)
+    if (digitalRead(FORCE_SETTING_MODE_PIN) == HIGH) {
+        DEBUG_MSG_LN("Force Setting Mode");
+        setField(_trapMode, false, CONFIG_TRAP_MODE);
+        saveCurrentModuleConfig();
+    }
+    _isTrapStart = false;
+}
+
+/**
+ * 旧形式の設定ファイル(JSON)を読み出す
+ * ファイルが存在しない場合や（初回起動時）読み込みエラーのとき
+ * はデフォルト値の設定を保存する
+ * 読み込めた場合はバイナリ形式で保存し直して設定ファイルは削除する
+ */
+bool ModuleConfig::loadModuleConfigJson() {
+    DEBUG_MSG_LN("loadModuleConfigJson");
+    File file = SPIFFS.open(CONFIG_JSON_PATH, "r");
     // 初回起動
     if (!file) {
         DEBUG_MSG_LN("file not found...\nmaybe this is first using of this module");
@@ -134,6 +264,11 @@ bool ModuleConfig::loadModuleConfigFile() {
     config.printTo(param);
     DEBUG_MSG_LN(param);
 #endif
+    // バイナリ形式に移行
+    _dirtyFields = CONFIG_ALL;
+    if (saveCurrentModuleConfig()) {
+        SPIFFS.remove(CONFIG_JSON_PATH);
+    }
     return true;
 }
 
@@ -147,101 +282,221 @@ void ModuleConfig::updateModuleConfig(const JsonObject &config) {
         setDefaultModuleConfig();
         return;
     }
-    // 稼働開始時刻
-    if (config.containsKey(KEY_ACTIVE_START)) {
-        setParameter(_activeStart, static_cast<uint8_t>(config[KEY_ACTIVE_START]), 24, 0);
-    }
-    // 稼働終了時刻
-    if (config.containsKey(KEY_ACTIVE_END)) {
-        setParameter(_activeEnd, static_cast<uint8_t>(config[KEY_ACTIVE_END]), 24, 0);
-    }
-    // 親モジュール ID
-    if (config.containsKey(KEY_PARENT_NODE_ID)) {
-        _parentNodeId = config[KEY_PARENT_NODE_ID];
-    }
-    // ノードサイズ
-    if (config.containsKey(KEY_NODE_NUM)) {
-        _nodeNum = config[KEY_NODE_NUM];
-    }
-    // GPS 情報
-    if (config.containsKey(KEY_GPS_LAT) && config.containsKey(KEY_GPS_LON)) {
-        updateGpsInfo(config[KEY_GPS_LAT], config[KEY_GPS_LON]);
+    // 他の項目と合わせて反映するものは走査後に反映する
+    bool hasWakeSchedule = false;
+    const char *wakeSchedule = NULL;
+    bool isRangeChanged = false;
+    const char *lat = NULL;
+    const char *lon = NULL;
+    // フィールドを 1 度だけ走査し、キーのハッシュ値で振り分ける
+    for (const JsonPair &kv : config) {
+        auto isKey = [&kv](const char *key) { return strcmp(kv.key, key) == 0; };
+        switch (messageKeyHash(kv.key)) {
+        // 稼働開始時刻
+        case messageKeyHash(KEY_ACTIVE_START):
+            if (isKey(KEY_ACTIVE_START)) {
+                setParameter(_activeStart, kv.value.as<uint8_t>(), 24, 0, CONFIG_ACTIVE_START);
+                isRangeChanged = true;
+            }
+            break;
+        // 稼働終了時刻
+        case messageKeyHash(KEY_ACTIVE_END):
+            if (isKey(KEY_ACTIVE_END)) {
+                setParameter(_activeEnd, kv.value.as<uint8_t>(), 24, 0, CONFIG_ACTIVE_END);
+                isRangeChanged = true;
+            }
+            break;
+        // 起動スケジュール
+        case messageKeyHash(KEY_WAKE_SCHEDULE):
+            if (isKey(KEY_WAKE_SCHEDULE)) {
+                hasWakeSchedule = true;
+                wakeSchedule = kv.value.as<const char *>();
+            }
+            break;
+        // 親モジュール ID
+        case messageKeyHash(KEY_PARENT_NODE_ID):
+            if (isKey(KEY_PARENT_NODE_ID)) {
+                setField(_parentNodeId, kv.value.as<uint32_t>(), CONFIG_PARENT_NODE_ID);
+            }
+            break;
+        // ノードサイズ
+        case messageKeyHash(KEY_NODE_NUM):
+            if (isKey(KEY_NODE_NUM)) {
+                setField(_nodeNum, kv.value.as<uint8_t>(), CONFIG_NODE_NUM);
+            }
+            break;
+        // GPS 情報
+        case messageKeyHash(KEY_GPS_LAT):
+            if (isKey(KEY_GPS_LAT)) {
+                lat = kv.value.as<const char *>();
+            }
+            break;
+        case messageKeyHash(KEY_GPS_LON):
+            if (isKey(KEY_GPS_LON)) {
+                lon = kv.value.as<const char *>();
+            }
+            break;
+        // GPS 初期化
+        case messageKeyHash(KEY_INIT_GPS):
+            if (isKey(KEY_INIT_GPS)) {
+                initGps();
+            }
+            break;
+        // 次回起動時刻情報
+        case messageKeyHash(KEY_WAKE_TIME):
+            if (isKey(KEY_WAKE_TIME)) {
+                setField(_wakeTime, kv.value.as<time_t>(), CONFIG_WAKE_TIME);
+            }
+            break;
+        // 現在時刻情報
+        case messageKeyHash(KEY_CURRENT_TIME):
+            if (isKey(KEY_CURRENT_TIME)) {
+                setTime(kv.value.as<time_t>());
+            }
+            break;
+        // 罠作動
+        case messageKeyHash(KEY_TRAP_FIRE):
+            if (isKey(KEY_TRAP_FIRE)) {
+                setField(_trapFire, kv.value.as<bool>(), CONFIG_TRAP_FIRE);
+            }
+            break;
+        // カメラパケットサイズ
+        case messageKeyHash(KEY_CAMERA_PACKET_SIZE):
+            if (isKey(KEY_CAMERA_PACKET_SIZE)) {
+                uint16_t packetSize = kv.value.as<uint16_t>();
+                if (packetSize == CAMERA_PACKET_SIZE_AUTO) {
+                    setField(_cameraPacketSize, (uint16_t)CAMERA_PACKET_SIZE_AUTO,
+                             CONFIG_CAMERA_PACKET_SIZE);
+                } else {
+                    setParameter(_cameraPacketSize, packetSize, CAMERA_PACKET_SIZE_MAX,
+                                 CAMERA_PACKET_SIZE_MIN, CONFIG_CAMERA_PACKET_SIZE);
+                }
+            }
+            break;
+        // 罠モード
+        case messageKeyHash(KEY_TRAP_MODE):
+            if (isKey(KEY_TRAP_MODE)) {
+                bool preTrapMode = _trapMode;
+                setField(_trapMode, kv.value.as<bool>(), CONFIG_TRAP_MODE);
+                if (!preTrapMode && _trapMode) {
+                    DEBUG_MSG_LN("Trap start!");
+                    _isTrapStart = true;
+                }
+            }
+            break;
+        default:
+            break;
+        }
     }
-    // GPS 初期化
-    if (config.containsKey(KEY_INIT_GPS)) {
-        initGps();
+    // 起動スケジュール
+    // 指定が無く稼働時間帯が変わった場合は稼働時間帯の毎正時に起動する
+    if (hasWakeSchedule) {
+        setWakeSchedule(wakeSchedule);
+    } else if (isRangeChanged) {
+        setWakeScheduleRange(_activeStart, _activeEnd);
     }
-    // 次回起動時刻情報
-    if (config.containsKey(KEY_WAKE_TIME)) {
-        _wakeTime = config[KEY_WAKE_TIME];
-    }
-    // 現在時刻情報
-    if (config.containsKey(KEY_CURRENT_TIME)) {
-        setTime(config[KEY_CURRENT_TIME]);
-    }
-    // 罠作動
-    if (config.containsKey(KEY_TRAP_FIRE)) {
-        _trapFire = config[KEY_TRAP_FIRE];
-    }
-    // 罠モード
-    if (config.containsKey(KEY_TRAP_MODE)) {
-        bool preTrapMode = _trapMode;
-        _trapMode = config[KEY_TRAP_MODE];
-        if (!preTrapMode && _trapMode) {
-            DEBUG_MSG_LN("Trap start!");
-            _isTrapStart = true;
-        }
+    // GPS 情報(緯度と経度が揃っている場合のみ)
+    if (lat && lon) {
+        updateGpsInfo(lat, lon);
     }
 }
 
 /**
  * 最大値と最小値を考慮した値設定
+ * 値が変わった場合は保存対象にする
  */
 template <class T>
-void ModuleConfig::setParameter(T &targetParam, const T &setParam, const int maxV, const int minV) {
+void ModuleConfig::setParameter(T &targetParam, const T &setParam, const int maxV, const int minV,
+                                ConfigField fieldBit) {
     if (setParam >= minV && setParam <= maxV) {
-        targetParam = setParam;
+        setField(targetParam, setParam, fieldBit);
     } else {
-        targetParam = setParam < minV ? minV : maxV;
+        setField(targetParam, static_cast<T>(setParam < minV ? minV : maxV), fieldBit);
     }
 }
 
 /**
- * 設定ファイルを保存
- */
-bool ModuleConfig::saveModuleConfig(const JsonObject &config) {
-    File file = SPIFFS.open("/config.json", "w");
-    if (!file) {
-        DEBUG_MSG_LN("File Open Error");
+ * 現在の設定値を保存
+ * RTC メモリと NVS にバイナリ形式で保存する
+ * NVS への書き込みは前回保存時から変更された項目がある場合のみ行う
+ * NVS には通し番号を 1 つ増やして、最新の設定値が入っていない方の領域に書き込む
+ **/
+bool ModuleConfig::saveCurrentModuleConfig() {
+    DEBUG_MSG_F("saveCurrentModuleConfig dirty:0x%x\n", _dirtyFields);
+    ConfigRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = CONFIG_RECORD_MAGIC;
+    record.version = CONFIG_RECORD_VERSION;
+    record.seq = _dirtyFields == 0 ? _configSeq : _configSeq + 1;
+    record.trapMode = _trapMode;
+    record.trapFire = _trapFire;
+    memcpy(record.lat, _lat, GPS_STR_LEN);
+    memcpy(record.lon, _lon, GPS_STR_LEN);
+    record.activeStart = _activeStart;
+    record.activeEnd = _activeEnd;
+    record.parentNodeId = _parentNodeId;
+    record.wakeTime = _wakeTime;
+    record.nodeNum = _nodeNum;
+    record.cameraPacketSize = _cameraPacketSize;
+    memcpy(record.wakeSchedule, _wakeSchedule, sizeof(record.wakeSchedule));
+    record.crc = calcCrc(record);
+    rtcConfig = record;
+    if (_dirtyFields == 0) {
+        ++configWriteAvoidedNum;
+        DEBUG_MSG_F("config not changed. write avoided:%u\n", configWriteAvoidedNum);
+        return true;
+    }
+    Preferences prefs;
+    bool success = prefs.begin(CONFIG_NVS_NAMESPACE, false);
+    if (success) {
+        const char *key = record.seq % 2 == 0 ? CONFIG_NVS_KEY_A : CONFIG_NVS_KEY_B;
+        success = prefs.putBytes(key, &record, sizeof(record)) == sizeof(record);
+        prefs.end();
+    }
+    if (!success) {
+        // 通し番号が NVS より進んだ RTC メモリから起動すると、次の書き込みで
+        // 唯一正しい領域を上書きしてしまうので、次回は NVS から読み直させる
+        DEBUG_MSG_LN("config write fail...");
+        rtcConfig.magic = 0;
         return false;
     }
-    config.printTo(file);
-    file.close();
+    ++configWriteNum;
+    _configSeq = record.seq;
+    _dirtyFields = 0;
     return true;
 }
 
 /**
- * 現在の設定値を保存
- **/
-bool ModuleConfig::saveCurrentModuleConfig() {
-    DEBUG_MSG_LN("saveCurrentModuleConfig");
-    DynamicJsonBuffer jsonBuf(JSON_BUF_NUM);
-    JsonObject &config = jsonBuf.createObject();
+ * 設定値を JSON で取得(Web UI からのエクスポート用)
+ */
+void ModuleConfig::exportModuleConfig(JsonObject &config) {
     config[KEY_TRAP_MODE] = _trapMode;
     config[KEY_TRAP_FIRE] = _trapFire;
     config[KEY_GPS_LAT] = _lat;
     config[KEY_GPS_LON] = _lon;
     config[KEY_ACTIVE_START] = _activeStart;
     config[KEY_ACTIVE_END] = _activeEnd;
+    config[KEY_WAKE_SCHEDULE] = getWakeScheduleHex();
     config[KEY_PARENT_NODE_ID] = _parentNodeId;
     config[KEY_WAKE_TIME] = _wakeTime;
     config[KEY_NODE_NUM] = _nodeNum;
-#ifdef DEBUG_ESP_PORT
-    String configStr;
-    config.printTo(configStr);
-    DEBUG_MSG_LN(configStr);
-#endif
-    return saveModuleConfig(config);
+    config[KEY_CAMERA_PACKET_SIZE] = _cameraPacketSize;
+}
+
+/**
+ * CRC32 計算(magic, version, crc を除く)
+ */
+uint32_t ModuleConfig::calcCrc(const ConfigRecord &record) {
+    const uint8_t *data = (const uint8_t *)&record.seq;
+    return crc32_le(0, data, sizeof(ConfigRecord) - offsetof(ConfigRecord, seq));
+}
+
+/**
+ * 設定値が正しいか
+ */
+bool ModuleConfig::isValidRecord(const ConfigRecord &record) {
+    return record.magic == CONFIG_RECORD_MAGIC && record.version == CONFIG_RECORD_VERSION &&
+           record.crc == calcCrc(record);
 }
 
 /**
@@ -261,61 +516,80 @@ void ModuleConfig::pushNoDuplicateNodeId(const uint32_t &nodeId, SimpleList<uint
  */
 void ModuleConfig::updateGpsInfo(const char *lat, const char *lon) {
     if (!lat || !lon || strlen(lat) == 0 || strlen(lon) == 0) {
-        memset(_lat, '\0', GPS_STR_LEN);
-        memset(_lon, '\0', GPS_STR_LEN);
+        initGps();
         DEBUG_MSG_LN("GPS Clear");
         return;
     }
+    if (strncmp(_lat, lat, GPS_STR_LEN) == 0 && strncmp(_lon, lon, GPS_STR_LEN) == 0) {
+        return;
+    }
     strncpy(_lat, lat, strlen(lat));
     strncpy(_lon, lon, strlen(lon));
+    _dirtyFields |= CONFIG_GPS;
     DEBUG_MSG_F("GPS data: (lat, lon) = (%s, %s)\n", _lat, _lon);
 }
 
 /**
  * 次の起動時刻を設定する
+ * 起動スケジュールのビットを現在時刻から走査して最初に立っているビットの時刻を次回の起動時刻にする
  * もし現在時刻から15分以内(WAKE_TIME_SET_MIN)に次の起動時刻になる場合
  * 最も近い起動時刻を1つ飛ばした次の起動時刻を次回の起動時刻に設定する
  * 例）今が 13:46 で15分以内の 14:00 も稼働時間帯なら次の起動時刻は 14:00 を飛ばして 15:00
  */
-time_t ModuleConfig::calcWakeTime(uint8_t activeStart, uint8_t activeEnd) {
-    // 現在時刻
-    tmElements_t tNow;
-    breakTime(now(), tNow);
-    int tHour = tNow.Hour;
-    int tMinute = tNow.Minute;
-    tNow.Minute = 0;
-    tNow.Second = 0;
-    time_t baseTime = makeTime(tNow);
-    // 現在時刻が稼働時間帯
-    if (activeStart <= tHour && tHour < activeEnd) {
-        // 次の起動時刻が15分以上後なら1時間後が次回起動時刻
-        if (tMinute < 60 - WAKE_TIME_SET_MIN) {
-            return baseTime + adjustSleepTime(SECS_PER_HOUR);
-        }
-        // 2時間後の時刻が稼働時間帯の場合
-        if (tHour + 2 <= activeEnd) {
-            return baseTime + adjustSleepTime(2 * SECS_PER_HOUR);
-        }
-        // 2時間後の時刻が稼働時間帯ではない場合は稼働開始時刻をセット
-        return baseTime + adjustSleepTime((24 - tHour + activeStart) * SECS_PER_HOUR);
-    }
-    // 現在時刻が稼働開始時刻より早い
-    if (tHour < activeStart) {
-        // 次の稼働時刻が15分以内の場合稼働開始時刻まで停止
-        if (tHour + 1 != activeStart || tMinute < 60 - WAKE_TIME_SET_MIN) {
-            return baseTime + adjustSleepTime((activeStart - tHour) * SECS_PER_HOUR);
-        }
-        // もし15分以内に稼働開始時刻になるなら2時間後の起動時刻まで飛ばす
-        return baseTime + adjustSleepTime(2 * SECS_PER_HOUR);
+time_t ModuleConfig::calcWakeTime() {
+    time_t current = now();
+    time_t wakeTime = WakeSchedule::nextWakeTime(_wakeSchedule, current);
+    if (wakeTime == 0) {
+        DEBUG_MSG_LN("wake schedule is empty");
+        return current + adjustSleepTime(SECS_PER_DAY);
+    }
+    return current + adjustSleepTime(wakeTime - current);
+}
+
+/**
+ * 起動時刻が起動スケジュールに含まれているか
+ */
+bool ModuleConfig::isScheduledWakeTime(time_t wakeTime) {
+    return WakeSchedule::isScheduled(_wakeSchedule, wakeTime);
+}
+
+/**
+ * 稼働開始時刻から稼働停止時刻まで(停止時刻を含む)毎正時に起動するスケジュールを設定する
+ */
+void ModuleConfig::setWakeScheduleRange(uint8_t activeStart, uint8_t activeEnd) {
+    WakeScheduleBits schedule;
+    WakeSchedule::fromRange(activeStart, activeEnd, schedule);
+    updateWakeSchedule(schedule);
+}
+
+/**
+ * 16 進文字列で起動スケジュールを設定する
+ */
+bool ModuleConfig::setWakeSchedule(const char *hex) {
+    WakeScheduleBits schedule;
+    if (!WakeSchedule::fromHex(hex, schedule)) {
+        return false;
     }
-    // 現在時刻が稼働終了時刻より遅い
-    // 15分以内に稼働開始時刻になる場合2時間後まで停止(実質稼働開始時刻が 0 時の場合のみの考慮)
-    if (tMinute < 60 - WAKE_TIME_SET_MIN && tHour + 1 - 24 == activeStart) {
-        return baseTime + adjustSleepTime(2 * SECS_PER_HOUR);
+    updateWakeSchedule(schedule);
+    return true;
+}
+
+/**
+ * 起動スケジュールを更新し、変わった場合は保存対象にする
+ */
+void ModuleConfig::updateWakeSchedule(const WakeScheduleBits &schedule) {
+    if (memcmp(_wakeSchedule, schedule, sizeof(_wakeSchedule)) == 0) {
+        return;
     }
-    return baseTime + adjustSleepTime((24 - tHour + activeStart) * SECS_PER_HOUR);
+    memcpy(_wakeSchedule, schedule, sizeof(_wakeSchedule));
+    _dirtyFields |= CONFIG_WAKE_SCHEDULE;
 }
 
+/**
+ * 起動スケジュールを 15 分毎の 16 進文字列で取得する(末尾の桁がビット 0)
+ */
+String ModuleConfig::getWakeScheduleHex() { return WakeSchedule::toHex(_wakeSchedule); }
+
 /**
  * 最大DeepSleep時間を考慮したDeepSleep時間を返す
  * sleepTimeが最大DeepSleep時間を超えていて複数回DeepSleepする場合は
@@ -329,9 +603,9 @@ time_t ModuleConfig::adjustSleepTime(time_t sleepTime) {
     }
     // 極端に短いDeepSleep時間が発生しないように調整する
     if (sleepTime - MAX_SLEEP_TIME > MAX_SLEEP_TIME / 2) {
-        DEBUG_MSG_F("adjustSleepTime:%lu\n", MAX_SLEEP_TIME);
+        DEBUG_MSG_F("adjustSleepTime:%d\n", MAX_SLEEP_TIME);
         return MAX_SLEEP_TIME;
     }
-    DEBUG_MSG_F("adjustSleepTime:%lu\n", MAX_SLEEP_TIME / 2);
+    DEBUG_MSG_F("adjustSleepTime:%d\n", MAX_SLEEP_TIME / 2);
     return MAX_SLEEP_TIME / 2;
 }
@@ -1,9 +1,13 @@
 #ifndef INCLUDE_GUARD_MODULECONFIG
 #define INCLUDE_GUARD_MODULECONFIG
 
+#include "messageDispatcher.h"
 #include "trapCommon.h"
+#include "wakeSchedule.h"
+#include <Preferences.h>
 #include <TimeLib.h>
 #include <painlessMesh.h>
+#include <rom/crc.h>
 
 // モジュール状態構
 struct ModuleState {
@@ -14,9 +18,46 @@ struct ModuleState {
     bool cameraEnable;
 };
 
+// 保存する設定値の項目(変更有無の管理用)
+enum ConfigField : uint16_t {
+    CONFIG_TRAP_MODE = 1 << 0,
+    CONFIG_TRAP_FIRE = 1 << 1,
+    CONFIG_GPS = 1 << 2,
+    CONFIG_ACTIVE_START = 1 << 3,
+    CONFIG_ACTIVE_END = 1 << 4,
+    CONFIG_PARENT_NODE_ID = 1 << 5,
+    CONFIG_WAKE_TIME = 1 << 6,
+    CONFIG_NODE_NUM = 1 << 7,
+    CONFIG_CAMERA_PACKET_SIZE = 1 << 8,
+    CONFIG_WAKE_SCHEDULE = 1 << 9,
+    CONFIG_ALL = 0x3ff
+};
+
+// 保存する設定値(RTC メモリと NVS に置くのでコンストラクタを持たない型のみ)
+struct __attribute__((packed)) ConfigRecord {
+    uint32_t magic;
+    uint8_t version;
+    uint32_t crc; // crc 以降の CRC32
+    uint32_t seq; // 書き込み毎に増える通し番号
+    bool trapMode;
+    bool trapFire;
+    char lat[GPS_STR_LEN];
+    char lon[GPS_STR_LEN];
+    uint8_t activeStart;
+    uint8_t activeEnd;
+    uint32_t parentNodeId;
+    uint32_t wakeTime;
+    uint8_t nodeNum;
+    uint16_t cameraPacketSize;
+    uint32_t wakeSchedule[WAKE_SCHEDULE_WORDS];
+};
+
 class ModuleConfig {
   private:
-    static ModuleConfig *_pModuleConfig;
+    static SINGLETON_STORAGE ModuleConfig *_pModuleConfig;
+    unsigned long _configLoadTime = 0; // 設定値読み込み時間[usec]
+    uint16_t _dirtyFields = 0;         // 保存後に変更された項目(ConfigField)
+    uint32_t _configSeq = 0;           // NVS に保存されている最新の設定値の通し番号
 
   public:
     uint32_t _nodeId = DEF_NODEID;           // 自身のNodeId
@@ -29,6 +70,7 @@ class ModuleConfig {
     uint32_t _parentNodeId = DEF_NODEID;     // 親モジュール ID
     uint8_t _nodeNum = DEF_NODE_NUM;         // 前回起動時のノード数
     time_t _wakeTime = DEF_WAKE_TIME;        // 次回起動時刻
+    WakeScheduleBits _wakeSchedule = {0};    // 起動スケジュール
     // フラグ関連
     bool _isTrapStart = false;       // 罠起動モード移行フラグ
     bool _ledOnFlag = false;         // LED点滅フラグ
@@ -37,6 +79,7 @@ class ModuleConfig {
     bool _isSleep = false;           // スリープ状態遷移フラグ
     // カメラモジュール関連
     bool _cameraEnable = false;
+    uint16_t _cameraPacketSize = DEF_CAMERA_PACKET_SIZE; // パケットサイズ(0:自動調整)
 
   public:
     static ModuleConfig *getInstance() {
@@ -55,25 +98,51 @@ class ModuleConfig {
 
     void collectModuleInfo(painlessMesh &mesh, JsonObject &moduleInfo);
     void collectModuleState(JsonObject &state);
+    void collectModuleState(ModuleState &state);
     void collectModuleConfig(JsonObject &moduleConfig);
+    void exportModuleConfig(JsonObject &config);
     void updateModuleConfig(const JsonObject &config);
     bool saveCurrentModuleConfig();
     void initGps() {
+        if (_lat[0] != '\0' || _lon[0] != '\0') {
+            _dirtyFields |= CONFIG_GPS;
+        }
         memset(_lat, '\0', GPS_STR_LEN);
         memset(_lon, '\0', GPS_STR_LEN);
     };
-    time_t calcWakeTime(uint8_t activeStart, uint8_t activeEnd);
+    time_t calcWakeTime();
+    bool isScheduledWakeTime(time_t wakeTime);
+    String getWakeScheduleHex();
     void pushNoDuplicateNodeId(const uint32_t &nodeId, SimpleList<uint32_t> &list);
-    bool loadModuleConfigFile();
+    bool loadModuleConfig();
+    unsigned long getConfigLoadTime() { return _configLoadTime; };
+    void setTrapFire(bool trapFire) { setField(_trapFire, trapFire, CONFIG_TRAP_FIRE); };
+    void setNodeNum(uint8_t nodeNum) { setField(_nodeNum, nodeNum, CONFIG_NODE_NUM); };
+    uint16_t getDirtyFields() { return _dirtyFields; };
 
   private:
     ModuleConfig(){};
 
     time_t adjustSleepTime(time_t sleepTime);
+    void setWakeScheduleRange(uint8_t activeStart, uint8_t activeEnd);
+    bool setWakeSchedule(const char *hex);
+    void updateWakeSchedule(const WakeScheduleBits &schedule);
     void setDefaultModuleConfig();
+    template <class T> void setField(T &field, const T &value, ConfigField fieldBit) {
+        if (field != value) {
+            field = value;
+            _dirtyFields |= fieldBit;
+        }
+    }
     template <class T>
-    void setParameter(T &targetParam, const T &setParam, const int maxV, const int minV);
-    bool saveModuleConfig(const JsonObject &config);
+    void setParameter(T &targetParam, const T &setParam, const int maxV, const int minV,
+                      ConfigField fieldBit);
+    bool loadModuleConfigJson();
+    bool loadConfigRecord(ConfigRecord &record, bool &isFromRtc);
+    static bool readConfigRecord(Preferences &prefs, const char *key, ConfigRecord &record);
+    void applyConfigRecord(const ConfigRecord &record, bool isFromRtc);
+    static uint32_t calcCrc(const ConfigRecord &record);
+    static bool isValidRecord(const ConfigRecord &record);
     void updateGpsInfo(const char *lat, const char *lon);
 };
 
@@ -0,0 +1,422 @@
+#include "pictureTransfer.h"
+
+/***********************************
+ * 送信
+ **********************************/
+/**
+ * 画像送信開始
+ * 画像ファイルを開いて転送 ID とチャンク数を決定する
+ * 送信先が 0 の場合はブロードキャストし ACK は待たない
+ * PICTURE_MAX_SIZE を超える画像は送信できないので数えておく
+ */
+bool PictureTransfer::beginSend(uint32_t dest, const char *path) {
+    DEBUG_MSG_LN("beginSend");
+    endSend();
+    if (!SPIFFS.exists(path)) {
+        DEBUG_MSG_LN("picture not found");
+        return false;
+    }
+    _send.file = SPIFFS.open(path, "r");
+    if (!_send.file) {
+        DEBUG_MSG_LN("picture open fail...");
+        return false;
+    }
+    _send.size = _send.file.size();
+    _send.total = (_send.size + PICTURE_CHUNK_SIZE - 1) / PICTURE_CHUNK_SIZE;
+    if (_send.size == 0) {
+        DEBUG_MSG_LN("empty picture");
+        _send.file.close();
+        return false;
+    }
+    if (_send.total > PICTURE_MAX_CHUNKS) {
+        ++_tooLargeNum;
+        DEBUG_MSG_F("picture too large:%u > %u\n", _send.size, PICTURE_MAX_SIZE);
+        _send.file.close();
+        return false;
+    }
+    // 受信側で前回の転送と区別できるよう転送毎に ID を変える
+    if (_nextId == 0) {
+        _nextId = (uint32_t)random(1, 0xffff) << 16;
+    }
+    _send.dest = dest;
+    _send.id = ++_nextId;
+    _send.base = 0;
+    _send.next = 0;
+    _send.resend = 0;
+    _send.resendEnd = 0;
+    _send.retry = 0;
+    _send.ackTimeoutNum = 0;
+    _send.lastSend = millis();
+    memset(_send.acked, 0, sizeof(_send.acked));
+    _send.stats = PictureSendStats();
+    _send.stats.id = _send.id;
+    _send.stats.start = millis();
+    DEBUG_MSG_F("picture id:%u size:%u chunks:%u dest:%u\n", _send.id, _send.size, _send.total,
+                _send.dest);
+    return true;
+}
+
+/**
+ * 次に送信するチャンクのメッセージを作成
+ * 再送対象のチャンクを優先し、無ければウィンドウ内の新規チャンクを作成する
+ * ウィンドウが埋まっていて ACK 待ちの場合は false を返す
+ */
+bool PictureTransfer::createNextChunk(String &msg) {
+    if (!isSending() || isSendComplete()) {
+        return false;
+    }
+    // 再送
+    while (_send.resend < _send.resendEnd && isAcked(_send.resend)) {
+        ++_send.resend;
+    }
+    if (_send.resend < _send.resendEnd) {
+        // 再送範囲で最後の未 ACK チャンクで ACK を要求する
+        uint16_t last = _send.resend;
+        for (uint16_t seq = _send.resend + 1; seq < _send.resendEnd; ++seq) {
+            if (!isAcked(seq)) {
+                last = seq;
+            }
+        }
+        _send.pending = _send.resend;
+        _send.isPendingResend = true;
+        return readChunk(_send.pending, last == _send.pending, msg);
+    }
+    // 新規送信
+    if (_send.next < _send.total && _send.next < _send.base + PICTURE_WINDOW_SIZE) {
+        // ウィンドウが埋まるチャンクか最終チャンクで ACK を要求する
+        bool isAckRequest = _send.next + 1 == _send.total ||
+                            _send.next + 1 == _send.base + PICTURE_WINDOW_SIZE;
+        _send.pending = _send.next;
+        _send.isPendingResend = false;
+        return readChunk(_send.pending, _send.dest != 0 && isAckRequest, msg);
+    }
+    return false;
+}
+
+/**
+ * 作成したチャンクの送信成功
+ */
+void PictureTransfer::chunkSent() {
+    _send.retry = 0;
+    _send.lastSend = millis();
+    _send.stats.bytes += _send.pendingLen;
+    if (_send.isPendingResend) {
+        ++_send.stats.retransmits;
+        _send.resend = _send.pending + 1;
+    } else {
+        _send.next = _send.pending + 1;
+    }
+    // ブロードキャストの場合は ACK を待たない
+    if (_send.dest == 0) {
+        _send.acked[_send.pending / 8] |= 1 << (_send.pending % 8);
+        updateBase();
+    }
+}
+
+/**
+ * ACK タイムアウト確認
+ * 一定時間 ACK が無い場合はウィンドウ内の未 ACK チャンクを再送する
+ * 再送回数の上限を超えた場合は false を返す
+ */
+bool PictureTransfer::checkAckTimeout() {
+    if (_send.dest == 0 || millis() - _send.lastSend < PICTURE_ACK_TIMEOUT) {
+        return true;
+    }
+    if (++_send.ackTimeoutNum > PICTURE_ACK_RETRY) {
+        DEBUG_MSG_LN("picture ack timeout");
+        return false;
+    }
+    DEBUG_MSG_F("picture ack timeout, resend %u-%u\n", _send.base, _send.next);
+    _send.resend = _send.base;
+    _send.resendEnd = _send.next;
+    _send.lastSend = millis();
+    return true;
+}
+
+/**
+ * ACK 受信
+ * 受信済みビットマップを反映し、ACK 要求したチャンクまでに欠けているチャンクを再送対象にする
+ */
+void PictureTransfer::receiveAck(uint32_t from, JsonObject &ack) {
+    uint32_t id = ack[KEY_PICTURE_ACK];
+    if (!isSending() || from != _send.dest || id != _send.id) {
+        return;
+    }
+    // 16 進文字列のビットマップ
+    const char *map = ack[KEY_PICTURE_MAP];
+    if (map == NULL) {
+        return;
+    }
+    for (uint16_t i = 0; i < sizeof(_send.acked) && map[i * 2] != '\0' && map[i * 2 + 1] != '\0';
+         ++i) {
+        char hex[3] = {map[i * 2], map[i * 2 + 1], '\0'};
+        _send.acked[i] |= strtoul(hex, NULL, 16);
+    }
+    uint16_t preBase = _send.base;
+    updateBase();
+    if (_send.base != preBase) {
+        _send.ackTimeoutNum = 0;
+    }
+    _send.lastSend = millis();
+    // ACK 要求したチャンクより後ろはまだ届いていない可能性があるので再送しない
+    uint16_t ackSeq = ack[KEY_PICTURE_SEQ];
+    uint16_t end = min((uint16_t)(ackSeq + 1), _send.next);
+    for (uint16_t seq = _send.base; seq < end; ++seq) {
+        if (!isAcked(seq)) {
+            _send.resend = seq;
+            _send.resendEnd = max(_send.resendEnd, end);
+            break;
+        }
+    }
+}
+
+/**
+ * 画像送信終了
+ * 転送統計を保存する
+ */
+void PictureTransfer::endSend(bool success) {
+    if (!_send.file) {
+        return;
+    }
+    _send.file.close();
+    _send.stats.success = success;
+    _send.stats.elapsed = millis() - _send.stats.start;
+    _lastStats = _send.stats;
+    DEBUG_MSG_F("picture %u %s bytes:%u retransmits:%u elapsed:%lu\n", _lastStats.id,
+                success ? "success" : "failed", _lastStats.bytes, _lastStats.retransmits,
+                _lastStats.elapsed);
+}
+
+/**
+ * 指定番号のチャンクをファイルから読み出してメッセージを作成
+ * バッファは固定長なので画像サイズに関わらず使用メモリは一定
+ */
+bool PictureTransfer::readChunk(uint16_t seq, bool isAckRequest, String &msg) {
+    uint8_t buf[PICTURE_CHUNK_SIZE];
+    char enc[PICTURE_CHUNK_ENC_LEN + 1];
+    if (!_send.file.seek((uint32_t)seq * PICTURE_CHUNK_SIZE)) {
+        DEBUG_MSG_LN("picture seek fail...");
+        return false;
+    }
+    size_t len = _send.file.read(buf, PICTURE_CHUNK_SIZE);
+    if (len == 0) {
+        DEBUG_MSG_LN("picture read fail...");
+        return false;
+    }
+    int encLen = base64_encode(enc, (char *)buf, len);
+    enc[encLen] = '\0';
+    char header[160];
+    snprintf(header, sizeof(header),
+             "{\"" KEY_PICTURE_ID "\":%u,\"" KEY_PICTURE_SEQ "\":%u,\"" KEY_PICTURE_TOTAL
+             "\":%u,\"" KEY_PICTURE_SIZE "\":%u,%s\"" KEY_PICTURE "\":\"",
+             _send.id, seq, _send.total, _send.size,
+             isAckRequest ? "\"" KEY_PICTURE_ACK_REQUEST "\":1," : "");
+    msg = "";
+    msg.reserve(strlen(header) + encLen + 2);
+    msg += header;
+    msg += enc;
+    msg += "\"}";
+    _send.pendingLen = msg.length();
+    return true;
+}
+
+/**
+ * ACK されていない最小のチャンク番号を更新
+ */
+void PictureTransfer::updateBase() {
+    while (_send.base < _send.total && isAcked(_send.base)) {
+        ++_send.base;
+    }
+}
+
+/***********************************
+ * 受信
+ **********************************/
+/**
+ * チャンク受信
+ * JSON として解析せずに受信メッセージから直接ヘッダと画像データを取り出し、
+ * 画像データは固定長ブロック毎にデコードしてファイルの該当位置へ書き込む
+ * 全チャンク揃ったら画像を保存する
+ * 送信元から ACK を要求された場合は ack に返信メッセージを格納する
+ */
+bool PictureTransfer::receiveChunk(uint32_t from, const String &msg, String &ack) {
+    uint32_t id, seq, total, size;
+    if (!findUIntValue(msg, KEY_PICTURE_ID, id) || !findUIntValue(msg, KEY_PICTURE_SEQ, seq) ||
+        !findUIntValue(msg, KEY_PICTURE_TOTAL, total) ||
+        !findUIntValue(msg, KEY_PICTURE_SIZE, size)) {
+        DEBUG_MSG_LN("invalid picture header");
+        return false;
+    }
+    // 画像データ(Base64 文字列)の範囲
+    int dataStart = findValue(msg, KEY_PICTURE);
+    if (dataStart < 0 || msg.charAt(dataStart) != '"') {
+        return false;
+    }
+    ++dataStart;
+    int dataEnd = msg.indexOf('"', dataStart);
+    if (dataEnd < 0 || dataEnd - dataStart > PICTURE_CHUNK_ENC_LEN ||
+        (dataEnd - dataStart) % 4 != 0) {
+        DEBUG_MSG_LN("invalid picture chunk");
+        return false;
+    }
+    PictureRecvState *slot = findRecvSlot(from, id);
+    if (slot == NULL) {
+        slot = openRecvSlot(from, id, total, size);
+    }
+    if (slot == NULL || seq >= slot->total) {
+        return false;
+    }
+    uint32_t isAckRequest = 0;
+    findUIntValue(msg, KEY_PICTURE_ACK_REQUEST, isAckRequest);
+    // 受信済みチャンクは書き込まない
+    if (slot->received[seq / 8] & (1 << (seq % 8))) {
+        if (isAckRequest) {
+            createAck(*slot, seq, ack);
+        }
+        return true;
+    }
+    // SPIFFS はファイル末尾より先へ seek できないので、欠けているチャンクの領域は 0 で埋めておく
+    uint32_t offset = seq * PICTURE_CHUNK_SIZE;
+    slot->file.seek(0, SeekEnd);
+    uint8_t zero[64] = {0};
+    for (uint32_t pos = slot->file.position(); pos < offset; pos += sizeof(zero)) {
+        slot->file.write(zero, min((uint32_t)sizeof(zero), offset - pos));
+    }
+    slot->file.seek(offset);
+    // 固定長ブロック毎にデコードして書き込む
+    const char *data = msg.c_str();
+    char dec[PICTURE_DECODE_BLOCK / 4 * 3 + 1];
+    for (int pos = dataStart; pos < dataEnd; pos += PICTURE_DECODE_BLOCK) {
+        int inputLen = min(PICTURE_DECODE_BLOCK, dataEnd - pos);
+        int decLen = base64_decode(dec, (char *)&data[pos], inputLen);
+        if (slot->file.write((const uint8_t *)dec, decLen) != (size_t)decLen) {
+            DEBUG_MSG_LN("picture write fail...");
+            closeRecvSlot(*slot, false);
+            return false;
+        }
+    }
+    slot->received[seq / 8] |= 1 << (seq % 8);
+    ++slot->count;
+    slot->lastUpdate = millis();
+    if (slot->count == slot->total) {
+        DEBUG_MSG_F("picture %u receive complete\n", id);
+        closeRecvSlot(*slot, true);
+    }
+    if (isAckRequest) {
+        createAck(*slot, seq, ack);
+    }
+    return true;
+}
+
+/**
+ * 受信スロットを探す
+ * 受信完了したスロットも、ACK を再送できるよう次の転送で再利用されるまで残す
+ */
+PictureRecvState *PictureTransfer::findRecvSlot(uint32_t from, uint32_t id) {
+    for (auto &slot : _recv) {
+        if (slot.id != 0 && slot.from == from && slot.id == id) {
+            return &slot;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 新規転送用の受信スロットを確保
+ * 同じ送信元の古い転送や、一定時間更新のない転送は破棄する
+ * 受信完了済みのスロットは再利用する
+ */
+PictureRecvState *PictureTransfer::openRecvSlot(uint32_t from, uint32_t id, uint16_t total,
+                                                uint32_t size) {
+    if (total == 0 || total > PICTURE_MAX_CHUNKS || size > (uint32_t)total * PICTURE_CHUNK_SIZE) {
+        DEBUG_MSG_LN("invalid picture header");
+        return NULL;
+    }
+    PictureRecvState *freeSlot = NULL;
+    for (auto &slot : _recv) {
+        if (slot.file && (slot.from == from || millis() - slot.lastUpdate > PICTURE_RECV_TIMEOUT)) {
+            DEBUG_MSG_F("discard picture %u\n", slot.id);
+            closeRecvSlot(slot, false);
+        }
+        if (!slot.file && freeSlot == NULL) {
+            freeSlot = &slot;
+        }
+    }
+    if (freeSlot == NULL) {
+        DEBUG_MSG_LN("picture receive slot full");
+        return NULL;
+    }
+    freeSlot->file = SPIFFS.open(tempPath(from), "w");
+    if (!freeSlot->file) {
+        DEBUG_MSG_LN("picture open fail...");
+        return NULL;
+    }
+    freeSlot->from = from;
+    freeSlot->id = id;
+    freeSlot->size = size;
+    freeSlot->total = total;
+    freeSlot->count = 0;
+    freeSlot->lastUpdate = millis();
+    memset(freeSlot->received, 0, sizeof(freeSlot->received));
+    return freeSlot;
+}
+
+/**
+ * 受信スロットを閉じる
+ * 受信完了していれば一時ファイルを画像ファイルとして保存する
+ */
+void PictureTransfer::closeRecvSlot(PictureRecvState &slot, bool isComplete) {
+    slot.file.close();
+    String path = tempPath(slot.from);
+    if (isComplete) {
+        if (SPIFFS.exists(DEF_IMG_PATH)) {
+            SPIFFS.remove(DEF_IMG_PATH);
+        }
+        SPIFFS.rename(path, DEF_IMG_PATH);
+        return;
+    }
+    SPIFFS.remove(path);
+    slot.from = 0;
+    slot.id = 0;
+}
+
+/**
+ * ACK メッセージ作成
+ * 受信済みチャンクのビットマップを 16 進文字列で返す
+ */
+void PictureTransfer::createAck(PictureRecvState &slot, uint16_t seq, String &ack) {
+    char map[PICTURE_MAX_CHUNKS / 4 + 1];
+    uint16_t mapLen = (slot.total + 7) / 8;
+    for (uint16_t i = 0; i < mapLen; ++i) {
+        snprintf(&map[i * 2], 3, "%02x", slot.received[i]);
+    }
+    map[mapLen * 2] = '\0';
+    char buf[sizeof(map) + 96];
+    snprintf(buf, sizeof(buf),
+             "{\"" KEY_PICTURE_ACK "\":%u,\"" KEY_PICTURE_SEQ "\":%u,\"" KEY_PICTURE_MAP
+             "\":\"%s\"}",
+             slot.id, seq, map);
+    ack = buf;
+}
+
+/**
+ * JSON 文字列からキーに対応する値の開始位置を探す
+ * 見つからない場合は -1 を返す
+ */
+int PictureTransfer::findValue(const String &msg, const char *key) {
+    String pattern = String("\"") + key + "\":";
+    int index = msg.indexOf(pattern);
+    return index < 0 ? -1 : index + pattern.length();
+}
+
+/**
+ * JSON 文字列からキーに対応する符号なし整数値を取り出す
+ */
+bool PictureTransfer::findUIntValue(const String &msg, const char *key, uint32_t &value) {
+    int index = findValue(msg, key);
+    if (index < 0 || !isDigit(msg.charAt(index))) {
+        return false;
+    }
+    value = strtoul(msg.c_str() + index, NULL, 10);
+    return true;
+}
@@ -0,0 +1,101 @@
+#ifndef INCLUDE_GUARD_PICTURE_TRANSFER
+#define INCLUDE_GUARD_PICTURE_TRANSFER
+
+#include "trapCommon.h"
+#include <ArduinoBase64.h>
+#include <ArduinoJson.h>
+
+// 画像転送統計
+struct PictureSendStats {
+    uint32_t id = 0;           // 転送 ID
+    uint32_t bytes = 0;        // 送信バイト数
+    uint16_t retransmits = 0;  // 再送チャンク数
+    unsigned long start = 0;   // 転送開始時刻[msec]
+    unsigned long elapsed = 0; // 転送時間[msec]
+    bool success = false;      // 転送成否
+};
+
+// 送信側の転送状態
+struct PictureSendState {
+    File file;
+    uint32_t dest = 0;         // 送信先 NodeId(0 の場合はブロードキャストで ACK なし)
+    uint32_t id = 0;           // 転送 ID
+    uint32_t size = 0;         // 画像サイズ[byte]
+    uint16_t total = 0;        // 総チャンク数
+    uint16_t base = 0;         // ACK されていない最小のチャンク番号
+    uint16_t next = 0;         // 次に送信する新規チャンク番号
+    uint16_t resend = 0;       // 次に再送を確認するチャンク番号
+    uint16_t resendEnd = 0;    // 再送範囲の終端(この番号未満を再送する)
+    uint16_t pending = 0;      // 作成済みで送信結果待ちのチャンク番号
+    uint16_t pendingLen = 0;   // 作成済みメッセージ長
+    bool isPendingResend = false;
+    uint8_t retry = 0;         // 同一チャンクの送信リトライ数
+    uint8_t ackTimeoutNum = 0; // ACK タイムアウト連続回数
+    unsigned long lastSend = 0;
+    uint8_t acked[PICTURE_MAX_CHUNKS / 8]; // ACK 済みチャンクのビットマップ
+    PictureSendStats stats;
+};
+
+// 受信側の転送状態
+struct PictureRecvState {
+    File file;
+    uint32_t from = 0;  // 送信元 NodeId
+    uint32_t id = 0;    // 転送 ID(0 の場合は未使用)
+    uint32_t size = 0;  // 画像サイズ[byte]
+    uint16_t total = 0; // 総チャンク数
+    uint16_t count = 0; // 受信済みチャンク数
+    unsigned long lastUpdate = 0;
+    uint8_t received[PICTURE_MAX_CHUNKS / 8]; // 受信済みチャンクのビットマップ
+};
+
+/**
+ * 画像をチャンクに分割してメッシュ上で送受信する
+ * 送信側はファイルから 1 チャンクずつ読み出して Base64 エンコードし、
+ * 受信側はチャンク毎にデコードしてファイルの該当位置へ書き込む
+ * 送信先を指定した場合はスライディングウィンドウで送信し、
+ * 受信側から返る受信済みビットマップを元に欠けたチャンクのみ再送する
+ */
+class PictureTransfer {
+  private:
+    PictureSendState _send;
+    PictureSendStats _lastStats;
+    PictureRecvState _recv[PICTURE_RECV_SLOT_NUM];
+    uint32_t _nextId = 0;
+    uint16_t _tooLargeNum = 0; // 大きすぎて送信できなかった画像数
+
+  public:
+    PictureTransfer(){};
+
+    // 送信
+    bool beginSend(uint32_t dest, const char *path = DEF_IMG_PATH);
+    bool isSending() { return (bool)_send.file; };
+    bool isSendComplete() { return _send.base >= _send.total; };
+    uint32_t getSendDest() { return _send.dest; };
+    bool createNextChunk(String &msg);
+    void chunkSent();
+    bool canRetryChunk() { return ++_send.retry < DEF_ITERATION; };
+    bool checkAckTimeout();
+    void receiveAck(uint32_t from, JsonObject &ack);
+    void endSend(bool success = false);
+    const PictureSendStats &getLastStats() { return _lastStats; };
+    uint16_t getTooLargeNum() { return _tooLargeNum; };
+    // 受信
+    static bool isChunkMessage(const String &msg) {
+        return msg.indexOf("\"" KEY_PICTURE "\":\"") >= 0;
+    };
+    bool receiveChunk(uint32_t from, const String &msg, String &ack);
+
+  private:
+    bool readChunk(uint16_t seq, bool isAckRequest, String &msg);
+    bool isAcked(uint16_t seq) { return _send.acked[seq / 8] & (1 << (seq % 8)); };
+    void updateBase();
+    PictureRecvState *findRecvSlot(uint32_t from, uint32_t id);
+    PictureRecvState *openRecvSlot(uint32_t from, uint32_t id, uint16_t total, uint32_t size);
+    void closeRecvSlot(PictureRecvState &slot, bool isComplete);
+    void createAck(PictureRecvState &slot, uint16_t seq, String &ack);
+    String tempPath(uint32_t from) { return String("/recv_") + String(from) + ".tmp"; };
+    static int findValue(const String &msg, const char *key);
+    static bool findUIntValue(const String &msg, const char *key, uint32_t &value);
+};
+
+#endif // INCLUDE_GUARD_PICTURE_TRANSFER
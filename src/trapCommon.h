@@ -4,6 +4,12 @@
 #include <Arduino.h>
 #include <SPIFFS.h>
 
+// シングルトンのインスタンスの記憶域
+// ホスト上のテストでは 1 プロセスで複数のモジュールを動かすため、代替ヘッダでスレッド毎にする
+#ifndef SINGLETON_STORAGE
+#define SINGLETON_STORAGE
+#endif
+
 // デバッグ
 #define DEBUG_ESP_PORT Serial
 #ifdef DEBUG_ESP_PORT
@@ -18,6 +24,7 @@
 // 罠検知設定
 // #define TRAP_CHECK_ACTIVE
 #define TRAP_CHECK_PIN 14
+#define TRAP_FIRE_BURST_NUM 1 // 罠作動時の撮影枚数
 // 罠設置モードでの強制起動用
 #define FORCE_SETTING_MODE_PIN 35
 // 接続モジュール数確認用LED
@@ -40,6 +47,7 @@
 #define KEY_PARENT_NODE_ID "parent_id"
 #define KEY_NODE_NUM "node_num"
 #define KEY_WAKE_TIME "wake_time"
+#define KEY_WAKE_SCHEDULE "wake_schedule"
 #define KEY_CURRENT_TIME "current_time"
 // メッセージ JSON KEY
 #define KEY_CONFIG_UPDATE "config_update"
@@ -49,16 +57,78 @@
 #define KEY_BATTERY_DEAD "battery_dead"
 #define KEY_CURRENT_BATTERY "remaining_battery"
 #define KEY_NODE_ID "module_id"
+#define KEY_LAST_SEEN "last_seen"
+#define KEY_HOP "hop"
+#define KEY_MESH_MSG_VERSION "msg_ver"
 #define KEY_PICTURE "camera_image"
+#define KEY_PICTURE_ID "picture_id"
+#define KEY_PICTURE_SEQ "picture_seq"
+#define KEY_PICTURE_TOTAL "picture_total"
+#define KEY_PICTURE_SIZE "picture_size"
+#define KEY_PICTURE_ACK_REQUEST "picture_ack_req"
+#define KEY_PICTURE_ACK "picture_ack"
+#define KEY_PICTURE_MAP "picture_map"
+#define KEY_PICTURE_STATS "picture_stats"
+#define KEY_PICTURE_BYTES "bytes"
+#define KEY_PICTURE_RETRANSMITS "retransmits"
+#define KEY_PICTURE_ELAPSED "elapsed"
+#define KEY_PICTURE_TOO_LARGE "too_large"
 #define KEY_INIT_GPS "init_gps"
 #define KEY_MESH_GRAPH "mesh_graph"
+#define KEY_MESH_STATS "mesh_stats"
+#define KEY_MESH_SENT "sent"
+#define KEY_MESH_SEND_FAILED "send_failed"
+#define KEY_MESH_RECEIVED "received"
+#define KEY_MESH_RECEIVED_BYTES "received_bytes"
+#define KEY_CONFIG_SEND_TIME "config_send_time"
+#define KEY_CONFIG_DELAY "config_delay"
+#define KEY_REPORT_SLOT "report_slot"
+#define KEY_REPORT_RETRY "report_retry"
+#define KEY_REPORT_COLLISION "report_collision"
+#define KEY_REPORT_COLLECT_TIME "report_collect_time"
+#define KEY_MESSAGE_LOG "message_log"
+#define KEY_HANDLER_STATS "handler_stats"
+#define KEY_HANDLER_COUNT "count"
+#define KEY_HANDLER_AVERAGE "avg_us"
+#define KEY_HANDLER_MAX "max_us"
 #define KEY_SYNC_SLEEP "sync_sleep"
+#define KEY_SYNC_SLEEP_ACK "sync_sleep_ack"
+#define KEY_SLEEP_WAIT "sleep_wait"
+#define KEY_REPORTED_NUM "reported_num"
+#define KEY_SLEEP_ACK_NUM "sleep_ack_num"
 #define KEY_CAMERA_ENABLE "camera"
+#define KEY_CAMERA_BAUD "camera_baud"
+#define KEY_CAMERA_ERROR "camera_error"
+#define KEY_TRAP_FIRE_LATENCY "trap_fire_latency"
+#define KEY_CAMERA_PACKET_SIZE "camera_packet_size"
 #define KEY_PICTURE_FORMAT "picture_format"
+#define KEY_BURST_NUM "burst_num"
+#define KEY_CONFIG_WRITE_NUM "config_writes"
+#define KEY_CONFIG_WRITE_AVOIDED_NUM "config_writes_avoided"
+#define KEY_BOOT_STATS "boot_stats"
+#define KEY_CONFIG_LOAD_TIME "config_load_us"
+#define KEY_MESH_UP_TIME "mesh_up_ms"
+#define KEY_SLEEP_DRAIN_TIME "sleep_drain_ms"
+#define KEY_SLEEP_TIME_SAVED "sleep_saved_ms"
+#define KEY_RTC_DRIFT "rtc_drift_ppm"
+#define KEY_TIME_ADJUST "time_adjust_us"
+// 設定値保存
+#define CONFIG_RECORD_MAGIC 0x50415254 // "TRAP"
+#define CONFIG_RECORD_VERSION 3
+#define CONFIG_NVS_NAMESPACE "trapModule"
+#define CONFIG_NVS_KEY_A "config_a" // 通し番号が偶数の設定値
+#define CONFIG_NVS_KEY_B "config_b" // 通し番号が奇数の設定値
+#define CONFIG_JSON_PATH "/config.json" // 旧形式の設定ファイル(移行時のみ読み込む)
 // 稼働時間
 #define WORK_TIME 180000 // 3分間稼働[msec]
 // 起動時刻設定最小閾値[min]
 #define WAKE_TIME_SET_MIN 15
+// 起動スケジュール(1日を 15 分毎に区切ったビットマップ)
+#define WAKE_SCHEDULE_SLOT_MIN 15    // 1 ビットあたりの時間[min]
+#define WAKE_SCHEDULE_SLOT_NUM 96    // 1 日のビット数
+#define WAKE_SCHEDULE_WORDS 3        // ビットマップの uint32_t 数
+#define WAKE_SCHEDULE_HOURLY_LEN 6   // 1 時間毎(24 ビット)指定時の 16 進文字列長
+#define WAKE_SCHEDULE_QUARTER_LEN 24 // 15 分毎(96 ビット)指定時の 16 進文字列長
 // デフォルト設定値
 #define DEF_TRAP_MODE false // 設置モード
 #define DEF_TRAP_FIRE false // 罠作動済みフラグ
@@ -70,31 +140,62 @@
 #define DEF_CURRENT_TIME 0
 #define DEF_NODE_NUM 0
 #define DEF_NODEID 0
+#define DEF_CAMERA_PACKET_SIZE 500
 // 設定値上限下限値
+#define CAMERA_PACKET_SIZE_AUTO 0  // カメラパケットサイズ自動調整
+#define CAMERA_PACKET_SIZE_MIN 64  // カメラパケットサイズ最小値[byte]
+#define CAMERA_PACKET_SIZE_MAX 512 // カメラパケットサイズ最大値[byte]
 #ifdef ESP32
 // 最大DeepSleep時間[sec]
 #define MAX_SLEEP_TIME 86400 // ESP32 の場合停止時間は24時間でも大丈夫
 #else
 #define MAX_SLEEP_TIME 4200 // 70分[sec] 最大Sleep時間（本当は71.5分まで可能だが安全のため）
 #endif
+// RTC のずれ補正
+#define RTC_DRIFT_PPM_MAX 50000     // 補正するずれの上限[ppm]
+#define RTC_DRIFT_MIN_SLEEP 600     // ずれを計測する最低 DeepSleep 時間[sec]
 // Task 関連
-#define SYNC_SLEEP_INTERVAL 3000    // 同期 DeepSleep 遅延時間[msec]
+#define SYNC_SLEEP_INTERVAL 3000    // 同期 DeepSleep 遅延時間の上限[msec]
+#define SLEEP_DRAIN_MIN 500         // DeepSleep 前にメッセージを中継する最低時間[msec]
+#define SLEEP_DRAIN_CHECK 100       // DeepSleep 前の送信完了確認間隔[msec]
+#define SYNC_SLEEP_ACK_WAIT 1000    // 同期 DeepSleep の ACK 待ち時間[msec]
+// 中継ノードが親モジュールの同期 DeepSleep 再送を中継するため起きている上限[msec]
+#define SYNC_SLEEP_RELAY_MAX ((DEF_ITERATION + 1) * SYNC_SLEEP_ACK_WAIT)
 #define BATTERY_CHECK_INTERVAL 5000 // バッテリー残量チェック間隔[msec]
-#define MODULE_STATE_INTERVAL 3000  // モジュール状態送信間隔ランダム[msec]
+#define REPORT_SLOT_WIDTH 500       // モジュール状態送信スロット幅[msec]
 #define DEF_INTERVAL 1000           // メッセージ送信間隔[msec]
+#define HEAP_LOG_INTERVAL 30000     // ヒープ状態ログ出力間隔[msec]
 #define DEF_ITERATION 3             // メッセージ送信リトライ数
 // バッテリー関連
 // #define BATTERY_CHECK_ACTIVE
 #define BATTERY_LIMIT 4460 // 放電終止電圧(0.9V) * 電池 4 本(1[V] = 1240)
 #define VOLTAGE_DIVIDE 2   // 分圧比
 #define REAL_BATTERY_VALUE(v) (v) * VOLTAGE_DIVIDE / 1240
+#define RAW_BATTERY_VALUE(v) (v) * 1240 / VOLTAGE_DIVIDE
 // GPS ロケーション文字列長
 #define GPS_STR_LEN 16
 // camera
 #define DEF_IMG_PATH "/image.jpg"
+// 撮影画像リングバッファ
+#define IMAGE_RING_SIZE 8              // 保存しておく画像数
+#define IMAGE_INDEX_PATH "/images.idx" // 画像インデックスファイル
+#define DEF_BURST_NUM 1                // 1回の撮影指示での撮影枚数
+// 画像転送
+#define PICTURE_CHUNK_SIZE 768     // 1チャンクの画像データ長[byte](Base64 で割り切れるよう 3 の倍数)
+#define PICTURE_CHUNK_ENC_LEN ((PICTURE_CHUNK_SIZE + 2) / 3 * 4) // Base64 エンコード後の長さ
+#define PICTURE_MAX_CHUNKS 128     // 1画像の最大チャンク数(8 の倍数)
+#define PICTURE_MAX_SIZE ((uint32_t)PICTURE_MAX_CHUNKS * PICTURE_CHUNK_SIZE) // 送信できる最大画像サイズ
+#define PICTURE_DECODE_BLOCK 256   // 受信時に 1 度にデコードする Base64 文字数(4 の倍数)
+#define PICTURE_CHUNK_INTERVAL 50  // チャンク送信間隔[msec]
+#define PICTURE_RECV_SLOT_NUM 3    // 同時受信可能な画像数
+#define PICTURE_RECV_TIMEOUT 30000 // 受信途中の画像を破棄するまでの時間[msec]
+#define PICTURE_WINDOW_SIZE 8      // ACK を待たずに送信できるチャンク数
+#define PICTURE_ACK_TIMEOUT 2000   // ACK 待ちタイムアウト[msec]
+#define PICTURE_ACK_RETRY 5        // ACK タイムアウトによる再送の上限回数
 // multi task
 #define TASK_MEMORY 4096
 #define TASK_DELAY(delayMsec) vTaskDelay((delayMsec) / portTICK_RATE_MS)
 #define CAMERA_TASK_NAME "cameraTask"
+#define CAMERA_WRITE_TASK_NAME "cameraWriteTask"
 
 #endif // INCLUDE_GUARD_COMMON
@@ -1,7 +1,15 @@
 #include "trapModule.h"
 
 // singleton
-TrapModule *TrapModule::_pTrapModule = NULL;
+SINGLETON_STORAGE TrapModule *TrapModule::_pTrapModule = NULL;
+// 前回 DeepSleep 要求から DeepSleep 開始までの時間[msec](DeepSleep 中も保持される)
+RTC_DATA_ATTR static uint32_t sleepDrainTime = 0;
+// RTC のずれ(正なら遅れ)[ppm]と前回の DeepSleep 時間[sec](DeepSleep 中も保持される)
+RTC_DATA_ATTR static int32_t rtcDriftPpm = 0;
+RTC_DATA_ATTR static uint32_t lastSleepTime = 0;
+// 親モジュールのバイナリ形式対応バージョン(DeepSleep 中も保持される)
+RTC_DATA_ATTR static uint32_t rtcParentNodeId = DEF_NODEID;
+RTC_DATA_ATTR static uint8_t rtcParentMsgVersion = 0;
 
 /**************************************
  * setup
@@ -12,6 +20,10 @@ void TrapModule::setupModule() {
     pinMode(LED, OUTPUT);
     // モジュール読み込み
     loadModuleConfig();
+    // 子モジュールの状態と撮影画像読み込み
+    // 起動前チェックで DeepSleep する場合も保存し直すので先に読み込んでおく
+    _fleetTable.loadSnapshot();
+    _pImageStore->loadIndex();
     // // 起動前チェック
     if (!checkBeforeStart()) {
         shiftDeepSleep();
@@ -21,6 +33,7 @@ void TrapModule::setupModule() {
     DEBUG_MSG_LN("mesh setup");
     setupMesh(CONNECTION | SYNC); // painlessmesh 1.3v error
     setupTask();
+    logHeap("setup");
 }
 
 /**
@@ -38,6 +51,82 @@ void TrapModule::setupMesh(const uint16_t types) {
     _mesh.onNodeTimeAdjusted(
         std::bind(&TrapModule::nodeTimeAdjustedCallback, this, std::placeholders::_1));
     _pConfig->_nodeId = _mesh.getNodeId();
+    // 起動直後から親モジュールへバイナリ形式で送れるよう前回分かっていたバージョンを引き継ぐ
+    if (rtcParentNodeId != DEF_NODEID && rtcParentNodeId == _pConfig->_parentNodeId) {
+        _peerMsgVersion[rtcParentNodeId] = rtcParentMsgVersion;
+    }
+    setupMessageHandler();
+}
+
+/**
+ * メッセージハンドラ登録
+ * 1 つのメッセージに複数のキーが含まれる場合は登録順に処理される
+ */
+void TrapModule::setupMessageHandler() {
+    // 送信元のバイナリ形式対応バージョン
+    _dispatcher.on(KEY_MESH_MSG_VERSION, [this](uint32_t from, JsonObject &msg) {
+        _peerMsgVersion[from] = msg[KEY_MESH_MSG_VERSION];
+    });
+    // モジュール状態受信(旧形式)
+    _dispatcher.on(KEY_MODULE_STATE, [this](uint32_t from, JsonObject &msg) {
+        ModuleState state;
+        state.nodeId = from;
+        state.batery = RAW_BATTERY_VALUE(msg[KEY_CURRENT_BATTERY].as<double>());
+        state.batteryDead = msg[KEY_BATTERY_DEAD];
+        state.trapFire = msg[KEY_TRAP_FIRE];
+        state.cameraEnable = msg[KEY_CAMERA_ENABLE];
+        receivedModuleState(state);
+    });
+    // モジュール設定更新メッセージ受信
+    _dispatcher.on(KEY_CONFIG_UPDATE, [this](uint32_t from, JsonObject &msg) {
+        DEBUG_MSG_LN("Module config update");
+        _fleetTable.logMessage(from, LOG_CONFIG_UPDATE, now());
+        if (msg.containsKey(KEY_CONFIG_SEND_TIME)) {
+            uint32_t sendTime = msg[KEY_CONFIG_SEND_TIME];
+            _meshStats.configDelay = _mesh.getNodeTime() - sendTime;
+            DEBUG_MSG_F("config delay:%u[usec]\n", _meshStats.configDelay);
+        }
+        _pConfig->updateModuleConfig(msg);
+    });
+    // 画像チャンクの ACK
+    _dispatcher.on(KEY_PICTURE_ACK, [this](uint32_t from, JsonObject &msg) {
+        _pictureTransfer.receiveAck(from, msg);
+    });
+    // モジュール状態送信要求が来た場合は送信済みか否かにかかわらず送信する
+    _dispatcher.on(KEY_REQUEST_MODULE_STATE, [this](uint32_t from, JsonObject &) {
+        DEBUG_MSG_LN("request module state");
+        _fleetTable.logMessage(from, LOG_REQUEST_MODULE_STATE, now());
+        taskStart(_sendModuleStateTask, calcReportSlotDelay());
+    });
+    // 同期 DeepSleep の ACK(親モジュールで受信する)
+    _dispatcher.on(KEY_SYNC_SLEEP_ACK, [this](uint32_t from, JsonObject &) {
+        _fleetTable.logMessage(from, LOG_SYNC_SLEEP_ACK, now());
+        _sleepAckNodes.insert(from);
+        // 全子モジュールから ACK が揃ったら待たずに DeepSleep する
+        if (_syncSleepTask.isEnabled() && _sleepAckNodes.size() >= getExpectedChildNum()) {
+            sendSyncSleep();
+        }
+    });
+    // DeepSleepする前に全ノードのバッテリー状態などを取得している必要があるので最後に登録すること
+    // 親モジュールが通知を再送しなくて済むよう受信したら ACK を返す
+    // 再送時は ACK 待ちのノード一覧が付くので、一覧に無ければ ACK 済みとして返さない
+    _dispatcher.on(KEY_SYNC_SLEEP, [this](uint32_t from, JsonObject &msg) {
+        DEBUG_MSG_LN("Sync Sleep start");
+        _fleetTable.logMessage(from, LOG_SYNC_SLEEP, now());
+        bool isAckWaited = !msg.containsKey(KEY_SLEEP_WAIT);
+        for (JsonVariant nodeId : msg[KEY_SLEEP_WAIT].as<JsonArray>()) {
+            isAckWaited |= nodeId.as<uint32_t>() == getNodeId();
+        }
+        if (isAckWaited) {
+            String ack = "{\"" KEY_SYNC_SLEEP_ACK "\":true,\"" KEY_MESH_MSG_VERSION "\":" +
+                         String(MESH_MSG_VERSION) + "}";
+            sendMessage(from, ack);
+        }
+        // 配下に ACK 待ちの子モジュールがいる間は親モジュールの再送を中継するため起きている
+        _syncSleepTime = millis();
+        _isRelayingSleep = hasWaitingDownstream(from, msg);
+        _pConfig->_isSleep = true;
+    });
 }
 
 /**
@@ -50,6 +139,13 @@ void TrapModule::setupCamera() {
     if (_pConfig->_cameraEnable) {
         xTaskCreatePinnedToCore(TrapModule::snapCameraTask, CAMERA_TASK_NAME, TASK_MEMORY, NULL, 2,
                                 &_taskHandle[0], 0);
+#ifdef TRAP_CHECK_ACTIVE
+        // 罠作動時は割り込みから直接撮影タスクに通知する
+        if (_pConfig->_trapMode) {
+            attachInterrupt(digitalPinToInterrupt(TRAP_CHECK_PIN), TrapModule::trapFireISR,
+                            RISING);
+        }
+#endif
     }
 }
 
@@ -60,17 +156,27 @@ void TrapModule::setupTask() {
     // LED Setting
     setTask(_blinkNodesTask, BLINK_PERIOD, (_mesh.getNodeList().size() + 1) * 2,
             std::bind(&TrapModule::blinkLed, this), true);
-    // module state 送信が輻輳しないよう送信間隔をランダムにする
-    randomSeed(now());
-    setTask(_sendModuleStateTask, random(DEF_INTERVAL, MODULE_STATE_INTERVAL), TASK_FOREVER,
+    // module state は輻輳しないよう自身の送信スロットで送信する(開始時に間隔を設定する)
+    setTask(_sendModuleStateTask, REPORT_SLOT_WIDTH, TASK_FOREVER,
             std::bind(&TrapModule::sendModuleState, this), false);
     // picture
-    setTask(_sendPictureTask, DEF_INTERVAL, DEF_ITERATION,
+    setTask(_sendPictureTask, PICTURE_CHUNK_INTERVAL, TASK_FOREVER,
             std::bind(&TrapModule::sendPicture, this), false);
     // battery check
     // 設置モード時はバッテリーチェックを有効にする
     setTask(_checkBatteryLimitTask, BATTERY_CHECK_INTERVAL, TASK_FOREVER,
             std::bind(&TrapModule::checkBatteryLimit, this), !_pConfig->_trapMode);
+    // DeepSleep 移行
+    setTask(_drainSleepTask, SLEEP_DRAIN_CHECK, TASK_FOREVER,
+            std::bind(&TrapModule::drainBeforeSleep, this), false);
+    // 同期 DeepSleep 通知
+    // ACK が揃わない場合は DEF_ITERATION 回まで再送し、最後の 1 回で DeepSleep する
+    setTask(_syncSleepTask, SYNC_SLEEP_ACK_WAIT, DEF_ITERATION + 1,
+            std::bind(&TrapModule::sendSyncSleep, this), false);
+    // heap
+#ifdef DEBUG_ESP_PORT
+    setTask(_logHeapTask, HEAP_LOG_INTERVAL, TASK_FOREVER, []() { logHeap("wake"); }, true);
+#endif
 }
 
 /**
@@ -90,15 +196,14 @@ bool TrapModule::checkBeforeStart() {
     if (!_pConfig->_trapMode) {
         return true;
     }
+    // 電源投入時は時刻が分からないので起動して親モジュールからの時刻同期を待つ
+    if (timeStatus() == timeNotSet) {
+        DEBUG_MSG_LN("current time is not set.");
+        return true;
+    }
     // 起動時刻チェック
-    tmElements_t activeStart;
-    breakTime(_pConfig->_wakeTime, activeStart);
-    activeStart.Hour = _pConfig->_activeStart;
-    activeStart.Minute = 0;
-    activeStart.Second = 0;
-    tmElements_t activeEnd = activeStart;
-    activeEnd.Hour = _pConfig->_activeEnd;
-    if (_pConfig->_wakeTime < makeTime(activeStart) || _pConfig->_wakeTime > makeTime(activeEnd)) {
+    // 最大DeepSleep時間を超えるため途中で起動した場合などはスケジュールに含まれない
+    if (!_pConfig->isScheduledWakeTime(_pConfig->_wakeTime)) {
         DEBUG_MSG_LN("cannot start because current time is not active time.");
         return false;
     }
@@ -120,9 +225,10 @@ void TrapModule::update() {
         digitalWrite(LED, !_pConfig->_ledOnFlag);
     }
     // DeepSleep 開始
-    if (_pConfig->_isSleep) {
-        delay(SYNC_SLEEP_INTERVAL);
-        shiftDeepSleep();
+    // メッシュの更新を止めないよう移行はタスクで行い、その間も同期 DeepSleep 通知を中継する
+    if (_pConfig->_isSleep && !_drainSleepTask.isEnabled()) {
+        _sleepRequestTime = millis();
+        taskStart(_drainSleepTask);
     }
     // 設置モードか罠モード作動開始状態の場合は以降の処理は無視
     if (!_pConfig->_trapMode || _pConfig->_isTrapStart) {
@@ -144,6 +250,8 @@ void TrapModule::update() {
  */
 bool TrapModule::syncConfig(JsonObject &config) {
     config[KEY_CONFIG_UPDATE] = true;
+    // 受信側で伝搬時間を計測するため送信時のメッシュ時刻を付与する
+    config[KEY_CONFIG_SEND_TIME] = _mesh.getNodeTime();
     if (_mesh.getNodeList().size() > 0) {
         if (!sendBroadcast(config)) {
             return false;
@@ -171,13 +279,86 @@ bool TrapModule::initGps() {
     if (_mesh.getNodeList().size() == 0) {
         return true;
     }
-    DynamicJsonBuffer jsonBuf(JSON_BUF_NUM);
+    MeshJsonArenaLock arenaLock(_jsonArena);
+    ArenaJsonBuffer &jsonBuf = arenaLock.buffer();
     JsonObject &obj = jsonBuf.createObject();
     obj[KEY_CONFIG_UPDATE] = true;
     obj[KEY_INIT_GPS] = KEY_INIT_GPS;
     return sendBroadcast(obj);
 }
 
+/**
+ * モジュール情報取得
+ */
+void TrapModule::collectModuleInfo(JsonObject &moduleInfo) {
+    _pConfig->collectModuleInfo(_mesh, moduleInfo);
+    if (_pConfig->_cameraEnable) {
+        moduleInfo[KEY_CAMERA_BAUD] = _pCamera->getBaudRate();
+        // 直近の撮影で失敗した段階(失敗していなければ NONE)
+        moduleInfo[KEY_CAMERA_ERROR] =
+            Camera::getCaptureStageName(_pCamera->getCaptureResult().error);
+        // 直近の罠作動から画像保存までの時間
+        if (_trapFireLatency != 0) {
+            moduleInfo[KEY_TRAP_FIRE_LATENCY] = _trapFireLatency;
+        }
+    }
+    // メッシュ通信統計
+    JsonObject &meshStats = moduleInfo.createNestedObject(KEY_MESH_STATS);
+    meshStats[KEY_MESH_SENT] = _meshStats.sent;
+    meshStats[KEY_MESH_SEND_FAILED] = _meshStats.sendFailed;
+    meshStats[KEY_MESH_RECEIVED] = _meshStats.received;
+    meshStats[KEY_MESH_RECEIVED_BYTES] = _meshStats.receivedBytes;
+    meshStats[KEY_CONFIG_DELAY] = _meshStats.configDelay;
+    uint32_t reportSlot, reportSlotNum;
+    getReportSlot(reportSlot, reportSlotNum);
+    meshStats[KEY_REPORT_SLOT] = reportSlot;
+    meshStats[KEY_REPORT_RETRY] = _meshStats.reportRetry;
+    meshStats[KEY_REPORT_COLLISION] = _meshStats.reportCollision;
+    meshStats[KEY_REPORT_COLLECT_TIME] = _meshStats.reportCollectTime;
+    meshStats[KEY_REPORTED_NUM] = _reportedNodes.size();
+    meshStats[KEY_SLEEP_ACK_NUM] = _sleepAckNodes.size();
+    // 起動時間
+    JsonObject &bootStats = moduleInfo.createNestedObject(KEY_BOOT_STATS);
+    bootStats[KEY_CONFIG_LOAD_TIME] = _pConfig->getConfigLoadTime();
+    bootStats[KEY_MESH_UP_TIME] = _meshUpTime;
+    bootStats[KEY_RTC_DRIFT] = rtcDriftPpm;
+    bootStats[KEY_TIME_ADJUST] = (int32_t)_timeAdjustSum;
+    if (sleepDrainTime != 0) {
+        bootStats[KEY_SLEEP_DRAIN_TIME] = sleepDrainTime;
+        // 以前は常に SYNC_SLEEP_INTERVAL 待っていたので、それとの差を短縮時間とする
+        bootStats[KEY_SLEEP_TIME_SAVED] =
+            sleepDrainTime < SYNC_SLEEP_INTERVAL ? SYNC_SLEEP_INTERVAL - sleepDrainTime : 0;
+    }
+    // 直近の受信メッセージ
+    JsonArray &messageLog = moduleInfo.createNestedArray(KEY_MESSAGE_LOG);
+    _fleetTable.collectLog(messageLog);
+    // メッセージハンドラ毎の処理統計
+    JsonObject &handlerStats = moduleInfo.createNestedObject(KEY_HANDLER_STATS);
+    _dispatcher.collectStats(handlerStats);
+    // 直近の画像転送統計
+    const PictureSendStats &stats = _pictureTransfer.getLastStats();
+    if (stats.id != 0 || _pictureTransfer.getTooLargeNum() > 0) {
+        JsonObject &pictureStats = moduleInfo.createNestedObject(KEY_PICTURE_STATS);
+        pictureStats[KEY_PICTURE_ID] = stats.id;
+        pictureStats[KEY_PICTURE_BYTES] = stats.bytes;
+        pictureStats[KEY_PICTURE_RETRANSMITS] = stats.retransmits;
+        pictureStats[KEY_PICTURE_ELAPSED] = stats.elapsed;
+        pictureStats[KEY_PICTURE_TOO_LARGE] = _pictureTransfer.getTooLargeNum();
+    }
+}
+
+/**
+ * 子モジュールの状態一覧を periodJson 形式で取得
+ * 自身の状態も含める
+ */
+void TrapModule::collectFleetState(String &json) {
+    ModuleState state;
+    _pConfig->collectModuleState(state);
+    state.nodeId = getNodeId();
+    _fleetTable.update(state, now());
+    _fleetTable.printTo(json, getNodeId(), now());
+}
+
 /********************************************
  * painlessMesh callback
  *******************************************/
@@ -185,33 +366,32 @@ bool TrapModule::initGps() {
  * モジュールからメッセージがあった場合のコールバック
  */
 void TrapModule::receivedCallback(uint32_t from, String &msg) {
+    ++_meshStats.received;
+    _meshStats.receivedBytes += msg.length();
+    // バイナリ形式のメッセージ
+    if (MeshMessage::isBinary(msg)) {
+        receivedBinaryMessage(from, msg);
+        return;
+    }
+    // 画像チャンクはサイズが大きいので JSON として解析せずに直接デコードして保存
+    if (PictureTransfer::isChunkMessage(msg)) {
+        DEBUG_MSG_LN("image chunk receive");
+        String ack;
+        if (_pictureTransfer.receiveChunk(from, msg, ack) && ack.length() > 0) {
+            sendMessage(from, ack);
+        }
+        return;
+    }
     DEBUG_MSG_LN("Received message.\nMessage:" + msg);
-    DynamicJsonBuffer jsonBuf(JSON_BUF_NUM);
+    MeshJsonArenaLock arenaLock(_jsonArena);
+    ArenaJsonBuffer &jsonBuf = arenaLock.buffer();
     JsonObject &msgJson = jsonBuf.parseObject(msg);
     if (!msgJson.success()) {
         DEBUG_MSG_LN("json parse failed");
         return;
     }
-    // モジュール設定更新メッセージ受信
-    if (msgJson.containsKey(KEY_CONFIG_UPDATE)) {
-        DEBUG_MSG_LN("Module config update");
-        _pConfig->updateModuleConfig(msgJson);
-    }
-    // モジュール状態送信要求が来た場合は送信済みか否かにかかわらず送信する
-    if (msgJson.containsKey(KEY_REQUEST_MODULE_STATE)) {
-        DEBUG_MSG_LN("request module state");
-        taskStart(_sendModuleStateTask);
-    }
-    // 画像保存
-    if (msgJson.containsKey(KEY_PICTURE)) {
-        DEBUG_MSG_LN("image receive");
-        saveBase64Image((const char *)msgJson[KEY_PICTURE]);
-    }
-    // DeepSleepする前に全ノードのバッテリー状態などを取得している必要があるので最後に呼ぶこと
-    if (msgJson.containsKey(KEY_SYNC_SLEEP)) {
-        DEBUG_MSG_LN("Sync Sleep start");
-        _pConfig->_isSleep = true;
-    }
+    // キー毎の処理は setupMessageHandler で登録したハンドラで行う
+    _dispatcher.dispatch(from, msgJson);
 }
 
 /**
@@ -220,8 +400,13 @@ void TrapModule::receivedCallback(uint32_t from, String &msg) {
  */
 void TrapModule::newConnectionCallback(uint32_t nodeId) {
     DEBUG_MSG_F("--> startHere: New Connection, nodeId = %u\n", nodeId);
+    if (_meshUpTime == 0) {
+        _meshUpTime = millis();
+        DEBUG_MSG_F("boot to mesh up:%lu[msec]\n", _meshUpTime);
+    }
     refreshMeshDetail();
     startSendModuleState();
+    startSendPicture();
 }
 
 /**
@@ -231,11 +416,140 @@ void TrapModule::newConnectionCallback(uint32_t nodeId) {
 void TrapModule::changedConnectionCallback() {
     DEBUG_MSG_F("Changed connections %s\n", _mesh.subConnectionJson().c_str());
     refreshMeshDetail();
+    updateTopology();
     startSendModuleState();
+    startSendPicture();
+}
+
+/**
+ * バイナリ形式のメッセージ受信
+ */
+void TrapModule::receivedBinaryMessage(uint32_t from, const String &msg) {
+    MeshMessageHeader header;
+    if (!MeshMessage::readHeader(msg, header)) {
+        DEBUG_MSG_LN("binary message parse failed");
+        return;
+    }
+    _peerMsgVersion[from] = header.version;
+    switch (header.type) {
+    case MESH_MSG_MODULE_STATE: {
+        ModuleState state;
+        if (MeshMessage::decodeModuleState(from, msg, state)) {
+            receivedModuleState(state);
+        }
+        break;
+    }
+    default:
+        DEBUG_MSG_F("unknown binary message type:%u\n", header.type);
+        break;
+    }
+}
+
+/**
+ * 子モジュールのモジュール状態受信
+ */
+void TrapModule::receivedModuleState(const ModuleState &state) {
+    DEBUG_MSG_F("module state from %u battery:%u dead:%d fire:%d camera:%d\n", state.nodeId,
+                state.batery, state.batteryDead, state.trapFire, state.cameraEnable);
+    _fleetTable.update(state, now());
+    _fleetTable.logMessage(state.nodeId, LOG_MODULE_STATE, now());
+    // 同じスロットで複数のモジュール状態を受信した場合はスロットが衝突している
+    uint32_t reportSlot = _mesh.getNodeTime() / 1000 / REPORT_SLOT_WIDTH;
+    if (reportSlot == _lastReportSlot) {
+        ++_meshStats.reportCollision;
+        DEBUG_MSG_F("report slot collision:%u\n", _meshStats.reportCollision);
+    }
+    _lastReportSlot = reportSlot;
+    if (_meshUpTime != 0) {
+        _meshStats.reportCollectTime = millis() - _meshUpTime;
+    }
+    // 罠モードの親モジュールは前回起動時の全子モジュールから受信したら同期 DeepSleep を開始する
+    _reportedNodes.insert(state.nodeId);
+    if (!_pConfig->_trapMode || _pConfig->_isTrapStart || _pConfig->_parentNodeId != getNodeId()) {
+        return;
+    }
+    uint8_t expectedNum = getExpectedChildNum();
+    if (expectedNum != 0 && _reportedNodes.size() >= expectedNum) {
+        DEBUG_MSG_F("all %u modules reported in %u[msec]\n", expectedNum,
+                    _meshStats.reportCollectTime);
+        taskStart(_syncSleepTask);
+    }
+}
+
+/**
+ * トポロジから子モジュールのホップ数と、各ノードへ経由する直接接続を更新
+ */
+void TrapModule::updateTopology() {
+    MeshJsonArenaLock arenaLock(_jsonArena);
+    JsonVariant root = arenaLock.buffer().parse(_mesh.subConnectionJson());
+    if (!root.success()) {
+        DEBUG_MSG_LN("mesh graph parse failed");
+        return;
+    }
+    _fleetTable.updateHops(root);
+    // 配列の場合は直接接続しているモジュールの一覧、オブジェクトの場合は自身が根
+    _meshRoutes.clear();
+    JsonVariant direct = root;
+    if (root.is<JsonObject>()) {
+        direct = root.as<JsonObject>()["subs"];
+    }
+    for (JsonVariant sub : direct.as<JsonArray>()) {
+        addMeshRoutes(sub, sub.as<JsonObject>()["nodeId"]);
+    }
+}
+
+/**
+ * トポロジを辿って配下のノードの経由する直接接続を設定する
+ */
+void TrapModule::addMeshRoutes(JsonVariant node, uint32_t via) {
+    if (!node.is<JsonObject>()) {
+        return;
+    }
+    JsonObject &obj = node.as<JsonObject>();
+    uint32_t nodeId = obj["nodeId"];
+    if (nodeId != 0) {
+        _meshRoutes[nodeId] = via;
+    }
+    if (obj.containsKey("subs")) {
+        JsonVariant subs = obj["subs"];
+        for (JsonVariant sub : subs.as<JsonArray>()) {
+            addMeshRoutes(sub, via);
+        }
+    }
+}
+
+/**
+ * 同期 DeepSleep 通知の送信元から見て自身の配下に ACK 待ちのノードがいるか
+ * 送信元と異なる直接接続を経由するノードを配下とする
+ * 初回の通知には ACK 待ちの一覧が無いので、配下にノードがあれば待っているものとする
+ */
+bool TrapModule::hasWaitingDownstream(uint32_t from, JsonObject &msg) {
+    auto upstream = _meshRoutes.find(from);
+    uint32_t upstreamVia = upstream == _meshRoutes.end() ? DEF_NODEID : upstream->second;
+    if (!msg.containsKey(KEY_SLEEP_WAIT)) {
+        for (auto &route : _meshRoutes) {
+            if (route.second != upstreamVia) {
+                return true;
+            }
+        }
+        return false;
+    }
+    for (JsonVariant nodeId : msg[KEY_SLEEP_WAIT].as<JsonArray>()) {
+        auto route = _meshRoutes.find(nodeId.as<uint32_t>());
+        if (route != _meshRoutes.end() && route->second != upstreamVia) {
+            return true;
+        }
+    }
+    return false;
 }
 
+/**
+ * メッシュ時刻の補正
+ * 起動直後は各ノードの時刻が起動からの経過時間なので、補正量の合計は他ノードより遅れて起動した時間になる
+ */
 void TrapModule::nodeTimeAdjustedCallback(int32_t offset) {
     DEBUG_MSG_F("Adjusted time %u. Offset = %d\n", _mesh.getNodeTime(), offset);
+    _timeAdjustSum += offset;
 }
 
 /*******************************************************
@@ -264,9 +578,9 @@ void TrapModule::updateBattery() {
 void TrapModule::updateTrapFire() {
     DEBUG_MSG_LN("updateTrapFire");
 #ifdef TRAP_CHECK_ACTIVE
-    _pConfig->_trapFire = digitalRead(TRAP_CHECK_PIN) == HIGH;
+    _pConfig->setTrapFire(digitalRead(TRAP_CHECK_PIN) == HIGH);
 #else
-    _pConfig->_trapFire = false;
+    _pConfig->setTrapFire(false);
 #endif
 }
 
@@ -281,7 +595,8 @@ bool TrapModule::sendCurrentTime() {
     if (_mesh.getNodeList().size() == 0) {
         return true;
     }
-    DynamicJsonBuffer jsonBuf(JSON_BUF_NUM);
+    MeshJsonArenaLock arenaLock(_jsonArena);
+    ArenaJsonBuffer &jsonBuf = arenaLock.buffer();
     JsonObject &currentTime = jsonBuf.createObject();
     currentTime[KEY_CONFIG_UPDATE] = true;
     currentTime[KEY_CURRENT_TIME] = now();
@@ -304,63 +619,141 @@ void TrapModule::sendModuleState() {
     updateBattery();
     updateTrapFire();
     // モジュール状態情報作成
-    DynamicJsonBuffer jsonBuf(JSON_BUF_NUM);
-    JsonObject &state = jsonBuf.createObject();
-    _pConfig->collectModuleState(state);
-    if (sendParent(state)) {
+    // 親モジュールがバイナリ形式に対応していればバイナリ形式で送信する
+    bool success = false;
+    if (getPeerMsgVersion(_pConfig->_parentNodeId) >= MESH_MSG_VERSION) {
+        ModuleState state;
+        _pConfig->collectModuleState(state);
+        String msg = MeshMessage::encodeModuleState(state);
+        success = sendMessage(_pConfig->_parentNodeId, msg);
+    } else {
+        MeshJsonArenaLock arenaLock(_jsonArena);
+        ArenaJsonBuffer &jsonBuf = arenaLock.buffer();
+        JsonObject &state = jsonBuf.createObject();
+        _pConfig->collectModuleState(state);
+        success = sendParent(state);
+    }
+    if (success) {
         _pConfig->_isSendModuleState = true;
         taskStop(_sendModuleStateTask);
+        return;
+    }
+    // 送信に成功しなかった場合は次の周期の自身のスロットで再送する
+    // スロットの開始時刻ちょうどで 0 になった場合は間隔 0 で回り続けないよう 1 周期後にする
+    ++_meshStats.reportRetry;
+    unsigned long retryDelay = calcReportSlotDelay();
+    if (retryDelay == 0) {
+        uint32_t reportSlot, reportSlotNum;
+        getReportSlot(reportSlot, reportSlotNum);
+        retryDelay = reportSlotNum * REPORT_SLOT_WIDTH;
+    }
+    _sendModuleStateTask.setInterval(retryDelay);
+}
+
+/**
+ * 同期 DeepSleep 通知
+ * 子モジュール全体へ通知し、全子モジュールから ACK が揃うか再送回数を超えたら自身も DeepSleep する
+ * 再送時は ACK の無いノードの一覧を付け、中継ノードが配下の ACK 待ちか判断できるようにする
+ * 終了時は空の一覧を送り、中継ノードにこれ以上再送しないことを知らせる
+ */
+void TrapModule::sendSyncSleep() {
+    uint8_t expectedNum = getExpectedChildNum();
+    bool isDone = _sleepAckNodes.size() >= expectedNum || _syncSleepTask.isLastIteration();
+    String msg = "{\"" KEY_SYNC_SLEEP "\":true,\"" KEY_MESH_MSG_VERSION "\":" +
+                 String(MESH_MSG_VERSION);
+    if (isDone || !_syncSleepTask.isFirstIteration()) {
+        msg += ",\"" KEY_SLEEP_WAIT "\":[";
+        bool isFirst = true;
+        SimpleList<uint32_t> nodes = _mesh.getNodeList();
+        for (auto &node : nodes) {
+            if (isDone || _sleepAckNodes.count(node) != 0) {
+                continue;
+            }
+            msg += (isFirst ? "" : ",") + String(node);
+            isFirst = false;
+        }
+        msg += "]";
+    }
+    msg += "}";
+    sendMessage(DEF_NODEID, msg);
+    if (isDone) {
+        DEBUG_MSG_F("sync sleep ack:%u/%u\n", (unsigned)_sleepAckNodes.size(), expectedNum);
+        taskStop(_syncSleepTask);
+        _pConfig->_isSleep = true;
     }
-    // 送信に成功しなかった場合輻輳を避けるため送信間隔を変更
-    randomSeed(now());
-    _sendModuleStateTask.setInterval(random(DEF_INTERVAL, MODULE_STATE_INTERVAL));
 }
 
 /**
  * 撮影画像を送信する
+ * 未送信画像を古い順に、1回の呼び出しで1チャンクずつ送信し、未送信画像が無くなったらタスクを停止する
+ * 親モジュールが分かっている場合は親モジュールへ送信し、ACK で欠けたチャンクのみ再送する
  */
 void TrapModule::sendPicture() {
-    DEBUG_MSG_LN("sendPicture");
-    // 送信先がいなければ何もしないz
+    // 送信先がいなければ何もしない
     if (_mesh.getNodeList().size() == 0) {
-        taskStop(_sendPictureTask);
+        DEBUG_MSG_LN("sendPicture: no node");
+        finishSendPicture(false);
         return;
     }
-    if (!SPIFFS.exists(DEF_IMG_PATH)) {
+    if (!_pictureTransfer.isSending()) {
+        // DeepSleep 移行中は新しい画像の送信を始めない
+        if (_pConfig->_isSleep) {
+            taskStop(_sendPictureTask);
+            return;
+        }
+        int8_t slot = _pImageStore->beginSend();
+        if (slot < 0) {
+            DEBUG_MSG_LN("no unsent picture");
+            taskStop(_sendPictureTask);
+            _pImageStore->flushIndex();
+            return;
+        }
+        uint32_t dest =
+            _pConfig->_parentNodeId == getNodeId() ? DEF_NODEID : _pConfig->_parentNodeId;
+        if (!_pictureTransfer.beginSend(dest, ImageStore::getPath(slot).c_str())) {
+            // 送信できない画像は破棄して次の画像へ(大きすぎる画像は画像転送統計に残る)
+            DEBUG_MSG_F("picture discarded:%s\n", ImageStore::getPath(slot).c_str());
+            _pImageStore->discard(slot);
+            return;
+        }
+    }
+    if (_pictureTransfer.isSendComplete()) {
+        DEBUG_MSG_LN("send picture success");
+        finishSendPicture(true);
         return;
     }
-    File file = SPIFFS.open(DEF_IMG_PATH, "r");
-    size_t size = file.size();
-    if (size == 0) {
-        file.close();
+    String msg;
+    if (!_pictureTransfer.createNextChunk(msg)) {
+        // ACK 待ち
+        if (!_pictureTransfer.checkAckTimeout()) {
+            DEBUG_MSG_LN("send picture failed");
+            finishSendPicture(false);
+        }
         return;
     }
-    DEBUG_MSG_LN("read picture");
-    char *buf = (char *)malloc(size);
-    file.readBytes(buf, size);
-    file.close();
-    int encLen = base64_enc_len(size);
-    char *enc = (char *)malloc(encLen + 1);
-    base64_encode(enc, buf, size);
-    free(buf);
-    DEBUG_MSG_LN("encoded");
-    // create json message
-    DEBUG_MSG_F("FreeHeepMem:%lu\n", ESP.getFreeHeap());
-    String temp(enc);
-    free(enc);
-    String msg = "{\"";
-    msg += KEY_PICTURE;
-    msg = msg + "\":\"" + temp + "\"}";
-    DEBUG_MSG_F("FreeHeepMem:%lu\n", ESP.getFreeHeap());
-    DEBUG_MSG_F("msgLength:%d\n", msg.length());
-    DEBUG_MSG_LN(msg);
-    if (_mesh.sendBroadcast(msg)) {
-        DEBUG_MSG_LN("send picture success");
-        taskStop(_sendPictureTask);
+    uint32_t dest = _pictureTransfer.getSendDest();
+    if (sendMessage(dest, msg)) {
+        _pictureTransfer.chunkSent();
         return;
     }
-    DEBUG_MSG_LN(_sendPictureTask.isLastIteration() ? "send picture failed"
-                                                    : "retry send picture...");
+    if (_pictureTransfer.canRetryChunk()) {
+        DEBUG_MSG_LN("retry send picture...");
+        return;
+    }
+    DEBUG_MSG_LN("send picture failed");
+    finishSendPicture(false);
+}
+
+/**
+ * 画像送信終了
+ * 成功した場合は送信済みにして次の未送信画像へ、失敗した場合は未送信のまま送信タスクを停止する
+ */
+void TrapModule::finishSendPicture(bool success) {
+    _pictureTransfer.endSend(success);
+    _pImageStore->endSend(success);
+    if (!success) {
+        taskStop(_sendPictureTask);
+    }
 }
 
 /*************************************
@@ -390,21 +783,32 @@ void TrapModule::blinkLed() {
  */
 void TrapModule::shiftDeepSleep() {
     DEBUG_MSG_LN("Shift Deep Sleep");
+    logHeap("sleep");
+    // 次回起動時の送信スロット数に使うため今回のノード数を保存する
+    if (_maxNodeNum > 1) {
+        _pConfig->setNodeNum(_maxNodeNum);
+    }
     DEBUG_MSG_LN("mesh Stop");
     _mesh.stop();
-    // wifi off
+    // wifi off(ESP32 では WiFi 停止まで待ってから戻るので切断を待つ必要はない)
     DEBUG_MSG_LN("wifi off");
     WiFi.mode(WIFI_OFF);
-    unsigned long dif = millis();
-    while (millis() - dif < 5000) {
-        delay(100);
-        yield();
-        if (WiFi.status() == WL_DISCONNECTED) {
-            break;
-        }
+    // 罠モードでは起動スケジュールから次の起動時刻を決める
+    // 起動時刻は RTC メモリにあれば十分なので、これだけでは NVS に書き込まない
+    if (_pConfig->_trapMode) {
+        _pConfig->_wakeTime = _pConfig->calcWakeTime();
     }
     // 現在の設定値を保存
     _pConfig->saveCurrentModuleConfig();
+    // 親モジュールのバイナリ形式対応バージョンを保存(今回分からなかった場合は前回の値のまま)
+    auto parentVersion = _peerMsgVersion.find(_pConfig->_parentNodeId);
+    if (parentVersion != _peerMsgVersion.end()) {
+        rtcParentNodeId = parentVersion->first;
+        rtcParentMsgVersion = parentVersion->second;
+    }
+    // 子モジュールの状態と画像インデックスを保存
+    _fleetTable.saveSnapshot(_pConfig->_parentNodeId == getNodeId());
+    _pImageStore->flushIndex();
     // バッテリーが限界の場合は手動で起動するまでDeepSleep
     if (_pConfig->_isBatteryDead) {
         DEBUG_MSG_LN("Battery limit!\nshutdown...");
@@ -419,9 +823,13 @@ void TrapModule::shiftDeepSleep() {
     time_t currentTime = now();
     DEBUG_MSG_F("currentTime:%s\n", asctime(gmtime(&currentTime)));
     DEBUG_MSG_F("wakeTime:%s\n", asctime(gmtime(&_pConfig->_wakeTime)));
+    updateRtcDrift();
     // calcSleepTime()の返り値をマイクロ秒にするとなぜか変になるので一旦ミリ秒で返してからマイクロ秒にする
     uint64_t deepSleepTime = _pConfig->_wakeTime - now();
+    lastSleepTime = deepSleepTime;
     deepSleepTime = deepSleepTime * 1000000L;
+    // RTC が遅れる分だけ短く(進む分だけ長く)して全ノードが揃って起動するようにする
+    deepSleepTime -= (int64_t)deepSleepTime * rtcDriftPpm / 1000000;
 #ifdef ESP32
     esp_sleep_enable_timer_wakeup(deepSleepTime);
     esp_deep_sleep_start();
@@ -431,6 +839,51 @@ void TrapModule::shiftDeepSleep() {
 #endif
 }
 
+/**
+ * RTC のずれを更新する
+ * タイマーで起動してメッシュに接続できた場合、起動の遅れを前回の DeepSleep 時間で割ってずれとし、
+ * 計測誤差で振動しないよう半分ずつ補正値に反映する
+ */
+void TrapModule::updateRtcDrift() {
+    if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER || _meshUpTime == 0 ||
+        lastSleepTime < RTC_DRIFT_MIN_SLEEP) {
+        return;
+    }
+    int32_t residual = _timeAdjustSum / lastSleepTime;
+    // 他ノードが長時間起動していた場合などは RTC のずれではないので無視する
+    if (abs(residual) > RTC_DRIFT_PPM_MAX) {
+        DEBUG_MSG_F("rtc drift ignored:%d[ppm]\n", residual);
+        return;
+    }
+    rtcDriftPpm = constrain(rtcDriftPpm + residual / 2, -RTC_DRIFT_PPM_MAX, RTC_DRIFT_PPM_MAX);
+    DEBUG_MSG_F("rtc drift:%d[ppm] residual:%d[ppm]\n", rtcDriftPpm, residual);
+}
+
+/**
+ * DeepSleep 移行
+ * 子モジュールへ同期 DeepSleep 通知を中継するため、要求と直近の通知受信から最低 SLEEP_DRAIN_MIN は
+ * メッシュを動かし続ける
+ * 配下に ACK 待ちの子モジュールがいる中継ノードは、親モジュールが再送を終えるまで
+ * (SYNC_SLEEP_RELAY_MAX を上限に)待ち、送信中の画像があれば SYNC_SLEEP_INTERVAL を上限に
+ * 送信完了を待ってから DeepSleep する
+ */
+void TrapModule::drainBeforeSleep() {
+    unsigned long elapsed = millis() - _sleepRequestTime;
+    if (elapsed < SLEEP_DRAIN_MIN || millis() - _syncSleepTime < SLEEP_DRAIN_MIN) {
+        return;
+    }
+    if (_isRelayingSleep && elapsed < SYNC_SLEEP_RELAY_MAX) {
+        return;
+    }
+    if (_pictureTransfer.isSending() && elapsed < SYNC_SLEEP_INTERVAL) {
+        return;
+    }
+    sleepDrainTime = elapsed;
+    DEBUG_MSG_F("sleep drain:%lu[msec]\n", elapsed);
+    taskStop(_drainSleepTask);
+    shiftDeepSleep();
+}
+
 /**
  * バッテリー残量が限界値を超えたら矯正シャットダウンさせる
  * 基本的に設置モード時のみ有効にする想定
@@ -485,7 +938,54 @@ void TrapModule::startSendModuleState() {
     if (_pConfig->_isSendModuleState) {
         return;
     }
-    taskStart(_sendModuleStateTask, DEF_INTERVAL);
+    // トポロジが変わると自身のスロットも変わるので、送信待ちの場合も送信時刻を設定し直す
+    taskStop(_sendModuleStateTask);
+    taskStart(_sendModuleStateTask, calcReportSlotDelay());
+}
+
+/**
+ * 自身のモジュール状態送信スロットとスロット数
+ * 親モジュールを除くメッシュ内の全ノード(自身を含む)にノード ID の昇順で 1 スロットずつ割り当てる
+ * ノード ID の剰余と違い、同じノード一覧を見ている子モジュール同士ではスロットが重ならない
+ */
+void TrapModule::getReportSlot(uint32_t &slot, uint32_t &slotNum) {
+    uint32_t nodeId = getNodeId();
+    slot = 0;
+    slotNum = 1;
+    SimpleList<uint32_t> nodes = _mesh.getNodeList();
+    for (auto &node : nodes) {
+        if (node == _pConfig->_parentNodeId || node == nodeId) {
+            continue;
+        }
+        ++slotNum;
+        if (node < nodeId) {
+            ++slot;
+        }
+    }
+}
+
+/**
+ * 次の自身のモジュール状態送信スロットまでの時間[msec]
+ * 子モジュール数分のスロットを 1 周期とし、全ノードで同期しているメッシュ時刻を基準にするので、
+ * 親モジュールは送信時刻を予測できる
+ * トポロジが変わる度に送信時刻を設定し直すので、メッシュが揃えば全子モジュールが同じ周期になる
+ */
+unsigned long TrapModule::calcReportSlotDelay() {
+    uint32_t reportSlot, reportSlotNum;
+    getReportSlot(reportSlot, reportSlotNum);
+    uint32_t period = reportSlotNum * REPORT_SLOT_WIDTH;
+    uint32_t slotStart = reportSlot * REPORT_SLOT_WIDTH;
+    uint32_t elapsed = (_mesh.getNodeTime() / 1000) % period;
+    return (slotStart + period - elapsed) % period;
+}
+
+/**
+ * 未送信画像があれば画像送信開始
+ */
+void TrapModule::startSendPicture() {
+    if (_pImageStore->hasUnsent()) {
+        taskStart(_sendPictureTask);
+    }
 }
 
 /********************************************
@@ -493,21 +993,25 @@ void TrapModule::startSendModuleState() {
  *******************************************/
 /**
  * カメラスナップショット
+ * burstNum 枚連続で撮影する
+ * 撮影画像はリングバッファに保存されるので画像送信中でも撮影できる
+ * 1 枚目の書き込み位置はここで確保し、その保存先を path に返す
  */
-bool TrapModule::snapCamera(int resolution) {
+bool TrapModule::snapCamera(String &path, int resolution, uint8_t burstNum) {
     DEBUG_MSG_LN("snapCamera");
     if (!_pConfig->_cameraEnable) {
         DEBUG_MSG_LN("camera cannot use");
         return false;
     }
-    // 画像転送タスク実行中はカメラ撮影は実行しない
-    if (_sendPictureTask.isEnabled()) {
-        DEBUG_MSG_LN("camera cannot use because picture send task is running");
-        return false;
-    }
-    if (eTaskGetState(_taskHandle[0]) == eSuspended) {
+    if (!_isCameraBusy) {
+        _isCameraBusy = true;
+        // 送信中の画像は上書きしないので 1 枚分少なくする
+        _burstNum = constrain(burstNum, 1, IMAGE_RING_SIZE - 1);
         Camera::getInstance()->setResolution(resolution);
-        vTaskResume(_taskHandle[0]);
+        Camera::getInstance()->setPacketSize(_pConfig->_cameraPacketSize);
+        _reservedSlot = _pImageStore->beginWrite();
+        path = ImageStore::getPath(_reservedSlot);
+        xTaskNotifyGive(_taskHandle[0]);
         return true;
     }
     DEBUG_MSG_LN("camera task is running");
@@ -516,25 +1020,83 @@ bool TrapModule::snapCamera(int resolution) {
 
 /**
  * カメラ撮影タスク
+ * 撮影画像をリングバッファに保存し、画像送信タスクを開始する
+ * 罠作動時にすぐ撮影できるよう、待機前にカメラの撮影準備を済ませておく
  */
-void TrapModule::snapCameraTask(void *arg) {
+void TrapModule::snapCameraTask(void *) {
     TrapModule *pTrapModule = TrapModule::getInstance();
     Camera *pCamera = Camera::getInstance();
+    ImageStore *pImageStore = ImageStore::getInstance();
     DEBUG_MSG_LN("snapCameraTask");
+    pCamera->setPacketSize(pTrapModule->_pConfig->_cameraPacketSize);
     while (1) {
-        if (pCamera->isSetResolution()) {
-            if (pCamera->saveCameraData()) {
-                DEBUG_MSG_LN("snap success");
-                // メッセージ送信タスク実行中でなければ送信タスク開始
-                pTrapModule->_sendPictureTask.setIterations(DEF_ITERATION);
+        bool isTrapFire = pTrapModule->_isTrapFireCapture;
+        if (isTrapFire || pCamera->isSetResolution()) {
+            uint8_t burstNum = isTrapFire ? TRAP_FIRE_BURST_NUM : pTrapModule->_burstNum;
+            uint8_t successNum = 0;
+            for (uint8_t i = 0; i < burstNum; ++i) {
+                // 撮影指示時に確保済みの位置があればそこへ書き込む
+                int8_t slot = pTrapModule->_reservedSlot;
+                pTrapModule->_reservedSlot = -1;
+                if (slot < 0) {
+                    slot = pImageStore->beginWrite();
+                }
+                if (pCamera->saveCameraData(ImageStore::getPath(slot))) {
+                    DEBUG_MSG_F("snap success:%d\n", slot);
+                    pImageStore->commit(slot, pCamera->getCaptureResult().dataLen,
+                                        pCamera->getResolution());
+                    if (isTrapFire && successNum == 0) {
+                        pTrapModule->_trapFireLatency = millis() - pTrapModule->_trapFireTime;
+                        DEBUG_MSG_F("trap fire latency:%lu[msec]\n", pTrapModule->_trapFireLatency);
+                    }
+                    ++successNum;
+                } else {
+                    DEBUG_MSG_F("snap failed at %s\n",
+                                Camera::getCaptureStageName(pCamera->getCaptureResult().error));
+                    pImageStore->discard(slot);
+                }
+            }
+            pImageStore->flushIndex();
+            // 画像送信タスク開始
+            if (successNum > 0 && !pTrapModule->_sendPictureTask.isEnabled()) {
                 pTrapModule->_sendPictureTask.enable();
-            } else {
-                DEBUG_MSG_LN("snap failed");
             }
         }
-        DEBUG_MSG_LN("camera task suspend");
-        vTaskSuspend(pTrapModule->_taskHandle[0]);
-        TASK_DELAY(1);
+        if (isTrapFire) {
+            pTrapModule->_pConfig->setTrapFire(true);
+            pTrapModule->_isTrapFireCapture = false;
+        }
+        // 次の撮影に備えて準備
+        if (!pCamera->isPrepared()) {
+            pCamera->prepare();
+        }
+        // 撮影中に罠が作動した場合は待機せずに撮影する
+        if (pTrapModule->_isTrapFireCapture) {
+            continue;
+        }
+        // 待機中に届いた通知は保持されるので、待機直前の撮影要求も取りこぼさない
+        DEBUG_MSG_LN("camera task wait");
+        pTrapModule->_isCameraBusy = false;
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        pTrapModule->_isCameraBusy = true;
+    }
+}
+
+/**
+ * 罠作動割り込み
+ * 作動時刻を記録して撮影タスクに通知する
+ */
+void IRAM_ATTR TrapModule::trapFireISR() {
+    TrapModule *pTrapModule = _pTrapModule;
+    if (pTrapModule == NULL || pTrapModule->_isTrapFireCapture) {
+        return;
+    }
+    pTrapModule->_trapFireTime = millis();
+    pTrapModule->_isTrapFireCapture = true;
+    BaseType_t isWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(pTrapModule->_taskHandle[0], &isWoken);
+    if (isWoken == pdTRUE) {
+        portYIELD_FROM_ISR();
     }
 }
 
@@ -547,10 +1109,10 @@ void TrapModule::snapCameraTask(void *arg) {
 bool TrapModule::sendDebugMesage(String msg, uint32_t nodeId) {
     if (nodeId != 0) {
         DEBUG_MSG_LN("send debug message single");
-        return _mesh.sendSingle(nodeId, msg);
+        return sendMessage(nodeId, msg);
     }
     DEBUG_MSG_LN("send debug message broadcast");
-    bool success = _mesh.getNodeList().size() == 0 ? true : _mesh.sendBroadcast(msg);
+    bool success = _mesh.getNodeList().size() == 0 ? true : sendMessage(DEF_NODEID, msg);
     receivedCallback(getNodeId(), msg);
     return success;
 }
@@ -559,18 +1121,17 @@ bool TrapModule::sendDebugMesage(String msg, uint32_t nodeId) {
  * Util
  ************************************/
 /**
- * Base64 エンコードされた画像データを保存する
- * ファイル名が NULL ならデフォルト名を使用する
+ * メッセージ送信
+ * 送信先が DEF_NODEID の場合はブロードキャストし、送信結果を通信統計に記録する
  */
-void TrapModule::saveBase64Image(const char *data, const char *name) {
-    int inputLen = strlen(data);
-    int decLen = base64_dec_len((char *)data, inputLen);
-    char *dec = (char *)malloc(decLen + 1);
-    base64_decode(dec, (char *)data, inputLen);
-    File img = SPIFFS.open(name == NULL ? DEF_IMG_PATH : name, "w");
-    img.write((const uint8_t *)dec, decLen + 1);
-    img.close();
-    free(dec);
+bool TrapModule::sendMessage(uint32_t dest, String &msg) {
+    bool success = dest == DEF_NODEID ? _mesh.sendBroadcast(msg) : _mesh.sendSingle(dest, msg);
+    if (success) {
+        ++_meshStats.sent;
+    } else {
+        ++_meshStats.sendFailed;
+    }
+    return success;
 }
 
 /**
@@ -582,8 +1143,9 @@ void TrapModule::refreshMeshDetail() {
     _blinkNodesTask.enableDelayed(BLINK_PERIOD -
                                   (_mesh.getNodeTime() % (BLINK_PERIOD * 1000)) / 1000);
     SimpleList<uint32_t> nodes = _mesh.getNodeList();
+    _maxNodeNum = max(_maxNodeNum, (uint8_t)(nodes.size() + 1));
     // 接続情報表示
-    DEBUG_MSG_F("Num nodes: %d\n", nodes.size());
+    DEBUG_MSG_F("Num nodes: %u\n", (unsigned)nodes.size());
     DEBUG_MSG_F("Connection list:");
     for (auto &node : nodes) {
         DEBUG_MSG_F(" %u", node);
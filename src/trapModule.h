@@ -2,27 +2,73 @@
 #define INCLUDE_GUARD_TRAPMODULE
 
 #include "camera.h"
+#include "fleetTable.h"
+#include "imageStore.h"
+#include "jsonArena.h"
+#include "meshMessage.h"
+#include "messageDispatcher.h"
 #include "moduleConfig.h"
+#include "pictureTransfer.h"
 #include "trapCommon.h"
-#include <ArduinoBase64.h>
 #include <TimeLib.h>
+#include <map>
+#include <set>
 #include <painlessMesh.h>
 
+// メッシュ通信統計
+struct MeshStats {
+    uint32_t sent = 0;              // 送信成功数
+    uint32_t sendFailed = 0;        // 送信失敗数
+    uint32_t received = 0;          // 受信数
+    uint32_t receivedBytes = 0;     // 受信バイト数
+    uint32_t configDelay = 0;       // 直近の設定値更新の伝搬時間[usec](メッシュ時刻で計測)
+    uint32_t reportRetry = 0;       // モジュール状態送信の再送数
+    uint32_t reportCollision = 0;   // 同じスロットで受信したモジュール状態の数
+    uint32_t reportCollectTime = 0; // メッシュ接続から最後のモジュール状態受信までの時間[msec]
+};
+
 class TrapModule {
   private:
-    static TrapModule *_pTrapModule;
+    static SINGLETON_STORAGE TrapModule *_pTrapModule;
 
     ModuleConfig *_pConfig;
     Camera *_pCamera;
+    ImageStore *_pImageStore;
     painlessMesh _mesh;
+    PictureTransfer _pictureTransfer;
+    MeshStats _meshStats;
+    MessageDispatcher _dispatcher;
+    FleetTable _fleetTable; // 子モジュールの状態(親モジュールで使用する)
+    unsigned long _meshUpTime = 0; // 起動から最初のメッシュ接続までの時間[msec]
+    uint8_t _maxNodeNum = 0;       // 今回の起動中に確認した最大ノード数
+    uint32_t _lastReportSlot = UINT32_MAX; // 直近にモジュール状態を受信した通しスロット番号
+    int64_t _timeAdjustSum = 0; // 起動後にメッシュ時刻へ合わせた補正量の合計[usec]
+    std::map<uint32_t, uint8_t> _peerMsgVersion; // ノード毎のバイナリ形式対応バージョン
+    std::set<uint32_t> _reportedNodes; // 今回の起動中にモジュール状態を受信した子モジュール
+    std::set<uint32_t> _sleepAckNodes; // 同期 DeepSleep の ACK を受信した子モジュール
+    std::map<uint32_t, uint32_t> _meshRoutes; // ノード毎の経由する直接接続の NodeId
+    MeshJsonArena _jsonArena{"mesh"}; // メッシュのループ用
 
     // タスク関連
     Task _blinkNodesTask;      // LED タスク
     Task _sendPictureTask;     // 写真撮影フラグ
     Task _sendModuleStateTask; // モジュール状態送信タスク
     Task _checkBatteryLimitTask; // バッテリー残量チェックタスク（設置モードで使用する）
+    Task _logHeapTask;           // ヒープ状態ログ出力タスク
+    Task _syncSleepTask;         // 同期 DeepSleep 通知タスク（親モジュールで使用する）
+    Task _drainSleepTask;        // DeepSleep 移行タスク
+    unsigned long _sleepRequestTime = 0; // DeepSleep 要求時刻[msec]
+    unsigned long _syncSleepTime = 0;    // 直近に同期 DeepSleep 通知を受信した時刻[msec]
+    bool _isRelayingSleep = false; // 配下の子モジュールの ACK 待ちのため再送を中継する
 
     TaskHandle_t _taskHandle[1];
+    volatile uint8_t _burstNum = DEF_BURST_NUM; // 1回の撮影指示での撮影枚数
+    volatile int8_t _reservedSlot = -1;         // 撮影指示時に確保した書き込み位置
+    volatile bool _isCameraBusy = true;         // 撮影タスクが撮影・準備中
+    // 罠作動時撮影
+    volatile bool _isTrapFireCapture = false;   // 罠作動による撮影要求
+    volatile unsigned long _trapFireTime = 0;   // 罠作動検知時刻[msec]
+    unsigned long _trapFireLatency = 0;         // 罠作動から画像保存までの時間[msec]
 
   public:
     static TrapModule *getInstance() {
@@ -49,12 +95,13 @@ class TrapModule {
     bool initGps();
     // モジュール情報取得
     String getMeshGraph() { return _mesh.subConnectionJson(); };
-    void collectModuleInfo(JsonObject &moduleInfo) {
-        _pConfig->collectModuleInfo(_mesh, moduleInfo);
-    };
+    void collectModuleInfo(JsonObject &moduleInfo);
+    void collectFleetState(String &json);
+    void exportModuleConfig(JsonObject &config) { _pConfig->exportModuleConfig(config); };
     // カメラ機能
-    bool snapCamera(int resolution = -1);
+    bool snapCamera(String &path, int resolution = -1, uint8_t burstNum = DEF_BURST_NUM);
     static void snapCameraTask(void *arg);
+    static void IRAM_ATTR trapFireISR();
     // debug 機能
     bool sendDebugMesage(String msg, uint32_t nodeId = 0);
     // deepSleep
@@ -64,19 +111,25 @@ class TrapModule {
     TrapModule() {
         _pConfig = ModuleConfig::getInstance();
         _pCamera = Camera::getInstance();
+        _pImageStore = ImageStore::getInstance();
     };
     // setup
     void setupMesh(const uint16_t types);
+    void setupMessageHandler();
     void setupTask();
     void setupCamera();
-    bool loadModuleConfig() { return _pConfig->loadModuleConfigFile(); };
+    bool loadModuleConfig() { return _pConfig->loadModuleConfig(); };
     bool checkBeforeStart();
     // メッセージ送信
     bool sendCurrentTime();
     void sendPicture();
+    void finishSendPicture(bool success);
     void sendModuleState();
+    void sendSyncSleep();
     // モジュール情報取得
     uint32_t getNodeId() { return _pConfig->_nodeId != 0 ? _pConfig->_nodeId : _mesh.getNodeId(); };
+    // 前回起動時のノード数から自身を除いた子モジュール数(不明な場合は 0)
+    uint8_t getExpectedChildNum() { return _pConfig->_nodeNum > 1 ? _pConfig->_nodeNum - 1 : 0; };
     // センサ情報
     void updateBattery();
     void updateTrapFire();
@@ -85,11 +138,22 @@ class TrapModule {
     void newConnectionCallback(uint32_t nodeId);
     void changedConnectionCallback();
     void nodeTimeAdjustedCallback(int32_t offset);
+    void receivedBinaryMessage(uint32_t from, const String &msg);
+    void receivedModuleState(const ModuleState &state);
+    void updateTopology();
+    void addMeshRoutes(JsonVariant node, uint32_t via);
+    bool hasWaitingDownstream(uint32_t from, JsonObject &msg);
+    uint8_t getPeerMsgVersion(uint32_t nodeId) {
+        auto it = _peerMsgVersion.find(nodeId);
+        return it == _peerMsgVersion.end() ? 0 : it->second;
+    }
     // task
     void blinkLed();
     void setTask(Task &task, const unsigned long interval, const long iteration,
                  TaskCallback aCallback, const bool isEnable);
     void checkBatteryLimit();
+    void drainBeforeSleep();
+    void updateRtcDrift();
     void taskStart(Task &task, unsigned long duration = 0, long iteration = -1);
     void taskStop(Task &task) {
         if (task.isEnabled()) {
@@ -97,17 +161,23 @@ class TrapModule {
         }
     }
     void startSendModuleState();
+    void getReportSlot(uint32_t &slot, uint32_t &slotNum);
+    unsigned long calcReportSlotDelay();
+    void startSendPicture();
     // util
-    void saveBase64Image(const char *data, const char *name = NULL);
+    bool sendMessage(uint32_t dest, String &msg);
+    // JSON メッセージには自身のバイナリ形式対応バージョンを付与する
     bool sendBroadcast(JsonObject &obj) {
+        obj[KEY_MESH_MSG_VERSION] = MESH_MSG_VERSION;
         String msg;
         obj.printTo(msg);
-        return _mesh.sendBroadcast(msg);
+        return sendMessage(DEF_NODEID, msg);
     }
     bool sendParent(JsonObject &obj) {
+        obj[KEY_MESH_MSG_VERSION] = MESH_MSG_VERSION;
         String msg;
         obj.printTo(msg);
-        return _mesh.sendSingle(_pConfig->_parentNodeId, msg);
+        return sendMessage(_pConfig->_parentNodeId, msg);
     }
     void refreshMeshDetail();
 };
@@ -8,6 +8,10 @@ void TrapServer::setupServer() {
               std::bind(&TrapServer::onSetConfig, this, std::placeholders::_1));
     server.on("/getModuleInfo", HTTP_GET,
               std::bind(&TrapServer::onGetModuleInfo, this, std::placeholders::_1));
+    server.on("/exportConfig", HTTP_GET,
+              std::bind(&TrapServer::onExportConfig, this, std::placeholders::_1));
+    server.on("/getFleetState", HTTP_GET,
+              std::bind(&TrapServer::onGetFleetState, this, std::placeholders::_1));
     server.on("/getMeshGraph", HTTP_GET,
               std::bind(&TrapServer::onGetMeshGraph, this, std::placeholders::_1));
     server.on("/setCurrentTime", HTTP_POST,
@@ -31,7 +35,8 @@ void TrapServer::setupServer() {
 void TrapServer::onSetConfig(AsyncWebServerRequest *request) {
     DEBUG_MSG_LN("onSetConfig");
     // 設定値反映
-    DynamicJsonBuffer jsonBuf(JSON_BUF_NUM);
+    WebJsonArenaLock arenaLock(_jsonArena);
+    WebJsonBuffer &jsonBuf = arenaLock.buffer();
     JsonObject &config = jsonBuf.createObject();
     // 罠モード
     String temp = request->arg(KEY_TRAP_MODE);
@@ -48,6 +53,16 @@ void TrapServer::onSetConfig(AsyncWebServerRequest *request) {
     if (temp != NULL && temp.length() != 0) {
         config[KEY_ACTIVE_END] = temp.toInt();
     }
+    // 起動スケジュール(1 時間毎なら 6 桁、15 分毎なら 24 桁の 16 進数)
+    temp = request->arg(KEY_WAKE_SCHEDULE);
+    if (temp != NULL && temp.length() != 0) {
+        config[KEY_WAKE_SCHEDULE] = temp;
+    }
+    // カメラパケットサイズ(0 の場合は自動調整)
+    temp = request->arg(KEY_CAMERA_PACKET_SIZE);
+    if (temp != NULL && temp.length() != 0) {
+        config[KEY_CAMERA_PACKET_SIZE] = temp.toInt();
+    }
     // 設定された変更値で全モジュールの設定値を更新
     if (_trapModule->syncConfig(config)) {
         String cfg;
@@ -65,15 +80,47 @@ void TrapServer::onSetConfig(AsyncWebServerRequest *request) {
 void TrapServer::onGetModuleInfo(AsyncWebServerRequest *request) {
     DEBUG_MSG_F("FreeHeepMem:%lu\n", ESP.getFreeHeap());
     DEBUG_MSG_LN("onGetModuleInfo");
-    DynamicJsonBuffer jsonBuf(JSON_BUF_NUM);
+    WebJsonArenaLock arenaLock(_jsonArena);
+    WebJsonBuffer &jsonBuf = arenaLock.buffer();
     JsonObject &moduleInfo = jsonBuf.createObject();
     _trapModule->collectModuleInfo(moduleInfo);
+    // 欠けた JSON を返さないようバッファが溢れた場合はエラーにする
+    if (!moduleInfo.success() || arenaLock.isOverflowed()) {
+        request->send(500, "text/plain", "module info too large");
+        return;
+    }
     String response;
     moduleInfo.printTo(response);
     DEBUG_MSG_LN(response);
     request->send(200, "application/json", response);
 }
 
+/**
+ * 設定値エクスポート
+ * 設定値はバイナリ形式で保存しているので JSON で取得する場合はこれを使う(インポートは /setConfig)
+ */
+void TrapServer::onExportConfig(AsyncWebServerRequest *request) {
+    DEBUG_MSG_LN("onExportConfig");
+    WebJsonArenaLock arenaLock(_jsonArena);
+    WebJsonBuffer &jsonBuf = arenaLock.buffer();
+    JsonObject &config = jsonBuf.createObject();
+    _trapModule->exportModuleConfig(config);
+    String response;
+    config.printTo(response);
+    request->send(200, "application/json", response);
+}
+
+/**
+ * 子モジュールの状態一覧取得
+ */
+void TrapServer::onGetFleetState(AsyncWebServerRequest *request) {
+    DEBUG_MSG_LN("onGetFleetState");
+    String response;
+    _trapModule->collectFleetState(response);
+    DEBUG_MSG_LN(response);
+    request->send(200, "application/json", response);
+}
+
 /**
  * メッシュネットワーク状態取得
  */
@@ -111,8 +158,16 @@ void TrapServer::onSnapShot(AsyncWebServerRequest *request) {
     if (temp != NULL && temp.length() > 0) {
         picFmt = temp.toInt();
     }
-    if (_trapModule->snapCamera(picFmt)) {
-        request->send(200, "image/jpeg", DEF_IMG_PATH);
+    // 連続撮影枚数
+    temp = request->arg(KEY_BURST_NUM);
+    int burstNum = DEF_BURST_NUM;
+    if (temp != NULL && temp.length() > 0) {
+        burstNum = temp.toInt();
+    }
+    // 撮影画像(連続撮影の場合は 1 枚目)の保存先を返す
+    String path;
+    if (_trapModule->snapCamera(path, picFmt, constrain(burstNum, 1, IMAGE_RING_SIZE))) {
+        request->send(200, "image/jpeg", path);
         return;
     }
     request->send(500);
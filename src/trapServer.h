@@ -5,10 +5,35 @@
 #include "trapModule.h"
 #include <ESPAsyncWebServer.h>
 
+// /getModuleInfo の要素数(TrapModule::collectModuleInfo で変更した場合は合わせること)
+#define MODULE_INFO_KEY_NUM 23   // 最上位のキー数
+#define MESH_STATS_KEY_NUM 11    // mesh_stats のキー数
+#define BOOT_STATS_KEY_NUM 6     // boot_stats のキー数
+#define PICTURE_STATS_KEY_NUM 5  // picture_stats のキー数
+#define HANDLER_STATS_KEY_NUM 3  // handler_stats の各ハンドラのキー数
+#define MESSAGE_LOG_ITEM_NUM 3   // message_log の各ログの要素数
+// /getModuleInfo の最大サイズ(ノードリストは FLEET_TABLE_SIZE 台まで、複製される文字列を含む)
+#define MODULE_INFO_JSON_SIZE                                                                     \
+    (JSON_OBJECT_SIZE(MODULE_INFO_KEY_NUM) + JSON_ARRAY_SIZE(FLEET_TABLE_SIZE) +                  \
+     JSON_OBJECT_SIZE(MESH_STATS_KEY_NUM) + JSON_OBJECT_SIZE(BOOT_STATS_KEY_NUM) +                \
+     JSON_OBJECT_SIZE(PICTURE_STATS_KEY_NUM) + JSON_ARRAY_SIZE(FLEET_LOG_SIZE) +                  \
+     FLEET_LOG_SIZE * JSON_ARRAY_SIZE(MESSAGE_LOG_ITEM_NUM) +                                     \
+     JSON_OBJECT_SIZE(MESSAGE_HANDLER_MAX) +                                                      \
+     MESSAGE_HANDLER_MAX * JSON_OBJECT_SIZE(HANDLER_STATS_KEY_NUM) + GPS_STR_LEN * 2 +            \
+     WAKE_SCHEDULE_QUARTER_LEN + 1)
+// Web サーバ用 JSON バッファサイズ
+#define WEB_JSON_BUF_NUM                                                                          \
+    (MODULE_INFO_JSON_SIZE > JSON_BUF_NUM ? MODULE_INFO_JSON_SIZE : JSON_BUF_NUM)
+
+typedef JsonArena<WEB_JSON_BUF_NUM> WebJsonArena;
+typedef JsonArenaLock<WEB_JSON_BUF_NUM> WebJsonArenaLock;
+typedef StaticJsonBuffer<WEB_JSON_BUF_NUM> WebJsonBuffer;
+
 class TrapServer {
   private:
     AsyncWebServer server = AsyncWebServer(80);
     TrapModule *_trapModule;
+    WebJsonArena _jsonArena{"web"}; // Web サーバ用
 
   public:
     TrapServer() { _trapModule = TrapModule::getInstance(); };
@@ -20,6 +45,8 @@ class TrapServer {
     // server call back
     void onSetConfig(AsyncWebServerRequest *request);
     void onGetModuleInfo(AsyncWebServerRequest *request);
+    void onGetFleetState(AsyncWebServerRequest *request);
+    void onExportConfig(AsyncWebServerRequest *request);
     void onGetMeshGraph(AsyncWebServerRequest *request);
     void onSetCurrentTime(AsyncWebServerRequest *request);
     void onSnapShot(AsyncWebServerRequest *request);
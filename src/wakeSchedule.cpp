@@ -0,0 +1,110 @@
+#include "wakeSchedule.h"
+
+/**
+ * from 番目以降で最初に立っているビットの位置を返す(無ければ -1)
+ */
+int16_t WakeSchedule::findSlot(const WakeScheduleBits &schedule, uint16_t from) {
+    for (uint8_t i = from / 32; i < WAKE_SCHEDULE_WORDS; ++i) {
+        uint32_t bits = schedule[i];
+        if (i == from / 32) {
+            bits &= UINT32_MAX << (from % 32);
+        }
+        if (bits != 0) {
+            return i * 32 + __builtin_ctz(bits);
+        }
+    }
+    return -1;
+}
+
+/**
+ * 現在時刻から走査して最初に立っているビットの時刻を返す(スケジュールが空なら 0)
+ * 現在時刻から15分以内(WAKE_TIME_SET_MIN)の起動時刻は飛ばし、当日に無ければ翌日から探す
+ * 例）今が 13:46 で 14:00 と 15:00 のビットが立っていれば 14:00 を飛ばして 15:00
+ */
+time_t WakeSchedule::nextWakeTime(const WakeScheduleBits &schedule, time_t current) {
+    const time_t slotSec = WAKE_SCHEDULE_SLOT_MIN * SECS_PER_MIN;
+    time_t dayStart = previousMidnight(current);
+    // 15分より後の最初のスロットから探す
+    time_t earliest = current + WAKE_TIME_SET_MIN * SECS_PER_MIN + 1;
+    uint16_t from = (earliest - dayStart + slotSec - 1) / slotSec;
+    if (from >= WAKE_SCHEDULE_SLOT_NUM) {
+        dayStart += SECS_PER_DAY;
+        from -= WAKE_SCHEDULE_SLOT_NUM;
+    }
+    int16_t slot = findSlot(schedule, from);
+    if (slot < 0) {
+        slot = findSlot(schedule, 0);
+        if (slot < 0) {
+            return 0;
+        }
+        dayStart += SECS_PER_DAY;
+    }
+    return dayStart + slot * slotSec;
+}
+
+/**
+ * 起動時刻がスケジュールに含まれているか
+ */
+bool WakeSchedule::isScheduled(const WakeScheduleBits &schedule, time_t wakeTime) {
+    uint16_t slot = elapsedSecsToday(wakeTime) / (WAKE_SCHEDULE_SLOT_MIN * SECS_PER_MIN);
+    return (schedule[slot / 32] >> (slot % 32)) & 1;
+}
+
+/**
+ * 稼働開始時刻から稼働停止時刻まで(停止時刻を含む)毎正時に起動するスケジュールを作る
+ * 停止時刻が開始時刻より前の場合は日をまたぐ
+ */
+void WakeSchedule::fromRange(uint8_t activeStart, uint8_t activeEnd,
+                             WakeScheduleBits &schedule) {
+    memset(schedule, 0, sizeof(schedule));
+    uint8_t hourNum = activeStart <= activeEnd ? activeEnd - activeStart + 1
+                                               : activeEnd + 24 - activeStart + 1;
+    hourNum = min(hourNum, (uint8_t)24);
+    for (uint8_t i = 0; i < hourNum; ++i) {
+        uint16_t slot = (activeStart + i) % 24 * (60 / WAKE_SCHEDULE_SLOT_MIN);
+        schedule[slot / 32] |= 1UL << (slot % 32);
+    }
+}
+
+/**
+ * 16 進文字列からスケジュールを作る
+ * 6 文字なら 1 時間毎、24 文字なら 15 分毎のビットマップとして扱い、末尾の桁がビット 0
+ * 不正な文字列の場合は false を返し schedule は変更しない
+ */
+bool WakeSchedule::fromHex(const char *hex, WakeScheduleBits &schedule) {
+    size_t len = hex ? strlen(hex) : 0;
+    if (len != WAKE_SCHEDULE_HOURLY_LEN && len != WAKE_SCHEDULE_QUARTER_LEN) {
+        DEBUG_MSG_F("invalid wake schedule:%s\n", hex ? hex : "");
+        return false;
+    }
+    // 1 時間毎の指定は各時刻の正時のビットに割り当てる
+    uint8_t step = len == WAKE_SCHEDULE_HOURLY_LEN ? 60 / WAKE_SCHEDULE_SLOT_MIN : 1;
+    WakeScheduleBits parsed = {0};
+    for (size_t i = 0; i < len; ++i) {
+        char c = hex[len - 1 - i];
+        if (!isxdigit(c)) {
+            DEBUG_MSG_F("invalid wake schedule:%s\n", hex);
+            return false;
+        }
+        uint8_t nibble = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+        for (uint8_t b = 0; b < 4; ++b) {
+            if (nibble & (1 << b)) {
+                uint16_t slot = (i * 4 + b) * step;
+                parsed[slot / 32] |= 1UL << (slot % 32);
+            }
+        }
+    }
+    memcpy(schedule, parsed, sizeof(schedule));
+    return true;
+}
+
+/**
+ * 15 分毎の 16 進文字列にする(末尾の桁がビット 0)
+ */
+String WakeSchedule::toHex(const WakeScheduleBits &schedule) {
+    char hex[WAKE_SCHEDULE_QUARTER_LEN + 1];
+    for (uint8_t i = 0; i < WAKE_SCHEDULE_WORDS; ++i) {
+        snprintf(&hex[i * 8], 9, "%08x", schedule[WAKE_SCHEDULE_WORDS - 1 - i]);
+    }
+    return String(hex);
+}
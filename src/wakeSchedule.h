@@ -0,0 +1,24 @@
+#ifndef INCLUDE_GUARD_WAKE_SCHEDULE
+#define INCLUDE_GUARD_WAKE_SCHEDULE
+
+#include "trapCommon.h"
+#include <TimeLib.h>
+
+// 起動スケジュール(ビット n が 0 時から 15n 分後の起動時刻)
+typedef uint32_t WakeScheduleBits[WAKE_SCHEDULE_WORDS];
+
+/**
+ * 起動スケジュールのビットマップ操作
+ * 設定値や時計に依存しないのでホスト上でもテストできる
+ */
+class WakeSchedule {
+  public:
+    static int16_t findSlot(const WakeScheduleBits &schedule, uint16_t from);
+    static time_t nextWakeTime(const WakeScheduleBits &schedule, time_t current);
+    static bool isScheduled(const WakeScheduleBits &schedule, time_t wakeTime);
+    static void fromRange(uint8_t activeStart, uint8_t activeEnd, WakeScheduleBits &schedule);
+    static bool fromHex(const char *hex, WakeScheduleBits &schedule);
+    static String toHex(const WakeScheduleBits &schedule);
+};
+
+#endif // INCLUDE_GUARD_WAKE_SCHEDULE
@@ -0,0 +1,142 @@
+#ifndef INCLUDE_GUARD_NATIVE_ARDUINO
+#define INCLUDE_GUARD_NATIVE_ARDUINO
+
+/**
+ * native 環境用の Arduino 代替
+ * ホスト上でテスト・ベンチマークを動かすのに必要な分だけを標準ライブラリで実装する
+ * 時刻は起動からの経過時間(steady_clock)、Serial は環境変数 TRAP_NATIVE_VERBOSE が
+ * 設定されている場合のみ標準出力に書き出す
+ * 仮想時刻の時計(native::VirtualClock)が設定されたスレッドでは時刻と待ちは仮想時刻になる
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "WString.h"
+#include "esp_sleep.h"
+#include "freertos/FreeRTOS.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x02
+#define RISING 0x01
+#define A0 36
+
+using std::max;
+using std::min;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+namespace native {
+inline std::chrono::steady_clock::time_point bootTime() {
+    static const std::chrono::steady_clock::time_point boot = std::chrono::steady_clock::now();
+    return boot;
+}
+} // namespace native
+
+inline unsigned long micros() {
+    if (native::virtualClock() != NULL) {
+        return native::virtualClock()->micros();
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - native::bootTime())
+        .count();
+}
+inline unsigned long millis() { return micros() / 1000; }
+inline void delayMicroseconds(unsigned int us) {
+    if (native::virtualClock() != NULL) {
+        native::virtualClock()->delay(us);
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+inline void delay(unsigned long ms) {
+    if (native::virtualClock() != NULL) {
+        native::virtualClock()->delay(ms * 1000ULL);
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+inline void yield() { std::this_thread::yield(); }
+inline long random(long howbig) { return howbig <= 0 ? 0 : std::rand() % howbig; }
+inline long random(long howsmall, long howbig) {
+    return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+inline void randomSeed(unsigned long seed) { std::srand(seed); }
+inline bool isDigit(int c) { return std::isdigit(c) != 0; }
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+inline uint16_t analogRead(uint8_t) { return 0; }
+
+/**
+ * ESP32 のチップ機能
+ * ヒープは実機の起動直後程度の固定値を返す
+ */
+class EspClass {
+  public:
+    uint32_t getFreeHeap() { return 200000; }
+    void deepSleep(uint64_t time_us) {
+        esp_sleep_enable_timer_wakeup(time_us);
+        esp_deep_sleep_start();
+    }
+};
+
+inline EspClass ESP;
+
+/**
+ * デバッグ出力先
+ */
+class HostSerial {
+  private:
+    bool isVerbose() {
+        static const bool verbose = std::getenv("TRAP_NATIVE_VERBOSE") != NULL;
+        return verbose;
+    }
+
+  public:
+    void begin(unsigned long) {}
+    size_t print(const String &s) { return print(s.c_str()); }
+    size_t print(const char *s) {
+        if (!isVerbose()) {
+            return 0;
+        }
+        std::fputs(s, stdout);
+        return strlen(s);
+    }
+    size_t print(char c) { return printf("%c", c); }
+    size_t print(int n) { return printf("%d", n); }
+    size_t print(unsigned int n) { return printf("%u", n); }
+    size_t print(long n) { return printf("%ld", n); }
+    size_t print(unsigned long n) { return printf("%lu", n); }
+    size_t print(double n) { return printf("%.2f", n); }
+    template <typename T> size_t println(const T &v) { return print(v) + print("\n"); }
+    size_t println() { return print("\n"); }
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        if (!isVerbose()) {
+            return 0;
+        }
+        va_list args;
+        va_start(args, format);
+        int len = std::vprintf(format, args);
+        va_end(args);
+        return len < 0 ? 0 : len;
+    }
+};
+
+inline HostSerial Serial;
+
+#endif // INCLUDE_GUARD_NATIVE_ARDUINO
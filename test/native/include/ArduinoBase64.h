@@ -0,0 +1,68 @@
+#ifndef INCLUDE_GUARD_NATIVE_ARDUINO_BASE64
+#define INCLUDE_GUARD_NATIVE_ARDUINO_BASE64
+
+/**
+ * native 環境用の arduino-base64 代替
+ * 元のライブラリと同じく、エンコード・デコードとも出力の末尾に終端文字を付けて出力長を返す
+ */
+
+#include <cstdint>
+#include <cstring>
+
+namespace native {
+inline const char *base64Alphabet() {
+    return "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+}
+inline int base64Index(char c) {
+    const char *pos = strchr(base64Alphabet(), c);
+    return c == '\0' || pos == NULL ? 0 : pos - base64Alphabet();
+}
+} // namespace native
+
+inline int base64_enc_len(int plainLen) { return (plainLen + 2) / 3 * 4; }
+
+inline int base64_encode(char *output, char *input, int inputLen) {
+    const char *alphabet = native::base64Alphabet();
+    int encLen = 0;
+    for (int i = 0; i < inputLen; i += 3) {
+        int remain = inputLen - i;
+        uint32_t block = (uint8_t)input[i] << 16;
+        block |= remain > 1 ? (uint8_t)input[i + 1] << 8 : 0;
+        block |= remain > 2 ? (uint8_t)input[i + 2] : 0;
+        output[encLen++] = alphabet[(block >> 18) & 0x3f];
+        output[encLen++] = alphabet[(block >> 12) & 0x3f];
+        output[encLen++] = remain > 1 ? alphabet[(block >> 6) & 0x3f] : '=';
+        output[encLen++] = remain > 2 ? alphabet[block & 0x3f] : '=';
+    }
+    output[encLen] = '\0';
+    return encLen;
+}
+
+inline int base64_dec_len(char *input, int inputLen) {
+    int padding = 0;
+    for (int i = inputLen - 1; i >= 0 && input[i] == '='; --i) {
+        ++padding;
+    }
+    return inputLen / 4 * 3 - padding;
+}
+
+inline int base64_decode(char *output, char *input, int inputLen) {
+    int decLen = 0;
+    for (int i = 0; i + 3 < inputLen; i += 4) {
+        uint32_t block = 0;
+        for (int j = 0; j < 4; ++j) {
+            block = block << 6 | native::base64Index(input[i + j]);
+        }
+        output[decLen++] = block >> 16;
+        if (input[i + 2] != '=') {
+            output[decLen++] = block >> 8;
+        }
+        if (input[i + 3] != '=') {
+            output[decLen++] = block;
+        }
+    }
+    output[decLen] = '\0';
+    return decLen;
+}
+
+#endif // INCLUDE_GUARD_NATIVE_ARDUINO_BASE64
@@ -0,0 +1,34 @@
+#ifndef INCLUDE_GUARD_NATIVE_HARDWARE_SERIAL
+#define INCLUDE_GUARD_NATIVE_HARDWARE_SERIAL
+
+/**
+ * native 環境用の HardwareSerial 代替
+ * 接続先が無いので何も受信せず、readBytes は実機と同じくタイムアウトまで待って戻る
+ * (カメラを使うテストは CameraPort を差し替えて使う)
+ */
+
+#include "Arduino.h"
+
+#define SERIAL_8N1 0x800001c
+
+class HardwareSerial {
+  private:
+    unsigned long _timeout = 1000;
+
+  public:
+    explicit HardwareSerial(int) {}
+    void begin(unsigned long, uint32_t = SERIAL_8N1, int8_t = -1, int8_t = -1) {}
+    void updateBaudRate(unsigned long) {}
+    size_t setRxBufferSize(size_t size) { return size; }
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    int available() { return 0; }
+    int read() { return -1; }
+    size_t write(const uint8_t *, size_t size) { return size; }
+    size_t readBytes(uint8_t *, size_t) {
+        delay(_timeout);
+        return 0;
+    }
+    void flush() {}
+};
+
+#endif // INCLUDE_GUARD_NATIVE_HARDWARE_SERIAL
@@ -0,0 +1,68 @@
+#ifndef INCLUDE_GUARD_NATIVE_PREFERENCES
+#define INCLUDE_GUARD_NATIVE_PREFERENCES
+
+/**
+ * native 環境用の Preferences(NVS)代替
+ * 名前空間毎のキーと値をメモリに持つ
+ * NVS は DeepSleep しても消えないが、VirtualMesh のノード毎に別の NVS になるようスレッド毎に持つ
+ */
+
+#include "Arduino.h"
+#include <map>
+#include <string>
+#include <vector>
+
+class Preferences {
+  private:
+    typedef std::map<std::string, std::vector<uint8_t>> Namespace;
+    Namespace *_namespace = NULL;
+    bool _isReadOnly = false;
+
+    static std::map<std::string, Namespace> &storage() {
+        thread_local std::map<std::string, Namespace> nvs;
+        return nvs;
+    }
+
+  public:
+    bool begin(const char *name, bool readOnly = false) {
+        _namespace = &storage()[name];
+        _isReadOnly = readOnly;
+        return true;
+    }
+    void end() { _namespace = NULL; }
+    size_t putBytes(const char *key, const void *value, size_t len) {
+        if (_namespace == NULL || _isReadOnly) {
+            return 0;
+        }
+        const uint8_t *bytes = (const uint8_t *)value;
+        (*_namespace)[key].assign(bytes, bytes + len);
+        return len;
+    }
+    size_t getBytesLength(const char *key) {
+        if (_namespace == NULL || _namespace->count(key) == 0) {
+            return 0;
+        }
+        return (*_namespace)[key].size();
+    }
+    // ESP32 と同じく格納されている値より短いバッファには読み出さない
+    size_t getBytes(const char *key, void *buf, size_t maxLen) {
+        size_t len = getBytesLength(key);
+        if (len == 0 || len > maxLen) {
+            return 0;
+        }
+        memcpy(buf, (*_namespace)[key].data(), len);
+        return len;
+    }
+    bool remove(const char *key) {
+        return _namespace != NULL && !_isReadOnly && _namespace->erase(key) > 0;
+    }
+    bool clear() {
+        if (_namespace == NULL || _isReadOnly) {
+            return false;
+        }
+        _namespace->clear();
+        return true;
+    }
+};
+
+#endif // INCLUDE_GUARD_NATIVE_PREFERENCES
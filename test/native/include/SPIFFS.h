@@ -0,0 +1,137 @@
+#ifndef INCLUDE_GUARD_NATIVE_SPIFFS
+#define INCLUDE_GUARD_NATIVE_SPIFFS
+
+/**
+ * native 環境用の SPIFFS 代替
+ * 一時ディレクトリ以下(環境変数 TRAP_NATIVE_SPIFFS で変更可)のファイルとして読み書きする
+ * VirtualMesh のノード毎に別のディレクトリを使えるようスレッド毎に持つ
+ */
+
+#include "Arduino.h"
+#include <filesystem>
+#include <memory>
+
+namespace fs {
+
+enum SeekMode { SeekSet = SEEK_SET, SeekCur = SEEK_CUR, SeekEnd = SEEK_END };
+
+class File {
+  private:
+    std::shared_ptr<FILE> _fp;
+    String _name;
+
+  public:
+    File() {}
+    File(FILE *fp, const String &name) : _fp(fp, fclose), _name(name) {}
+
+    operator bool() const { return _fp != nullptr; }
+    const char *name() const { return _name.c_str(); }
+    size_t write(const uint8_t *buf, size_t size) {
+        return _fp ? fwrite(buf, 1, size, _fp.get()) : 0;
+    }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+    size_t read(uint8_t *buf, size_t size) { return _fp ? fread(buf, 1, size, _fp.get()) : 0; }
+    size_t readBytes(char *buf, size_t size) { return read((uint8_t *)buf, size); }
+    int read() {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+    size_t position() const { return _fp ? ftell(_fp.get()) : 0; }
+    bool seek(uint32_t pos, SeekMode mode = SeekSet) {
+        return _fp && fseek(_fp.get(), pos, mode) == 0;
+    }
+    size_t size() const {
+        if (!_fp) {
+            return 0;
+        }
+        long pos = ftell(_fp.get());
+        fseek(_fp.get(), 0, SEEK_END);
+        long size = ftell(_fp.get());
+        fseek(_fp.get(), pos, SEEK_SET);
+        return size;
+    }
+    int available() { return size() - position(); }
+    String readString() {
+        String str;
+        for (int c = read(); c >= 0; c = read()) {
+            str += (char)c;
+        }
+        return str;
+    }
+    void flush() {
+        if (_fp) {
+            fflush(_fp.get());
+        }
+    }
+    // 他のコピーが同じファイルを持っていても閉じる
+    void close() {
+        if (_fp) {
+            fflush(_fp.get());
+        }
+        _fp.reset();
+    }
+};
+
+class SPIFFSFS {
+  private:
+    std::filesystem::path _root;
+
+  public:
+    SPIFFSFS() {
+        const char *root = std::getenv("TRAP_NATIVE_SPIFFS");
+        _root = root != NULL ? std::filesystem::path(root)
+                             : std::filesystem::temp_directory_path() / "trapModule_spiffs";
+    }
+    // ホスト上の保存先を変える(native 環境のみ)
+    void setRoot(const std::filesystem::path &root) { _root = root; }
+    const std::filesystem::path &getRoot() const { return _root; }
+    std::filesystem::path hostPath(const String &path) const {
+        return _root / std::filesystem::path(path.c_str()).relative_path();
+    }
+    bool begin(bool = false) {
+        std::error_code error;
+        std::filesystem::create_directories(_root, error);
+        return !error;
+    }
+    bool format() {
+        std::error_code error;
+        std::filesystem::remove_all(_root, error);
+        return begin();
+    }
+    bool exists(const String &path) const { return std::filesystem::exists(hostPath(path)); }
+    bool remove(const String &path) {
+        std::error_code error;
+        return std::filesystem::remove(hostPath(path), error);
+    }
+    bool rename(const String &from, const String &to) {
+        std::error_code error;
+        std::filesystem::rename(hostPath(from), hostPath(to), error);
+        return !error;
+    }
+    File open(const String &path, const char *mode = "r") {
+        String hostMode = String(mode) + "b";
+        FILE *fp = fopen(hostPath(path).c_str(), hostMode.c_str());
+        return fp == NULL ? File() : File(fp, path);
+    }
+    size_t totalBytes() const { return 1441792; }
+    size_t usedBytes() const {
+        size_t used = 0;
+        std::error_code error;
+        for (auto &entry : std::filesystem::directory_iterator(_root, error)) {
+            used += entry.is_regular_file() ? entry.file_size() : 0;
+        }
+        return used;
+    }
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+inline thread_local fs::SPIFFSFS SPIFFS;
+
+#endif // INCLUDE_GUARD_NATIVE_SPIFFS
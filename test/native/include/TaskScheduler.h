@@ -0,0 +1,151 @@
+#ifndef INCLUDE_GUARD_NATIVE_TASK_SCHEDULER
+#define INCLUDE_GUARD_NATIVE_TASK_SCHEDULER
+
+/**
+ * native 環境用の TaskScheduler 代替
+ * painlessMesh が使う協調型スケジューラの、ファームウェアで使っている機能のみ実装する
+ * 実行回数・遅延・最終回の判定は TaskScheduler と同じ規則に従う
+ * (実行回数を使い切ったタスクは次の execute で無効になる、delay(0) は周期だけ遅らせる など)
+ */
+
+#include "Arduino.h"
+#include <functional>
+#include <list>
+
+#define TASK_IMMEDIATE 0
+#define TASK_FOREVER (-1)
+#define TASK_ONCE 1
+#define TASK_MILLISECOND 1UL
+#define TASK_SECOND 1000UL
+#define TASK_MINUTE 60000UL
+
+typedef std::function<void()> TaskCallback;
+
+class Scheduler;
+
+class Task {
+  private:
+    friend class Scheduler;
+
+    Scheduler *_scheduler = NULL;
+    bool _isEnabled = false;
+    unsigned long _interval = 0;
+    unsigned long _delay = 0;        // 前回実行から次回実行までの時間[msec]
+    unsigned long _previousMillis = 0;
+    long _iterations = 0;            // 残り実行回数(TASK_FOREVER なら無制限)
+    long _setIterations = 0;
+    unsigned long _runCounter = 0;
+    TaskCallback _callback;
+
+  public:
+    void set(unsigned long interval, long iterations, TaskCallback callback) {
+        _interval = interval;
+        _delay = interval;
+        _iterations = _setIterations = iterations;
+        _callback = callback;
+    }
+    void setInterval(unsigned long interval) {
+        _interval = interval;
+        delay();
+    }
+    unsigned long getInterval() { return _interval; }
+    void setIterations(long iterations) { _iterations = _setIterations = iterations; }
+    long getIterations() { return _iterations; }
+    unsigned long getRunCounter() { return _runCounter; }
+    bool enable() {
+        if (_scheduler == NULL) {
+            return false;
+        }
+        _isEnabled = true;
+        _runCounter = 0;
+        _delay = _interval;
+        _previousMillis = millis() - _interval;
+        return true;
+    }
+    bool enableDelayed(unsigned long delayMsec = 0) {
+        enable();
+        delay(delayMsec);
+        return _isEnabled;
+    }
+    bool restart() {
+        _iterations = _setIterations;
+        return enable();
+    }
+    bool disable() {
+        bool wasEnabled = _isEnabled;
+        _isEnabled = false;
+        return wasEnabled;
+    }
+    void delay(unsigned long delayMsec = 0) {
+        _delay = delayMsec != 0 ? delayMsec : _interval;
+        _previousMillis = millis();
+    }
+    bool isEnabled() { return _isEnabled; }
+    bool isFirstIteration() { return _runCounter <= 1; }
+    bool isLastIteration() { return _iterations == 0; }
+};
+
+class Scheduler {
+  private:
+    std::list<Task *> _tasks;
+
+  public:
+    void addTask(Task &task) {
+        task._scheduler = this;
+        _tasks.push_back(&task);
+    }
+    void deleteTask(Task &task) {
+        task._scheduler = NULL;
+        _tasks.remove(&task);
+    }
+    /**
+     * 実行時刻になったタスクを登録順に 1 回ずつ実行する
+     * 1 つも実行しなかった場合に true を返す
+     */
+    bool execute() {
+        bool isIdle = true;
+        for (Task *task : _tasks) {
+            if (!task->_isEnabled) {
+                continue;
+            }
+            if (task->_iterations == 0) {
+                task->disable();
+                continue;
+            }
+            if (millis() - task->_previousMillis < task->_delay) {
+                continue;
+            }
+            if (task->_iterations > 0) {
+                --task->_iterations;
+            }
+            ++task->_runCounter;
+            task->_previousMillis += task->_delay;
+            task->_delay = task->_interval;
+            isIdle = false;
+            if (task->_callback) {
+                task->_callback();
+            }
+        }
+        return isIdle;
+    }
+    /**
+     * 次回実行までの時間[msec](実行中のタスクが無ければ -1)
+     * 実行回数を使い切ったタスクは無効にするため次の execute を待たせない
+     */
+    long timeUntilNextIteration() {
+        long next = -1;
+        for (Task *task : _tasks) {
+            if (!task->_isEnabled) {
+                continue;
+            }
+            unsigned long elapsed = millis() - task->_previousMillis;
+            long remain = task->_iterations == 0 || elapsed >= task->_delay
+                              ? 0
+                              : (long)(task->_delay - elapsed);
+            next = next < 0 ? remain : min(next, remain);
+        }
+        return next;
+    }
+};
+
+#endif // INCLUDE_GUARD_NATIVE_TASK_SCHEDULER
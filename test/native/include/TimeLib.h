@@ -0,0 +1,97 @@
+#ifndef INCLUDE_GUARD_NATIVE_TIMELIB
+#define INCLUDE_GUARD_NATIVE_TIMELIB
+
+/**
+ * native 環境用の TimeLib 代替
+ * setTime した時刻から millis() の経過分だけ進む UTC の時計
+ * VirtualMesh のノード毎に別の時計になるようスレッド毎に持つ
+ */
+
+#include "Arduino.h"
+#include <ctime>
+
+#define SECS_PER_MIN ((time_t)(60UL))
+#define SECS_PER_HOUR ((time_t)(3600UL))
+#define SECS_PER_DAY ((time_t)(SECS_PER_HOUR * 24UL))
+#define previousMidnight(_time_) (((_time_) / SECS_PER_DAY) * SECS_PER_DAY)
+#define nextMidnight(_time_) (previousMidnight(_time_) + SECS_PER_DAY)
+#define elapsedSecsToday(_time_) ((_time_) % SECS_PER_DAY)
+#define numberOfHours(_secs_) (((_secs_) % SECS_PER_DAY) / SECS_PER_HOUR)
+#define numberOfMinutes(_secs_) (((_secs_) / SECS_PER_MIN) % SECS_PER_MIN)
+
+typedef enum { timeNotSet, timeNeedsSync, timeSet } timeStatus_t;
+
+namespace native {
+struct HostClock {
+    time_t sysTime = 0;
+    unsigned long setMillis = 0;
+    timeStatus_t status = timeNotSet;
+};
+inline HostClock &hostClock() {
+    thread_local HostClock clock;
+    return clock;
+}
+inline struct tm breakTime(time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return tm;
+}
+} // namespace native
+
+// TimeLib と同じく Year は 1970 年からの年数
+typedef struct {
+    uint8_t Second;
+    uint8_t Minute;
+    uint8_t Hour;
+    uint8_t Wday; // 日曜が 1
+    uint8_t Day;
+    uint8_t Month;
+    uint8_t Year;
+} tmElements_t;
+
+inline void breakTime(time_t t, tmElements_t &tm) {
+    struct tm parts = native::breakTime(t);
+    tm.Second = parts.tm_sec;
+    tm.Minute = parts.tm_min;
+    tm.Hour = parts.tm_hour;
+    tm.Wday = parts.tm_wday + 1;
+    tm.Day = parts.tm_mday;
+    tm.Month = parts.tm_mon + 1;
+    tm.Year = parts.tm_year - 70;
+}
+inline time_t makeTime(const tmElements_t &tm) {
+    struct tm parts = {};
+    parts.tm_sec = tm.Second;
+    parts.tm_min = tm.Minute;
+    parts.tm_hour = tm.Hour;
+    parts.tm_mday = tm.Day;
+    parts.tm_mon = tm.Month - 1;
+    parts.tm_year = tm.Year + 70;
+    return timegm(&parts);
+}
+
+inline void setTime(time_t t) {
+    native::hostClock().sysTime = t;
+    native::hostClock().setMillis = millis();
+    native::hostClock().status = timeSet;
+}
+inline timeStatus_t timeStatus() { return native::hostClock().status; }
+inline time_t now() {
+    return native::hostClock().sysTime + (millis() - native::hostClock().setMillis) / 1000;
+}
+inline int hour(time_t t) { return native::breakTime(t).tm_hour; }
+inline int minute(time_t t) { return native::breakTime(t).tm_min; }
+inline int second(time_t t) { return native::breakTime(t).tm_sec; }
+inline int day(time_t t) { return native::breakTime(t).tm_mday; }
+inline int weekday(time_t t) { return native::breakTime(t).tm_wday + 1; }
+inline int month(time_t t) { return native::breakTime(t).tm_mon + 1; }
+inline int year(time_t t) { return native::breakTime(t).tm_year + 1900; }
+inline int hour() { return hour(now()); }
+inline int minute() { return minute(now()); }
+inline int second() { return second(now()); }
+inline int day() { return day(now()); }
+inline int weekday() { return weekday(now()); }
+inline int month() { return month(now()); }
+inline int year() { return year(now()); }
+
+#endif // INCLUDE_GUARD_NATIVE_TIMELIB
@@ -0,0 +1,168 @@
+#ifndef INCLUDE_GUARD_NATIVE_WSTRING
+#define INCLUDE_GUARD_NATIVE_WSTRING
+
+/**
+ * native 環境用の Arduino String 代替
+ * std::string を包み、ファームウェアで使っているメンバ関数のみ実装する
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+class String {
+  private:
+    std::string _str;
+
+    static std::string toBase(unsigned long value, unsigned char base) {
+        if (base == 10) {
+            return std::to_string(value);
+        }
+        std::string str;
+        do {
+            unsigned long digit = value % base;
+            str.insert(str.begin(), digit < 10 ? '0' + digit : 'a' + digit - 10);
+            value /= base;
+        } while (value > 0);
+        return str;
+    }
+
+  public:
+    String(const char *cstr = "") : _str(cstr == NULL ? "" : cstr) {}
+    String(const std::string &str) : _str(str) {}
+    explicit String(char c) : _str(1, c) {}
+    explicit String(unsigned char value, unsigned char base = 10) : _str(toBase(value, base)) {}
+    explicit String(int value, unsigned char base = 10)
+        : _str(base == 10 || value >= 0 ? std::to_string(value) : toBase(value, base)) {}
+    explicit String(unsigned int value, unsigned char base = 10) : _str(toBase(value, base)) {}
+    explicit String(long value, unsigned char base = 10)
+        : _str(base == 10 || value >= 0 ? std::to_string(value) : toBase(value, base)) {}
+    explicit String(unsigned long value, unsigned char base = 10) : _str(toBase(value, base)) {}
+    explicit String(double value, unsigned char decimalPlaces = 2) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+        _str = buf;
+    }
+
+    const char *c_str() const { return _str.c_str(); }
+    unsigned int length() const { return _str.length(); }
+    bool reserve(unsigned int size) {
+        _str.reserve(size);
+        return true;
+    }
+    char charAt(unsigned int index) const { return index < _str.length() ? _str[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char &operator[](unsigned int index) { return _str[index]; }
+
+    bool concat(const String &str) {
+        _str += str._str;
+        return true;
+    }
+    bool concat(const char *cstr) {
+        _str += cstr;
+        return true;
+    }
+    bool concat(char c) {
+        _str += c;
+        return true;
+    }
+    template <typename T> bool concat(T value) { return concat(String(value)); }
+    template <typename T> String &operator+=(const T &value) {
+        concat(value);
+        return *this;
+    }
+
+    bool equals(const String &str) const { return _str == str._str; }
+    bool equals(const char *cstr) const { return _str == cstr; }
+    bool operator==(const String &str) const { return equals(str); }
+    bool operator==(const char *cstr) const { return equals(cstr); }
+    bool operator!=(const String &str) const { return !equals(str); }
+    bool operator!=(const char *cstr) const { return !equals(cstr); }
+    bool operator<(const String &str) const { return _str < str._str; }
+    int compareTo(const String &str) const { return _str.compare(str._str); }
+    bool startsWith(const String &prefix) const { return _str.rfind(prefix._str, 0) == 0; }
+    bool endsWith(const String &suffix) const {
+        return _str.length() >= suffix._str.length() &&
+               _str.compare(_str.length() - suffix._str.length(), suffix._str.length(),
+                            suffix._str) == 0;
+    }
+
+    int indexOf(char c, unsigned int from = 0) const {
+        size_t pos = _str.find(c, from);
+        return pos == std::string::npos ? -1 : pos;
+    }
+    int indexOf(const String &str, unsigned int from = 0) const {
+        size_t pos = _str.find(str._str, from);
+        return pos == std::string::npos ? -1 : pos;
+    }
+    int lastIndexOf(char c) const {
+        size_t pos = _str.rfind(c);
+        return pos == std::string::npos ? -1 : pos;
+    }
+    String substring(unsigned int from) const {
+        return from < _str.length() ? String(_str.substr(from)) : String();
+    }
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) {
+            std::swap(from, to);
+        }
+        return from < _str.length() ? String(_str.substr(from, to - from)) : String();
+    }
+    void remove(unsigned int index) { _str.erase(std::min<size_t>(index, _str.length())); }
+    void remove(unsigned int index, unsigned int count) {
+        if (index < _str.length()) {
+            _str.erase(index, count);
+        }
+    }
+    void replace(const String &find, const String &replace) {
+        if (find._str.empty()) {
+            return;
+        }
+        for (size_t pos = 0; (pos = _str.find(find._str, pos)) != std::string::npos;
+             pos += replace._str.length()) {
+            _str.replace(pos, find._str.length(), replace._str);
+        }
+    }
+    void trim() {
+        size_t begin = _str.find_first_not_of(" \t\r\n");
+        size_t end = _str.find_last_not_of(" \t\r\n");
+        _str = begin == std::string::npos ? "" : _str.substr(begin, end - begin + 1);
+    }
+    void toLowerCase() {
+        for (char &c : _str) {
+            c = tolower(c);
+        }
+    }
+    void toUpperCase() {
+        for (char &c : _str) {
+            c = toupper(c);
+        }
+    }
+    long toInt() const { return strtol(_str.c_str(), NULL, 10); }
+    float toFloat() const { return strtof(_str.c_str(), NULL); }
+    void toCharArray(char *buf, unsigned int bufsize, unsigned int index = 0) const {
+        getBytes((unsigned char *)buf, bufsize, index);
+    }
+    void getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index = 0) const {
+        if (bufsize == 0) {
+            return;
+        }
+        size_t len = index < _str.length() ? std::min<size_t>(bufsize - 1, _str.length() - index)
+                                           : 0;
+        memcpy(buf, _str.c_str() + std::min<size_t>(index, _str.length()), len);
+        buf[len] = '\0';
+    }
+};
+
+inline String operator+(const String &lhs, const String &rhs) {
+    String str = lhs;
+    str.concat(rhs);
+    return str;
+}
+inline String operator+(const String &lhs, const char *rhs) { return lhs + String(rhs); }
+inline String operator+(const char *lhs, const String &rhs) { return String(lhs) + rhs; }
+template <typename T> inline String operator+(const String &lhs, T rhs) {
+    return lhs + String(rhs);
+}
+
+#endif // INCLUDE_GUARD_NATIVE_WSTRING
@@ -0,0 +1,25 @@
+#ifndef INCLUDE_GUARD_NATIVE_WIFI
+#define INCLUDE_GUARD_NATIVE_WIFI
+
+/**
+ * native 環境用の WiFi 代替
+ * 通信は painlessMesh 代替が VirtualMesh で行うので、モード設定のみ受け付ける
+ */
+
+typedef enum { WIFI_OFF = 0, WIFI_STA, WIFI_AP, WIFI_AP_STA } wifi_mode_t;
+
+class WiFiClass {
+  private:
+    wifi_mode_t _mode = WIFI_OFF;
+
+  public:
+    bool mode(wifi_mode_t mode) {
+        _mode = mode;
+        return true;
+    }
+    wifi_mode_t getMode() { return _mode; }
+};
+
+inline thread_local WiFiClass WiFi;
+
+#endif // INCLUDE_GUARD_NATIVE_WIFI
@@ -0,0 +1,16 @@
+#ifndef INCLUDE_GUARD_NATIVE_ESP_HEAP_CAPS
+#define INCLUDE_GUARD_NATIVE_ESP_HEAP_CAPS
+
+/**
+ * native 環境用の ESP-IDF ヒープ情報代替
+ * ホストのヒープは断片化の目安にならないので、ESP.getFreeHeap() と同じく固定値を返す
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+
+inline size_t heap_caps_get_largest_free_block(uint32_t) { return 110000; }
+
+#endif // INCLUDE_GUARD_NATIVE_ESP_HEAP_CAPS
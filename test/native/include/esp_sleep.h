@@ -0,0 +1,57 @@
+#ifndef INCLUDE_GUARD_NATIVE_ESP_SLEEP
+#define INCLUDE_GUARD_NATIVE_ESP_SLEEP
+
+/**
+ * native 環境用の ESP-IDF DeepSleep 代替
+ * esp_deep_sleep_start は戻らない代わりに native::DeepSleep を投げるので、
+ * 呼び出したスレッド(VirtualMesh のノード)の先頭で捕捉してノードを止める
+ */
+
+#include <cstdint>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+
+typedef enum {
+    GPIO_NUM_0 = 0,
+    GPIO_NUM_2 = 2,
+    GPIO_NUM_13 = 13,
+    GPIO_NUM_14 = 14,
+} gpio_num_t;
+
+typedef enum {
+    ESP_SLEEP_WAKEUP_UNDEFINED = 0,
+    ESP_SLEEP_WAKEUP_ALL,
+    ESP_SLEEP_WAKEUP_EXT0,
+    ESP_SLEEP_WAKEUP_EXT1,
+    ESP_SLEEP_WAKEUP_TIMER,
+} esp_sleep_wakeup_cause_t;
+
+namespace native {
+/**
+ * DeepSleep 開始
+ * timerWakeup はタイマー起動までの時間[usec](0 ならタイマーでは起動しない)
+ */
+struct DeepSleep {
+    uint64_t timerWakeup;
+};
+// スレッド毎の起動要因と次回のタイマー起動時間
+inline esp_sleep_wakeup_cause_t &wakeupCause() {
+    thread_local esp_sleep_wakeup_cause_t cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+    return cause;
+}
+inline uint64_t &timerWakeup() {
+    thread_local uint64_t time_us = 0;
+    return time_us;
+}
+} // namespace native
+
+inline esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_us) {
+    native::timerWakeup() = time_us;
+    return ESP_OK;
+}
+inline esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t, int) { return ESP_OK; }
+inline esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() { return native::wakeupCause(); }
+[[noreturn]] inline void esp_deep_sleep_start() { throw native::DeepSleep{native::timerWakeup()}; }
+
+#endif // INCLUDE_GUARD_NATIVE_ESP_SLEEP
@@ -0,0 +1,136 @@
+#ifndef INCLUDE_GUARD_NATIVE_FREERTOS
+#define INCLUDE_GUARD_NATIVE_FREERTOS
+
+/**
+ * native 環境用の FreeRTOS 代替
+ * タスクは std::thread、タスク通知とミューテックスは std::mutex / condition_variable で実装する
+ * コア指定と優先度は無視し、1 tick = 1msec とする
+ * 仮想時刻の時計が設定されたスレッド(VirtualMesh のノード)では vTaskDelay も仮想時刻で待つ
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffUL
+#define portTICK_PERIOD_MS 1
+#define portTICK_RATE_MS portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portYIELD_FROM_ISR()
+#define IRAM_ATTR
+// RTC メモリの変数とシングルトンは VirtualMesh のノード(スレッド)毎に持つ
+#define RTC_DATA_ATTR thread_local
+#define SINGLETON_STORAGE thread_local
+
+typedef enum { eRunning = 0, eReady, eBlocked, eSuspended, eDeleted } eTaskState;
+
+/**
+ * タスク
+ * 通知値のみ持つ
+ */
+struct NativeTask {
+    std::mutex mutex;
+    std::condition_variable cond;
+    uint32_t notifyValue = 0;
+};
+typedef NativeTask *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+namespace native {
+/**
+ * 仮想時刻の時計
+ * スレッド毎に設定し、設定されたスレッドでは時刻取得と待ち(delay, vTaskDelay)がこの時計を使う
+ */
+class VirtualClock {
+  public:
+    virtual ~VirtualClock() {}
+    virtual uint64_t micros() = 0;
+    virtual void delay(uint64_t usec) = 0;
+};
+inline VirtualClock *&virtualClock() {
+    thread_local VirtualClock *clock = NULL;
+    return clock;
+}
+
+inline std::chrono::steady_clock::time_point deadline(TickType_t ticks) {
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(ticks);
+}
+inline TaskHandle_t &currentTask() {
+    thread_local TaskHandle_t task = NULL;
+    return task;
+}
+} // namespace native
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+    TaskHandle_t &task = native::currentTask();
+    if (task == NULL) {
+        // メインスレッドなど、xTaskCreate 以外で作られたスレッド
+        task = new NativeTask();
+    }
+    return task;
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *, uint32_t,
+                                          void *arg, UBaseType_t, TaskHandle_t *handle,
+                                          BaseType_t) {
+    TaskHandle_t task = new NativeTask();
+    if (handle != NULL) {
+        *handle = task;
+    }
+    std::thread([function, arg, task]() {
+        native::currentTask() = task;
+        function(arg);
+    }).detach();
+    return pdPASS;
+}
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack, void *arg,
+                              UBaseType_t priority, TaskHandle_t *handle) {
+    return xTaskCreatePinnedToCore(function, name, stack, arg, priority, handle, 0);
+}
+// スレッドは関数から戻った時点で終了するので何もしない
+inline void vTaskDelete(TaskHandle_t) {}
+inline void vTaskDelay(TickType_t ticks) {
+    if (native::virtualClock() != NULL) {
+        native::virtualClock()->delay(ticks * 1000ULL);
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->mutex);
+    auto isNotified = [task]() { return task->notifyValue > 0; };
+    if (ticks == portMAX_DELAY) {
+        task->cond.wait(lock, isNotified);
+    } else if (!task->cond.wait_until(lock, native::deadline(ticks), isNotified)) {
+        return 0;
+    }
+    uint32_t value = task->notifyValue;
+    task->notifyValue = clearOnExit ? 0 : value - 1;
+    return value;
+}
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> lock(task->mutex);
+    ++task->notifyValue;
+    task->cond.notify_all();
+    return pdPASS;
+}
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken) {
+    xTaskNotifyGive(task);
+    if (higherPriorityTaskWoken != NULL) {
+        *higherPriorityTaskWoken = pdFALSE;
+    }
+}
+
+#endif // INCLUDE_GUARD_NATIVE_FREERTOS
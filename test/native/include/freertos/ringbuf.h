@@ -0,0 +1,83 @@
+#ifndef INCLUDE_GUARD_NATIVE_RINGBUF
+#define INCLUDE_GUARD_NATIVE_RINGBUF
+
+/**
+ * native 環境用の ESP-IDF リングバッファ代替(RINGBUF_TYPE_NOSPLIT のみ)
+ * 受け取った項目は vRingbufferReturnItem で返すまで容量に含める
+ */
+
+#include "FreeRTOS.h"
+#include <deque>
+#include <list>
+#include <vector>
+
+typedef enum { RINGBUF_TYPE_NOSPLIT = 0 } RingbufferType_t;
+
+struct NativeRingbuf {
+    // ESP-IDF と同じく 1 項目あたり 8byte のヘッダ分を消費する
+    static const size_t HEADER_SIZE = 8;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t capacity;
+    size_t used = 0;
+    std::deque<std::vector<uint8_t>> items;
+    std::list<std::vector<uint8_t>> received;
+
+    explicit NativeRingbuf(size_t size) : capacity(size) {}
+    static size_t itemSize(size_t size) { return (size + 3) / 4 * 4 + HEADER_SIZE; }
+};
+typedef NativeRingbuf *RingbufHandle_t;
+
+inline RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t) {
+    return new NativeRingbuf(size);
+}
+inline void vRingbufferDelete(RingbufHandle_t ringbuf) { delete ringbuf; }
+
+inline BaseType_t xRingbufferSend(RingbufHandle_t ringbuf, const void *data, size_t size,
+                                  TickType_t ticks) {
+    size_t needed = NativeRingbuf::itemSize(size);
+    if (needed > ringbuf->capacity) {
+        return pdFALSE;
+    }
+    std::unique_lock<std::mutex> lock(ringbuf->mutex);
+    auto hasSpace = [ringbuf, needed]() { return ringbuf->used + needed <= ringbuf->capacity; };
+    if (ticks == portMAX_DELAY) {
+        ringbuf->cond.wait(lock, hasSpace);
+    } else if (!ringbuf->cond.wait_until(lock, native::deadline(ticks), hasSpace)) {
+        return pdFALSE;
+    }
+    const uint8_t *bytes = (const uint8_t *)data;
+    ringbuf->items.emplace_back(bytes, bytes + size);
+    ringbuf->used += needed;
+    ringbuf->cond.notify_all();
+    return pdTRUE;
+}
+
+inline void *xRingbufferReceive(RingbufHandle_t ringbuf, size_t *size, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(ringbuf->mutex);
+    auto hasItem = [ringbuf]() { return !ringbuf->items.empty(); };
+    if (ticks == portMAX_DELAY) {
+        ringbuf->cond.wait(lock, hasItem);
+    } else if (!ringbuf->cond.wait_until(lock, native::deadline(ticks), hasItem)) {
+        return NULL;
+    }
+    ringbuf->received.push_back(std::move(ringbuf->items.front()));
+    ringbuf->items.pop_front();
+    *size = ringbuf->received.back().size();
+    return ringbuf->received.back().data();
+}
+
+inline void vRingbufferReturnItem(RingbufHandle_t ringbuf, void *item) {
+    std::lock_guard<std::mutex> lock(ringbuf->mutex);
+    for (auto it = ringbuf->received.begin(); it != ringbuf->received.end(); ++it) {
+        if (it->data() == item) {
+            ringbuf->used -= NativeRingbuf::itemSize(it->size());
+            ringbuf->received.erase(it);
+            ringbuf->cond.notify_all();
+            return;
+        }
+    }
+}
+
+#endif // INCLUDE_GUARD_NATIVE_RINGBUF
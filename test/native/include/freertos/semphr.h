@@ -0,0 +1,45 @@
+#ifndef INCLUDE_GUARD_NATIVE_SEMPHR
+#define INCLUDE_GUARD_NATIVE_SEMPHR
+
+/**
+ * native 環境用の FreeRTOS セマフォ代替
+ * ミューテックス(再帰不可)とバイナリセマフォを同じカウンタで表す
+ * バイナリセマフォは取得したタスク以外からも返せるので std::mutex は使わない
+ */
+
+#include "FreeRTOS.h"
+
+struct NativeSemaphore {
+    std::mutex mutex;
+    std::condition_variable cond;
+    uint32_t count;
+    explicit NativeSemaphore(uint32_t initial) : count(initial) {}
+};
+typedef NativeSemaphore *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new NativeSemaphore(1); }
+inline SemaphoreHandle_t xSemaphoreCreateBinary() { return new NativeSemaphore(0); }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(sem->mutex);
+    auto isAvailable = [sem]() { return sem->count > 0; };
+    if (ticks == portMAX_DELAY) {
+        sem->cond.wait(lock, isAvailable);
+    } else if (!sem->cond.wait_until(lock, native::deadline(ticks), isAvailable)) {
+        return pdFALSE;
+    }
+    --sem->count;
+    return pdTRUE;
+}
+// 既に返されている場合は FreeRTOS と同じく失敗する
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    std::lock_guard<std::mutex> lock(sem->mutex);
+    if (sem->count > 0) {
+        return pdFALSE;
+    }
+    sem->count = 1;
+    sem->cond.notify_one();
+    return pdTRUE;
+}
+inline void vSemaphoreDelete(SemaphoreHandle_t sem) { delete sem; }
+
+#endif // INCLUDE_GUARD_NATIVE_SEMPHR
@@ -0,0 +1,125 @@
+#ifndef INCLUDE_GUARD_NATIVE_PAINLESS_MESH
+#define INCLUDE_GUARD_NATIVE_PAINLESS_MESH
+
+/**
+ * native 環境用の painlessMesh 代替
+ * WiFi の代わりに、呼び出したスレッドの VirtualMesh のノードとして送受信する
+ * 受信・接続のコールバックは painlessMesh と同じく update の中から呼ぶ
+ * メッシュ時刻は VirtualMesh の仮想時刻で全ノードで一致しているので、時刻補正は起きない
+ */
+
+#include "Arduino.h"
+#include "TaskScheduler.h"
+#include "WiFi.h"
+#include "../virtualMesh.h"
+#include <list>
+
+template <class T> using SimpleList = std::list<T>;
+
+typedef std::function<void(uint32_t from, String &msg)> receivedCallback_t;
+typedef std::function<void(uint32_t nodeId)> newConnectionCallback_t;
+typedef std::function<void()> changedConnectionsCallback_t;
+typedef std::function<void(int32_t offset)> nodeTimeAdjustedCallback_t;
+
+// デバッグ出力の種類(出力はしない)
+enum debugType {
+    ERROR = 1 << 0,
+    STARTUP = 1 << 1,
+    MESH_STATUS = 1 << 2,
+    CONNECTION = 1 << 3,
+    SYNC = 1 << 4,
+    COMMUNICATION = 1 << 5,
+    GENERAL = 1 << 6,
+    MSG_TYPES = 1 << 7,
+    REMOTE = 1 << 8,
+};
+
+class painlessMesh {
+  private:
+    VirtualNode *_node = NULL;
+    receivedCallback_t _receivedCallback;
+    newConnectionCallback_t _newConnectionCallback;
+    changedConnectionsCallback_t _changedConnectionsCallback;
+    nodeTimeAdjustedCallback_t _nodeTimeAdjustedCallback;
+
+  public:
+    Scheduler scheduler;
+
+    void setDebugMsgTypes(uint16_t) {}
+    void init(String, String, uint16_t = 5555) {
+        _node = VirtualNode::current();
+        if (_node == NULL) {
+            return;
+        }
+        VirtualMeshCallbacks callbacks;
+        callbacks.received = [this](uint32_t from, String &msg) {
+            if (_receivedCallback) {
+                _receivedCallback(from, msg);
+            }
+        };
+        callbacks.newConnection = [this](uint32_t nodeId) {
+            if (_newConnectionCallback) {
+                _newConnectionCallback(nodeId);
+            }
+        };
+        callbacks.changedConnections = [this]() {
+            if (_changedConnectionsCallback) {
+                _changedConnectionsCallback();
+            }
+        };
+        _node->join(callbacks);
+    }
+    void stop() {
+        if (_node != NULL) {
+            _node->leave();
+        }
+    }
+    /**
+     * 受信・接続通知を処理してからタスクを実行する
+     * VirtualMesh には次にタスクを実行する時刻まで休めることを伝える
+     */
+    void update() {
+        if (_node != NULL) {
+            _node->processInbox();
+        }
+        bool isIdle = scheduler.execute();
+        long next = scheduler.timeUntilNextIteration();
+        if (_node != NULL && (!isIdle || next >= 0)) {
+            _node->wakeWithin(isIdle ? next : 0);
+        }
+    }
+    void onReceive(receivedCallback_t callback) { _receivedCallback = callback; }
+    void onNewConnection(newConnectionCallback_t callback) { _newConnectionCallback = callback; }
+    void onChangedConnections(changedConnectionsCallback_t callback) {
+        _changedConnectionsCallback = callback;
+    }
+    void onNodeTimeAdjusted(nodeTimeAdjustedCallback_t callback) {
+        _nodeTimeAdjustedCallback = callback;
+    }
+
+    uint32_t getNodeId() { return _node != NULL ? _node->getNodeId() : 0; }
+    uint32_t getNodeTime() { return micros(); }
+    SimpleList<uint32_t> getNodeList() {
+        return _node != NULL ? _node->getNodeList() : SimpleList<uint32_t>();
+    }
+    bool isConnected(uint32_t nodeId) {
+        SimpleList<uint32_t> nodeList = getNodeList();
+        return std::find(nodeList.begin(), nodeList.end(), nodeId) != nodeList.end();
+    }
+    String subConnectionJson() { return _node != NULL ? _node->subConnectionJson() : "[]"; }
+    bool sendSingle(uint32_t &destId, String &msg) {
+        return _node != NULL && _node->sendSingle(destId, msg);
+    }
+    bool sendBroadcast(String &msg, bool includeSelf = false) {
+        if (_node == NULL) {
+            return false;
+        }
+        bool success = _node->sendBroadcast(msg);
+        if (success && includeSelf && _receivedCallback) {
+            _receivedCallback(getNodeId(), msg);
+        }
+        return success;
+    }
+};
+
+#endif // INCLUDE_GUARD_NATIVE_PAINLESS_MESH
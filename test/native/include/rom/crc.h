@@ -0,0 +1,22 @@
+#ifndef INCLUDE_GUARD_NATIVE_ROM_CRC
+#define INCLUDE_GUARD_NATIVE_ROM_CRC
+
+/**
+ * native 環境用の ESP32 ROM CRC 代替
+ * ROM の crc32_le と同じく、初期値と結果を反転する CRC-32(IEEE 802.3)
+ */
+
+#include <cstdint>
+
+inline uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+    while (len-- > 0) {
+        crc ^= *buf++;
+        for (uint8_t bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+#endif // INCLUDE_GUARD_NATIVE_ROM_CRC
@@ -0,0 +1,447 @@
+#ifndef INCLUDE_GUARD_OV528_SIM
+#define INCLUDE_GUARD_OV528_SIM
+
+/**
+ * OV528 シミュレータ
+ * CameraPort として Camera に差し込み、実機の代わりに OV528 の応答を返す
+ * SYNC, INITIAL, SET_PACKAGE_SIZE, SET_BAUD, SNAPSHOT, GET_PICTURE と
+ * パケット要求(ACK)に応答し、JPEG 画像をチェックサム付きパケットで送る
+ * 送受信はボーレートから求めた時刻に届くので、撮影時間をホスト上で計測できる
+ */
+
+#include "cameraPort.h"
+#include <deque>
+#include <map>
+#include <random>
+#include <vector>
+
+// OV528 のコマンド ID
+#define OV528_CMD_INITIAL 0x01
+#define OV528_CMD_GET_PICTURE 0x04
+#define OV528_CMD_SNAPSHOT 0x05
+#define OV528_CMD_SET_PACKAGE_SIZE 0x06
+#define OV528_CMD_SET_BAUD 0x07
+#define OV528_CMD_DATA 0x0a
+#define OV528_CMD_SYNC 0x0d
+#define OV528_CMD_ACK 0x0e
+#define OV528_CMD_NAK 0x0f
+#define OV528_PACKAGE_END 0xf0f0
+#define OV528_DEF_PACKAGE_SIZE 64
+#define OV528_CLOCK 14745600 // SET_BAUD の基準クロック[Hz]
+
+/**
+ * シミュレータ設定
+ */
+struct Ov528SimConfig {
+    uint32_t bootBaud = 115200;            // 起動時のボーレート
+    uint32_t baudLimit = 921600;           // 通信できる最高ボーレート(超える SET_BAUD は NAK)
+    unsigned long cmdLatency = 200;        // コマンド受信から応答までの時間[usec]
+    unsigned long snapshotLatency = 50000; // SNAPSHOT から画像取得可能までの時間[usec]
+    double bitErrorRate = 0;               // カメラ → ホスト方向のビット誤り率
+    uint8_t syncIgnoreNum = 0;             // 起動直後に応答しない SYNC の数
+    uint8_t baudSyncIgnoreNum = 0;         // ボーレート切り替え直後に応答しない SYNC の数
+    unsigned int seed = 1;                 // ビット誤りの乱数シード
+};
+
+/**
+ * シミュレータ統計
+ */
+struct Ov528SimStats {
+    uint32_t commands = 0;
+    uint32_t naks = 0;
+    uint32_t packets = 0;
+    uint32_t bitErrors = 0;
+    uint32_t droppedBytes = 0; // ボーレート不一致で読めなかったバイト数
+};
+
+class Ov528SimPort : public CameraPort {
+  private:
+    // 受信待ちのバイト
+    struct LineByte {
+        uint64_t readyTime; // ホストに届く時刻[usec]
+        uint32_t baud;      // 送信時のボーレート
+        uint8_t data;
+    };
+
+    Ov528SimConfig _config;
+    Ov528SimStats _stats;
+    std::mt19937 _rng;
+    std::uniform_real_distribution<double> _uniform{0.0, 1.0};
+
+    uint32_t _hostBaud = 0;
+    uint32_t _cameraBaud = 0;
+    uint32_t _nextCameraBaud = 0;  // SET_BAUD の ACK 送信後に切り替えるボーレート
+    uint64_t _baudChangeTime = 0;  // [usec]
+    uint64_t _hostLineFree = 0;    // ホストの送信完了時刻[usec]
+    uint64_t _cameraLineFree = 0;  // カメラの送信完了時刻[usec]
+    std::deque<LineByte> _rx;
+    std::vector<uint8_t> _cmd;
+    uint8_t _syncIgnoreNum = 0; // これから応答しない SYNC の数
+    uint8_t _ackCounter = 0;
+
+    uint8_t _resolution = 0;
+    uint16_t _packetSize = OV528_DEF_PACKAGE_SIZE;
+    std::map<uint8_t, std::vector<uint8_t>> _images;
+    std::vector<uint8_t> _picture;
+    uint64_t _pictureReadyTime = 0; // [usec]
+    bool _hasPicture = false;
+
+  public:
+    explicit Ov528SimPort(const Ov528SimConfig &config = Ov528SimConfig())
+        : _config(config), _rng(config.seed), _cameraBaud(config.bootBaud),
+          _syncIgnoreNum(config.syncIgnoreNum) {
+        setImage(1, makeJpeg(80, 60, 1600));
+        setImage(3, makeJpeg(160, 120, 4200));
+        setImage(5, makeJpeg(320, 240, 12800));
+        setImage(7, makeJpeg(640, 480, 43000));
+    }
+
+    /**
+     * 解像度毎の画像を設定(実機で撮影した JPEG などに差し替える)
+     */
+    void setImage(uint8_t resolution, const std::vector<uint8_t> &jpeg) {
+        _images[resolution] = jpeg;
+    }
+    const std::vector<uint8_t> &getImage(uint8_t resolution) { return _images[resolution]; }
+    void setBitErrorRate(double rate) { _config.bitErrorRate = rate; }
+    uint32_t getCameraBaud() { return _cameraBaud; }
+    const Ov528SimStats &getStats() { return _stats; }
+    void resetStats() { _stats = Ov528SimStats(); }
+
+    /*************************************
+     * CameraPort
+     ************************************/
+    void begin(uint32_t baud) {
+        _hostBaud = baud;
+        _rx.clear();
+        _cmd.clear();
+    }
+    void updateBaudRate(uint32_t baud) {
+        flush();
+        _hostBaud = baud;
+    }
+    int available() {
+        uint64_t now = micros();
+        int num = 0;
+        for (auto &lineByte : _rx) {
+            if (lineByte.readyTime > now) {
+                break;
+            }
+            ++num;
+        }
+        return num;
+    }
+    int read() {
+        if (_rx.empty() || _rx.front().readyTime > micros()) {
+            return -1;
+        }
+        return take();
+    }
+    size_t write(const uint8_t *buf, size_t len) {
+        uint64_t arrival = std::max<uint64_t>(micros(), _hostLineFree);
+        arrival += len * byteTime(_hostBaud);
+        _hostLineFree = arrival;
+        updateCameraBaud(arrival);
+        if (_hostBaud != _cameraBaud) {
+            // ボーレートが合わないとカメラは受信できない
+            _cmd.clear();
+            return len;
+        }
+        for (size_t i = 0; i < len; ++i) {
+            if (_cmd.empty() && buf[i] != 0xaa) {
+                continue;
+            }
+            _cmd.push_back(buf[i]);
+            if (_cmd.size() == 6) {
+                receiveCommand(_cmd.data(), arrival);
+                _cmd.clear();
+            }
+        }
+        return len;
+    }
+    /**
+     * Stream::readBytes と同じく、バイト間の待ち時間が timeout を超えるまで読み出す
+     */
+    size_t readBytes(uint8_t *buf, size_t len, unsigned long timeout) {
+        uint64_t timeoutUs = (uint64_t)timeout * 1000;
+        size_t readLen = 0;
+        while (readLen < len) {
+            // 待ち時間が timeout 以内で続けて届くバイトをまとめて待つ
+            uint64_t arrival = micros();
+            size_t num = 0;
+            for (; num < _rx.size() && readLen + num < len; ++num) {
+                if (_rx[num].readyTime > arrival + timeoutUs) {
+                    break;
+                }
+                arrival = std::max(arrival, _rx[num].readyTime);
+            }
+            if (num == 0) {
+                sleepUntil(micros() + timeoutUs);
+                break;
+            }
+            sleepUntil(arrival);
+            for (size_t i = 0; i < num; ++i) {
+                buf[readLen++] = take();
+            }
+        }
+        return readLen;
+    }
+    void flush() { sleepUntil(_hostLineFree); }
+
+    /**
+     * JPEG 生成
+     * 8x8 ブロック毎に明るさの異なるグレースケール画像(DC 成分のみ)を baseline JPEG で符号化し、
+     * OV528 の画像サイズに近づくよう COM セグメントで埋める
+     */
+    static std::vector<uint8_t> makeJpeg(uint16_t width, uint16_t height, size_t targetSize) {
+        // 輝度 DC の標準ハフマンテーブル
+        static const uint8_t DC_BITS[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+        std::vector<uint8_t> jpeg = {0xff, 0xd8};
+        auto addSegment = [&jpeg](uint8_t marker, const std::vector<uint8_t> &payload) {
+            jpeg.push_back(0xff);
+            jpeg.push_back(marker);
+            jpeg.push_back((payload.size() + 2) >> 8);
+            jpeg.push_back((payload.size() + 2) & 0xff);
+            jpeg.insert(jpeg.end(), payload.begin(), payload.end());
+        };
+        addSegment(0xe0, {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0});
+        std::vector<uint8_t> dqt(65, 16);
+        dqt[0] = 0x00;
+        addSegment(0xdb, dqt);
+        addSegment(0xc0, {8, (uint8_t)(height >> 8), (uint8_t)height, (uint8_t)(width >> 8),
+                          (uint8_t)width, 1, 1, 0x11, 0});
+        std::vector<uint8_t> dht = {0x00};
+        dht.insert(dht.end(), DC_BITS, DC_BITS + 16);
+        for (uint8_t i = 0; i < 12; ++i) {
+            dht.push_back(i);
+        }
+        // AC は EOB(0x00)のみで符号長 1
+        dht.push_back(0x10);
+        dht.push_back(1);
+        dht.insert(dht.end(), 15, 0);
+        dht.push_back(0x00);
+        addSegment(0xc4, dht);
+
+        // DC の符号(カテゴリ順に標準テーブルから求める)
+        uint16_t dcCode[12];
+        uint8_t dcLen[12];
+        uint16_t code = 0;
+        uint8_t category = 0;
+        for (uint8_t len = 1; len <= 16; ++len, code <<= 1) {
+            for (uint8_t i = 0; i < DC_BITS[len - 1]; ++i, ++code, ++category) {
+                dcCode[category] = code;
+                dcLen[category] = len;
+            }
+        }
+        std::vector<uint8_t> scan;
+        uint32_t bitBuf = 0;
+        uint8_t bitNum = 0;
+        auto putBits = [&](uint32_t bits, uint8_t len) {
+            for (int8_t i = len - 1; i >= 0; --i) {
+                bitBuf = (bitBuf << 1) | ((bits >> i) & 1);
+                if (++bitNum == 8) {
+                    scan.push_back(bitBuf);
+                    if (bitBuf == 0xff) {
+                        scan.push_back(0x00);
+                    }
+                    bitBuf = 0;
+                    bitNum = 0;
+                }
+            }
+        };
+        int prevDc = 0;
+        for (uint16_t by = 0; by < (height + 7) / 8; ++by) {
+            for (uint16_t bx = 0; bx < (width + 7) / 8; ++bx) {
+                int dc = ((bx * 7 + by * 3) % 64) - 32;
+                int diff = dc - prevDc;
+                prevDc = dc;
+                uint8_t size = 0;
+                for (int v = abs(diff); v > 0; v >>= 1) {
+                    ++size;
+                }
+                putBits(dcCode[size], dcLen[size]);
+                putBits(diff < 0 ? diff - 1 : diff, size);
+                putBits(0, 1); // EOB
+            }
+        }
+        putBits(0x7f, (8 - bitNum) % 8);
+        // 画像サイズを合わせる COM セグメント
+        size_t fixedSize = jpeg.size() + 10 + scan.size() + 2;
+        while (fixedSize + 4 < targetSize) {
+            size_t len = std::min<size_t>(targetSize - fixedSize - 4, 0xfff0);
+            addSegment(0xfe, std::vector<uint8_t>(len, 'x'));
+            fixedSize += len + 4;
+        }
+        addSegment(0xda, {1, 1, 0x00, 0, 63, 0});
+        jpeg.insert(jpeg.end(), scan.begin(), scan.end());
+        jpeg.push_back(0xff);
+        jpeg.push_back(0xd9);
+        return jpeg;
+    }
+
+  private:
+    // 1byte(スタート・ストップビット込み 10bit)の送信時間[usec]
+    static uint64_t byteTime(uint32_t baud) {
+        return baud == 0 ? 0 : (10000000ULL + baud - 1) / baud;
+    }
+    static void sleepUntil(uint64_t time) {
+        uint64_t now = micros();
+        if (time > now) {
+            std::this_thread::sleep_for(std::chrono::microseconds(time - now));
+        }
+    }
+    void updateCameraBaud(uint64_t time) {
+        if (_nextCameraBaud != 0 && time >= _baudChangeTime) {
+            _cameraBaud = _nextCameraBaud;
+            _nextCameraBaud = 0;
+        }
+    }
+    uint8_t take() {
+        LineByte lineByte = _rx.front();
+        _rx.pop_front();
+        if (lineByte.baud != _hostBaud) {
+            ++_stats.droppedBytes;
+            return lineByte.data ^ 0x5a;
+        }
+        return lineByte.data;
+    }
+
+    /**
+     * カメラからの送信
+     * 1 バイトずつボーレートに応じた時刻に届き、設定した誤り率でビットが反転する
+     */
+    void send(const std::vector<uint8_t> &bytes, uint64_t start) {
+        uint64_t time = std::max(start, _cameraLineFree);
+        for (uint8_t data : bytes) {
+            if (_config.bitErrorRate > 0) {
+                for (uint8_t bit = 0; bit < 8; ++bit) {
+                    if (_uniform(_rng) < _config.bitErrorRate) {
+                        data ^= 1 << bit;
+                        ++_stats.bitErrors;
+                    }
+                }
+            }
+            time += byteTime(_cameraBaud);
+            _rx.push_back({time, _cameraBaud, data});
+        }
+        _cameraLineFree = time;
+    }
+    void sendAck(uint8_t cmdId, uint64_t start, uint16_t packageId = 0) {
+        send({0xaa, OV528_CMD_ACK, cmdId, _ackCounter++, (uint8_t)packageId,
+              (uint8_t)(packageId >> 8)},
+             start);
+    }
+    void sendNak(uint8_t error, uint64_t start) {
+        ++_stats.naks;
+        send({0xaa, OV528_CMD_NAK, 0x00, _ackCounter++, error, 0x00}, start);
+    }
+
+    /**
+     * 6byte のコマンドを受信
+     */
+    void receiveCommand(const uint8_t *cmd, uint64_t arrival) {
+        ++_stats.commands;
+        uint64_t start = arrival + _config.cmdLatency;
+        uint8_t cmdId = cmd[1] & 0x1f;
+        switch (cmdId) {
+        case OV528_CMD_SYNC:
+            if (_syncIgnoreNum > 0) {
+                --_syncIgnoreNum;
+                return;
+            }
+            sendAck(OV528_CMD_SYNC, start);
+            send({0xaa, OV528_CMD_SYNC, 0x00, 0x00, 0x00, 0x00}, start);
+            break;
+        case OV528_CMD_ACK:
+            if (cmd[2] == 0x00) {
+                sendPackage(cmd[4] | (cmd[5] << 8), start);
+            }
+            break;
+        case OV528_CMD_INITIAL:
+            if (_images.count(cmd[5]) == 0) {
+                sendNak(0x0b, start);
+                return;
+            }
+            _resolution = cmd[5];
+            sendAck(cmdId, start);
+            break;
+        case OV528_CMD_SET_PACKAGE_SIZE: {
+            uint16_t size = cmd[3] | (cmd[4] << 8);
+            if (cmd[2] != 0x08 || size < OV528_DEF_PACKAGE_SIZE || size > 512) {
+                sendNak(0x0b, start);
+                return;
+            }
+            _packetSize = size;
+            sendAck(cmdId, start);
+            break;
+        }
+        case OV528_CMD_SET_BAUD: {
+            uint32_t baud = OV528_CLOCK / 4 / (cmd[2] + 1) / (cmd[3] + 1);
+            if (baud > _config.baudLimit) {
+                sendNak(0x0b, start);
+                return;
+            }
+            sendAck(cmdId, start);
+            _nextCameraBaud = baud;
+            _baudChangeTime = _cameraLineFree;
+            _syncIgnoreNum = _config.baudSyncIgnoreNum;
+            break;
+        }
+        case OV528_CMD_SNAPSHOT:
+            if (_resolution == 0) {
+                sendNak(0x0b, start);
+                return;
+            }
+            sendAck(cmdId, start);
+            _picture = _images[_resolution];
+            _pictureReadyTime = start + _config.snapshotLatency;
+            _hasPicture = true;
+            break;
+        case OV528_CMD_GET_PICTURE: {
+            if (!_hasPicture) {
+                sendNak(0x0b, start);
+                return;
+            }
+            sendAck(cmdId, start);
+            uint32_t size = _picture.size();
+            send({0xaa, OV528_CMD_DATA, 0x01, (uint8_t)size, (uint8_t)(size >> 8),
+                  (uint8_t)(size >> 16)},
+                 std::max(start, _pictureReadyTime));
+            break;
+        }
+        default:
+            sendNak(0x01, start);
+            break;
+        }
+    }
+
+    /**
+     * 画像データのパケット送信
+     * ID(2byte) + データ長(2byte) + データ + チェックサム(2byte)
+     */
+    void sendPackage(uint16_t id, uint64_t start) {
+        if (id == OV528_PACKAGE_END) {
+            return;
+        }
+        size_t dataSize = _packetSize - 6;
+        size_t offset = (size_t)id * dataSize;
+        if (offset >= _picture.size()) {
+            sendNak(0x0b, start);
+            return;
+        }
+        size_t len = std::min(dataSize, _picture.size() - offset);
+        std::vector<uint8_t> pkt = {(uint8_t)id, (uint8_t)(id >> 8), (uint8_t)len,
+                                    (uint8_t)(len >> 8)};
+        pkt.insert(pkt.end(), _picture.begin() + offset, _picture.begin() + offset + len);
+        uint8_t sum = 0;
+        for (uint8_t data : pkt) {
+            sum += data;
+        }
+        pkt.push_back(sum);
+        pkt.push_back(0x00);
+        ++_stats.packets;
+        send(pkt, start);
+    }
+};
+
+#endif // INCLUDE_GUARD_OV528_SIM
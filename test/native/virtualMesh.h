@@ -0,0 +1,643 @@
+#ifndef INCLUDE_GUARD_VIRTUAL_MESH
+#define INCLUDE_GUARD_VIRTUAL_MESH
+
+/**
+ * 仮想メッシュネットワーク
+ * 1 プロセス内の N ノードを木構造(painlessMesh と同じくループ無し)でつなぎ、
+ * リンク毎の遅延・揺らぎ・損失率に従ってメッセージを中継する
+ * 時刻は仮想時刻[usec]で、イベントを時刻順に処理するので実時間を待たない
+ *
+ * 各ノードはファームウェア(setup と loop)を自身のスレッドで動かす
+ * RTC メモリの変数・シングルトン・NVS・SPIFFS・時計は native 環境の代替ヘッダでスレッド毎に
+ * 持つので、ノード毎に別のモジュールとして振る舞う
+ * スレッドは 1 つずつ順番に動かし(動いていない間は仮想時刻が進まない)、
+ * loop を 1 回呼ぶ度に次のタスク実行時刻か受信まで休ませる
+ */
+
+#include "Arduino.h"
+#include "SPIFFS.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+
+#define VIRTUAL_LOOP_MAX_IDLE 1000 // 何も起きなくても loop を呼ぶ間隔[msec]
+
+/**
+ * リンク設定
+ */
+struct VirtualLinkConfig {
+    uint32_t latency = 5000; // 1 ホップの遅延[usec]
+    uint32_t jitter = 0;     // 遅延の揺らぎ(0 から jitter の一様分布)[usec]
+    double loss = 0;         // 1 ホップで失われる確率
+};
+
+/**
+ * 統計
+ */
+struct VirtualMeshStats {
+    uint32_t sent = 0;          // 送信メッセージ数(sendSingle, sendBroadcast の呼び出し数)
+    uint32_t transmissions = 0; // リンク上の送信数(中継を含む)
+    uint32_t delivered = 0;     // 受信コールバックの呼び出し数
+    uint32_t dropped = 0;       // リンク上で失われた数(途中のノードが抜けた場合を含む)
+    uint64_t bytes = 0;         // リンク上の送信バイト数
+};
+
+/**
+ * ノードで動かすファームウェア
+ * halt は DeepSleep(sleep が true)か計測終了でノードが止まるときにノードのスレッドで呼ばれる
+ */
+struct VirtualNodeProgram {
+    std::function<void()> setup;
+    std::function<void()> loop;
+    std::function<void(bool sleep)> halt;
+};
+
+/**
+ * メッシュに参加したノードのコールバック(painlessMesh 代替が登録する)
+ */
+struct VirtualMeshCallbacks {
+    std::function<void(uint32_t from, String &msg)> received;
+    std::function<void(uint32_t nodeId)> newConnection;
+    std::function<void()> changedConnections;
+};
+
+class VirtualMesh;
+
+/**
+ * 1 ノード分のスレッド
+ * 受信やトポロジ変化はキューに積み、ノードのスレッドで painlessMesh::update から呼ぶ
+ */
+class VirtualNode : public native::VirtualClock {
+  private:
+    friend class VirtualMesh;
+    // 計測終了時にノードのスレッドを止める
+    struct Shutdown {};
+
+    VirtualMesh &_vmesh;
+    uint32_t _nodeId;
+    VirtualNodeProgram _program;
+    std::thread _thread;
+    std::condition_variable _cond;
+    bool _isRunning = false;  // 自身の番
+    bool _isBlocked = false;  // delay 中(受信しても起こさない)
+    bool _isHalted = false;   // DeepSleep したか止めた
+    bool _isShutdown = false;
+    bool _isChangedQueued = false;  // トポロジ変化の通知がキューにある
+    uint64_t _wakeTime = UINT64_MAX; // 次に動かす仮想時刻[usec]
+    uint64_t _idleUntil = 0;         // loop の後に休ませる仮想時刻[usec]
+    uint64_t _sleepTime = 0;         // DeepSleep 時のタイマー起動時間[usec]
+    std::deque<std::function<void()>> _inbox;
+    VirtualMeshCallbacks _callbacks;
+    bool _isJoined = false;
+
+  public:
+    VirtualNode(VirtualMesh &vmesh, uint32_t nodeId, const VirtualNodeProgram &program)
+        : _vmesh(vmesh), _nodeId(nodeId), _program(program) {}
+    static VirtualNode *&current() {
+        thread_local VirtualNode *node = NULL;
+        return node;
+    }
+
+    uint32_t getNodeId() { return _nodeId; }
+    bool isHalted() { return _isHalted; }
+    uint64_t getSleepTime() { return _sleepTime; }
+    uint64_t micros() override;
+    // 仮想時刻で待つ(待っている間は他のノードが動く)
+    void delay(uint64_t usec) override {
+        _isBlocked = true;
+        yieldUntil(micros() + usec);
+        _isBlocked = false;
+    }
+    // 今回の loop の後、遅くとも delayMsec 後には起こす
+    void wakeWithin(unsigned long delayMsec) {
+        _idleUntil = std::min<uint64_t>(_idleUntil, micros() + delayMsec * 1000ULL);
+    }
+    // キューに積まれた受信・接続通知を処理する
+    void processInbox() {
+        while (!_inbox.empty()) {
+            std::function<void()> action = _inbox.front();
+            _inbox.pop_front();
+            action();
+        }
+    }
+
+    // painlessMesh 代替から呼ぶ
+    void join(const VirtualMeshCallbacks &callbacks);
+    void leave();
+    bool isJoined() { return _isJoined; }
+    bool sendSingle(uint32_t dest, const String &msg);
+    bool sendBroadcast(const String &msg);
+    std::list<uint32_t> getNodeList();
+    String subConnectionJson();
+
+  private:
+    void start();
+    void run();
+    void idle() {
+        uint64_t until = _inbox.empty() ? _idleUntil : micros();
+        _idleUntil = micros() + VIRTUAL_LOOP_MAX_IDLE * 1000ULL;
+        yieldUntil(until);
+    }
+    void yieldUntil(uint64_t time);
+    void waitTurn(std::unique_lock<std::mutex> &lock);
+    void post(std::function<void()> action);
+};
+
+class VirtualMesh {
+  private:
+    friend class VirtualNode;
+
+    struct Link {
+        uint32_t to;
+        VirtualLinkConfig config;
+    };
+    struct Node {
+        std::vector<Link> links;
+        std::unique_ptr<VirtualNode> process;
+    };
+    struct Event {
+        uint64_t time;
+        uint64_t seq; // 同時刻のイベントは登録順
+        std::function<void()> action;
+        bool operator>(const Event &other) const {
+            return time != other.time ? time > other.time : seq > other.seq;
+        }
+    };
+
+    std::map<uint32_t, Node> _nodes;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> _events;
+    uint64_t _now = 0;
+    uint64_t _eventSeq = 0;
+    std::mt19937 _rng;
+    VirtualMeshStats _stats;
+    std::function<bool(uint32_t from, uint32_t to, const String &msg)> _dropFilter;
+    // ノードのスレッドとの交代
+    std::mutex _mutex;
+    std::condition_variable _cond;
+
+  public:
+    explicit VirtualMesh(unsigned int seed = 1) : _rng(seed) {}
+    ~VirtualMesh() {
+        for (auto &node : _nodes) {
+            if (node.second.process) {
+                shutdown(*node.second.process);
+            }
+        }
+    }
+
+    void addNode(uint32_t nodeId) { _nodes[nodeId]; }
+    void connect(uint32_t a, uint32_t b, const VirtualLinkConfig &config) {
+        _nodes[a].links.push_back({b, config});
+        _nodes[b].links.push_back({a, config});
+    }
+    /**
+     * 先頭のノードを根とし、各ノードを子の数が maxChildren 未満の既存ノードにランダムにつなぐ
+     */
+    void makeRandomTree(const std::vector<uint32_t> &nodeIds, uint8_t maxChildren,
+                        const VirtualLinkConfig &config) {
+        std::vector<uint32_t> parents;
+        std::map<uint32_t, uint8_t> childNum;
+        for (uint32_t nodeId : nodeIds) {
+            addNode(nodeId);
+            if (!parents.empty()) {
+                size_t index = std::uniform_int_distribution<size_t>(0, parents.size() - 1)(_rng);
+                uint32_t parent = parents[index];
+                connect(parent, nodeId, config);
+                if (++childNum[parent] >= maxChildren) {
+                    parents.erase(parents.begin() + index);
+                }
+            }
+            parents.push_back(nodeId);
+        }
+    }
+
+    /*************************************
+     * ノードの起動
+     ************************************/
+    /**
+     * delay 後にノードを起動し、以降 program.loop を呼び続ける
+     * painlessMesh::init を呼んだ時点でメッシュに参加し、stop で抜ける
+     */
+    void boot(uint32_t nodeId, uint64_t delay, const VirtualNodeProgram &program) {
+        Node &node = _nodes[nodeId];
+        node.process.reset(new VirtualNode(*this, nodeId, program));
+        node.process->start();
+        wake(*node.process, _now + delay);
+    }
+    /**
+     * delay 後にノードのスレッドで action を実行する(モジュールへの操作の模擬用)
+     */
+    void post(uint32_t nodeId, uint64_t delay, std::function<void()> action) {
+        schedule(delay, [this, nodeId, action]() {
+            VirtualNode *process = _nodes[nodeId].process.get();
+            if (process != NULL && !process->_isHalted) {
+                process->post(action);
+            }
+        });
+    }
+    bool isHalted(uint32_t nodeId) {
+        VirtualNode *process = _nodes[nodeId].process.get();
+        return process == NULL || process->_isHalted;
+    }
+    uint32_t getHaltedNum() {
+        uint32_t haltedNum = 0;
+        for (auto &node : _nodes) {
+            haltedNum += isHalted(node.first) ? 1 : 0;
+        }
+        return haltedNum;
+    }
+    /**
+     * 止まっていなければノードを止める(halt は sleep が false で呼ばれる)
+     */
+    void shutdown(uint32_t nodeId) {
+        VirtualNode *process = _nodes[nodeId].process.get();
+        if (process != NULL) {
+            shutdown(*process);
+        }
+    }
+
+    /*************************************
+     * 仮想時刻
+     ************************************/
+    uint64_t now() { return _now; }
+    void schedule(uint64_t delay, std::function<void()> action) {
+        _events.push({_now + delay, _eventSeq++, action});
+    }
+    /**
+     * 指定時刻までのイベントを処理する
+     * done が true を返したらその時点で止める
+     */
+    void run(uint64_t until, std::function<bool()> done = nullptr) {
+        while (!_events.empty() && _events.top().time <= until) {
+            Event event = _events.top();
+            _events.pop();
+            _now = event.time;
+            event.action();
+            if (done && done()) {
+                return;
+            }
+        }
+        _now = std::max(_now, until);
+    }
+
+    /*************************************
+     * 送受信
+     ************************************/
+    /**
+     * 経路上のノードを中継して宛先に送る
+     * 宛先に届く経路が無ければ false を返す(途中で失われても送信は成功扱い)
+     */
+    bool sendSingle(uint32_t from, uint32_t dest, const String &msg) {
+        std::vector<uint32_t> path = findPath(from, dest);
+        if (path.size() < 2) {
+            return false;
+        }
+        ++_stats.sent;
+        forward(from, path, 1, msg);
+        return true;
+    }
+    /**
+     * 全ノードに送る(各ノードは受信したリンク以外の全リンクへ中継する)
+     */
+    bool sendBroadcast(uint32_t from, const String &msg) {
+        if (getNodeList(from).empty()) {
+            return false;
+        }
+        ++_stats.sent;
+        flood(from, from, from, msg);
+        return true;
+    }
+    // メッシュに参加しているノードのうち from からつながっているもの(自身を除く)
+    std::list<uint32_t> getNodeList(uint32_t nodeId) {
+        std::list<uint32_t> nodeList;
+        if (!isJoined(nodeId)) {
+            return nodeList;
+        }
+        for (uint32_t other : collect(nodeId, nodeId)) {
+            if (other != nodeId) {
+                nodeList.push_back(other);
+            }
+        }
+        return nodeList;
+    }
+    /**
+     * nodeId を根としたメッシュ内の接続(painlessMesh の subConnectionJson と同じ形式)
+     */
+    String subConnectionJson(uint32_t nodeId, uint32_t prev = 0) {
+        String json = "{\"nodeId\":" + String(nodeId) + ",\"subs\":[";
+        bool isFirst = true;
+        for (Link &link : _nodes[nodeId].links) {
+            if (link.to != prev && isJoined(link.to)) {
+                json += (isFirst ? "" : ",") + subConnectionJson(link.to, nodeId);
+                isFirst = false;
+            }
+        }
+        return json + "]}";
+    }
+    /**
+     * 1 ホップの送信毎に呼び、true を返したものを失わせる(特定のメッセージの損失の再現用)
+     */
+    void setDropFilter(std::function<bool(uint32_t from, uint32_t to, const String &msg)> filter) {
+        _dropFilter = filter;
+    }
+    // 根からのホップ数
+    uint8_t getHop(uint32_t root, uint32_t nodeId) {
+        return findPath(root, nodeId, false).size() - 1;
+    }
+    const VirtualMeshStats &getStats() { return _stats; }
+
+  private:
+    bool isJoined(uint32_t nodeId) {
+        VirtualNode *process = _nodes[nodeId].process.get();
+        return process != NULL && process->_isJoined;
+    }
+
+    /*************************************
+     * ノードのスレッドとの交代
+     ************************************/
+    // time にノードを動かす(既により早い時刻に動かす予定なら何もしない)
+    // loop 中の delay で過ぎた時刻を指定された場合は今すぐ動かす
+    void wake(VirtualNode &node, uint64_t time) {
+        time = std::max(time, _now);
+        if (node._isHalted || time >= node._wakeTime) {
+            return;
+        }
+        node._wakeTime = time;
+        VirtualNode *process = &node;
+        _events.push({time, _eventSeq++, [this, process, time]() {
+                          if (!process->_isHalted && process->_wakeTime == time) {
+                              resume(*process);
+                          }
+                      }});
+    }
+    // ノードのスレッドを動かし、休むか止まるまで待つ
+    void resume(VirtualNode &node) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        node._wakeTime = UINT64_MAX;
+        node._isRunning = true;
+        node._cond.notify_one();
+        _cond.wait(lock, [&node]() { return !node._isRunning; });
+    }
+    void shutdown(VirtualNode &node) {
+        if (!node._thread.joinable()) {
+            return;
+        }
+        if (!node._isHalted) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            node._isShutdown = true;
+            node._isRunning = true;
+            node._cond.notify_one();
+            _cond.wait(lock, [&node]() { return !node._isRunning; });
+        }
+        node._thread.join();
+    }
+
+    /*************************************
+     * メッシュへの参加・離脱
+     ************************************/
+    void join(VirtualNode &node) {
+        node._isJoined = true;
+        for (Link &link : _nodes[node._nodeId].links) {
+            VirtualNode *neighbor = _nodes[link.to].process.get();
+            if (neighbor == NULL || !neighbor->_isJoined) {
+                continue;
+            }
+            uint32_t nodeId = node._nodeId;
+            uint32_t neighborId = link.to;
+            neighbor->post([neighbor, nodeId]() { neighbor->_callbacks.newConnection(nodeId); });
+            node.post([&node, neighborId]() { node._callbacks.newConnection(neighborId); });
+        }
+        notifyChanged(node._nodeId);
+    }
+    void leave(VirtualNode &node) {
+        node._isJoined = false;
+        for (Link &link : _nodes[node._nodeId].links) {
+            notifyChanged(link.to);
+        }
+    }
+    // nodeId からつながっている全ノードにトポロジ変化を通知する
+    void notifyChanged(uint32_t nodeId) {
+        if (!isJoined(nodeId)) {
+            return;
+        }
+        for (uint32_t other : collect(nodeId, nodeId)) {
+            VirtualNode *process = _nodes[other].process.get();
+            if (process->_isChangedQueued) {
+                continue;
+            }
+            process->_isChangedQueued = true;
+            process->post([process]() {
+                process->_isChangedQueued = false;
+                process->_callbacks.changedConnections();
+            });
+        }
+    }
+
+    /*************************************
+     * 転送
+     ************************************/
+    /**
+     * 1 ホップの送信
+     * 損失しなければ遅延後に arrive を呼ぶ(その時点で受信側が抜けていれば失われる)
+     */
+    void transmit(uint32_t from, uint32_t to, const String &msg, std::function<void()> arrive) {
+        const VirtualLinkConfig *config = NULL;
+        for (Link &link : _nodes[from].links) {
+            if (link.to == to) {
+                config = &link.config;
+            }
+        }
+        ++_stats.transmissions;
+        _stats.bytes += msg.length();
+        bool isLost = config->loss > 0 &&
+                      std::uniform_real_distribution<double>(0, 1)(_rng) < config->loss;
+        if (isLost || (_dropFilter && _dropFilter(from, to, msg))) {
+            ++_stats.dropped;
+            return;
+        }
+        uint32_t jitter = config->jitter == 0
+                              ? 0
+                              : std::uniform_int_distribution<uint32_t>(0, config->jitter)(_rng);
+        schedule(config->latency + jitter, [this, to, arrive]() {
+            if (!isJoined(to)) {
+                ++_stats.dropped;
+                return;
+            }
+            arrive();
+        });
+    }
+    void forward(uint32_t origin, const std::vector<uint32_t> &path, size_t hop,
+                 const String &msg) {
+        transmit(path[hop - 1], path[hop], msg, [this, origin, path, hop, msg]() {
+            if (hop + 1 < path.size()) {
+                forward(origin, path, hop + 1, msg);
+                return;
+            }
+            deliver(path[hop], origin, msg);
+        });
+    }
+    void flood(uint32_t origin, uint32_t nodeId, uint32_t prev, const String &msg) {
+        for (Link &link : _nodes[nodeId].links) {
+            if (link.to == prev || !isJoined(link.to)) {
+                continue;
+            }
+            uint32_t next = link.to;
+            transmit(nodeId, next, msg, [this, origin, next, nodeId, msg]() {
+                deliver(next, origin, msg);
+                flood(origin, next, nodeId, msg);
+            });
+        }
+    }
+    void deliver(uint32_t nodeId, uint32_t from, const String &msg) {
+        ++_stats.delivered;
+        VirtualNode *process = _nodes[nodeId].process.get();
+        process->post([process, from, msg]() {
+            String received = msg;
+            process->_callbacks.received(from, received);
+        });
+    }
+    // nodeId から prev 以外のリンクでつながっている参加中のノード(自身を含む)
+    std::vector<uint32_t> collect(uint32_t nodeId, uint32_t prev) {
+        std::vector<uint32_t> nodeIds = {nodeId};
+        for (Link &link : _nodes[nodeId].links) {
+            if (link.to != prev && isJoined(link.to)) {
+                std::vector<uint32_t> sub = collect(link.to, nodeId);
+                nodeIds.insert(nodeIds.end(), sub.begin(), sub.end());
+            }
+        }
+        return nodeIds;
+    }
+    // joinedOnly が false の場合は参加していないノードも含めた配線上の経路
+    std::vector<uint32_t> findPath(uint32_t from, uint32_t dest, bool joinedOnly = true) {
+        if (joinedOnly && !isJoined(from)) {
+            return {};
+        }
+        std::map<uint32_t, uint32_t> prev = {{from, from}};
+        std::queue<uint32_t> queue;
+        queue.push(from);
+        while (!queue.empty() && prev.count(dest) == 0) {
+            uint32_t nodeId = queue.front();
+            queue.pop();
+            for (Link &link : _nodes[nodeId].links) {
+                if (prev.count(link.to) == 0 && (!joinedOnly || isJoined(link.to))) {
+                    prev[link.to] = nodeId;
+                    queue.push(link.to);
+                }
+            }
+        }
+        if (prev.count(dest) == 0) {
+            return {};
+        }
+        std::vector<uint32_t> path = {dest};
+        while (path.front() != from) {
+            path.insert(path.begin(), prev[path.front()]);
+        }
+        return path;
+    }
+};
+
+/*************************************
+ * VirtualNode
+ ************************************/
+inline uint64_t VirtualNode::micros() { return _vmesh._now; }
+
+inline void VirtualNode::start() {
+    _thread = std::thread([this]() { run(); });
+}
+
+/**
+ * ノードのスレッド
+ * ファームウェアは自身の番の間だけ動き、DeepSleep するか計測終了で止まる
+ */
+inline void VirtualNode::run() {
+    native::virtualClock() = this;
+    current() = this;
+    // SPIFFS はノード毎のディレクトリを空にして使う
+    SPIFFS.setRoot(SPIFFS.getRoot() / ("vmesh_" + std::to_string(_nodeId)));
+    SPIFFS.format();
+    bool isSleep = false;
+    try {
+        // 起動時刻まで待つ(先に起こされていても自身の番は VirtualMesh に返さない)
+        {
+            std::unique_lock<std::mutex> lock(_vmesh._mutex);
+            waitTurn(lock);
+        }
+        _idleUntil = micros() + VIRTUAL_LOOP_MAX_IDLE * 1000ULL;
+        _program.setup();
+        while (true) {
+            _program.loop();
+            idle();
+        }
+    } catch (const native::DeepSleep &sleep) {
+        _sleepTime = sleep.timerWakeup;
+        isSleep = true;
+    } catch (const Shutdown &) {
+    }
+    if (_isJoined) {
+        _vmesh.leave(*this);
+    }
+    if (_program.halt) {
+        _program.halt(isSleep);
+    }
+    std::unique_lock<std::mutex> lock(_vmesh._mutex);
+    _isHalted = true;
+    _isRunning = false;
+    _vmesh._cond.notify_one();
+}
+
+/**
+ * 仮想時刻 time まで休む
+ */
+inline void VirtualNode::yieldUntil(uint64_t time) {
+    _vmesh.wake(*this, time);
+    std::unique_lock<std::mutex> lock(_vmesh._mutex);
+    _isRunning = false;
+    _vmesh._cond.notify_one();
+    waitTurn(lock);
+}
+
+// 自身の番になるまで待つ
+inline void VirtualNode::waitTurn(std::unique_lock<std::mutex> &lock) {
+    _cond.wait(lock, [this]() { return _isRunning; });
+    if (_isShutdown) {
+        throw Shutdown();
+    }
+}
+
+// 受信などをキューに積み、休んでいれば起こす
+inline void VirtualNode::post(std::function<void()> action) {
+    _inbox.push_back(action);
+    if (!_isBlocked && !_isRunning) {
+        _vmesh.wake(*this, _vmesh._now);
+    }
+}
+
+inline void VirtualNode::join(const VirtualMeshCallbacks &callbacks) {
+    _callbacks = callbacks;
+    _vmesh.join(*this);
+}
+inline void VirtualNode::leave() {
+    if (_isJoined) {
+        _vmesh.leave(*this);
+    }
+}
+inline bool VirtualNode::sendSingle(uint32_t dest, const String &msg) {
+    return _isJoined && _vmesh.sendSingle(_nodeId, dest, msg);
+}
+inline bool VirtualNode::sendBroadcast(const String &msg) {
+    return _isJoined && _vmesh.sendBroadcast(_nodeId, msg);
+}
+inline std::list<uint32_t> VirtualNode::getNodeList() { return _vmesh.getNodeList(_nodeId); }
+inline String VirtualNode::subConnectionJson() {
+    return _isJoined ? _vmesh.subConnectionJson(_nodeId) : String("[]");
+}
+
+#endif // INCLUDE_GUARD_VIRTUAL_MESH
@@ -0,0 +1,220 @@
+/**
+ * Camera::saveCameraData() のベンチマーク
+ * OV528 シミュレータに対して解像度・パケットサイズ毎の撮影時間と 1 パケットの読み出し時間を
+ * 計測して表示する
+ * pio test -e native -f test_camera_bench -v
+ * 旧方式(CAMERA_LEGACY_UART)の UART 読み書きで計測する場合は native_legacy_uart 環境を使う
+ * pio test -e native_legacy_uart -f test_camera_bench -v
+ */
+
+#include "camera.h"
+#include "ov528Sim.h"
+#include <unity.h>
+
+#define BENCH_IMG_PATH "/bench.jpg"
+#define BENCH_REPEAT 3
+#ifdef CAMERA_LEGACY_UART
+#define BENCH_UART_MODE "legacy"
+#else
+#define BENCH_UART_MODE "bulk"
+#endif
+
+static const int BENCH_RESOLUTIONS[] = {OV528_SIZE_80_60, OV528_SIZE_QQVGA, OV528_SIZE_QVGA,
+                                        OV528_SIZE_VGA};
+static const uint16_t BENCH_PACKET_SIZES[] = {512, 256, 128};
+
+static Camera *beginCamera(Ov528SimPort &sim) {
+    Camera::deleteInstance();
+    Camera *pCamera = Camera::getInstance();
+    pCamera->setPort(&sim);
+    pCamera->cameraSerialBegin();
+    return pCamera;
+}
+
+static bool isSavedImage(const std::vector<uint8_t> &expected) {
+    File file = SPIFFS.open(BENCH_IMG_PATH, "r");
+    std::vector<uint8_t> saved(file.size());
+    file.read(saved.data(), saved.size());
+    file.close();
+    return saved == expected;
+}
+
+void setUp() {}
+void tearDown() {}
+
+/**
+ * 起動直後に応答しない SYNC があっても起動時のボーレートで同期し、最も速いボーレートに切り替える
+ */
+void test_initialize_negotiates_fastest_baud() {
+    Ov528SimConfig config;
+    config.syncIgnoreNum = 2;
+    Ov528SimPort sim(config);
+    Camera *pCamera = beginCamera(sim);
+    TEST_ASSERT_TRUE(pCamera->initialize());
+    TEST_ASSERT_EQUAL_UINT32(921600, pCamera->getBaudRate());
+    TEST_ASSERT_EQUAL_UINT32(921600, sim.getCameraBaud());
+}
+
+/**
+ * 通信できないボーレートは使わない
+ */
+void test_initialize_respects_baud_limit() {
+    Ov528SimConfig config;
+    config.baudLimit = 230400;
+    Ov528SimPort sim(config);
+    Camera *pCamera = beginCamera(sim);
+    TEST_ASSERT_TRUE(pCamera->initialize());
+    TEST_ASSERT_EQUAL_UINT32(230400, pCamera->getBaudRate());
+}
+
+/**
+ * DeepSleep 中もカメラが前回のボーレートのままでも同期できる
+ */
+void test_initialize_at_previous_baud() {
+    Ov528SimConfig config;
+    config.bootBaud = 460800;
+    Ov528SimPort sim(config);
+    Camera *pCamera = beginCamera(sim);
+    TEST_ASSERT_TRUE(pCamera->initialize());
+    TEST_ASSERT_EQUAL_UINT32(460800, pCamera->getBaudRate());
+}
+
+/**
+ * SET_BAUD の ACK 後にカメラだけ切り替わり、新しいボーレートでの最初の SYNC に応答しなくても
+ * 候補のボーレートを探し直してカメラを使い続ける
+ */
+void test_initialize_recovers_after_missed_baud_sync() {
+    Ov528SimConfig config;
+    config.baudSyncIgnoreNum = 1;
+    Ov528SimPort sim(config);
+    Camera *pCamera = beginCamera(sim);
+    TEST_ASSERT_TRUE(pCamera->initialize());
+    TEST_ASSERT_EQUAL_UINT32(921600, pCamera->getBaudRate());
+    TEST_ASSERT_EQUAL_UINT32(921600, sim.getCameraBaud());
+    TEST_ASSERT_TRUE(pCamera->saveCameraData(BENCH_IMG_PATH));
+}
+
+/**
+ * 解像度・パケットサイズ毎の撮影時間
+ */
+void test_capture_benchmark() {
+    Ov528SimPort sim;
+    Camera *pCamera = beginCamera(sim);
+    TEST_ASSERT_TRUE(pCamera->initialize());
+    printf("\nuart:%s baud:%u repeat:%d\n", BENCH_UART_MODE, pCamera->getBaudRate(),
+           BENCH_REPEAT);
+    printf("%-5s %6s %6s %8s %8s %8s %8s %8s %8s %9s\n", "res", "packet", "bytes", "SYNC",
+           "INITIAL", "SNAPSHOT", "GET_PIC", "DATA", "total", "KB/s");
+    for (int resolution : BENCH_RESOLUTIONS) {
+        for (uint16_t packetSize : BENCH_PACKET_SIZES) {
+            pCamera->setResolution(resolution);
+            pCamera->setPacketSize(packetSize);
+            unsigned long stageTime[CAPTURE_DONE] = {0};
+            unsigned long total = 0;
+            for (int i = 0; i < BENCH_REPEAT; ++i) {
+                unsigned long start = millis();
+                TEST_ASSERT_TRUE(pCamera->saveCameraData(BENCH_IMG_PATH));
+                total += millis() - start;
+                for (int stage = 0; stage < CAPTURE_DONE; ++stage) {
+                    stageTime[stage] += pCamera->getCaptureResult().stageTime[stage];
+                }
+                TEST_ASSERT_TRUE(isSavedImage(sim.getImage(resolution)));
+            }
+            unsigned long dataLen = pCamera->getCaptureResult().dataLen;
+            printf("%-5d %6u %6lu %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %9.1f\n", resolution,
+                   packetSize, dataLen, (double)stageTime[CAPTURE_SYNC] / BENCH_REPEAT,
+                   (double)stageTime[CAPTURE_INITIAL] / BENCH_REPEAT,
+                   (double)stageTime[CAPTURE_SNAPSHOT] / BENCH_REPEAT,
+                   (double)stageTime[CAPTURE_GET_PICTURE] / BENCH_REPEAT,
+                   (double)stageTime[CAPTURE_DATA] / BENCH_REPEAT, (double)total / BENCH_REPEAT,
+                   total == 0 ? 0 : (double)dataLen * BENCH_REPEAT / total);
+        }
+    }
+}
+
+/**
+ * パケットサイズ毎の 1 パケットの読み出し時間(要求の送信からチェックサム確認まで)
+ * 旧方式と比べる場合は両方の環境で実行して uart の行を並べる
+ */
+void test_packet_latency_benchmark() {
+    Ov528SimPort sim;
+    Camera *pCamera = beginCamera(sim);
+    TEST_ASSERT_TRUE(pCamera->initialize());
+    pCamera->setResolution(OV528_SIZE_VGA);
+    printf("\nuart:%s baud:%u res:%d repeat:%d\n", BENCH_UART_MODE, pCamera->getBaudRate(),
+           OV528_SIZE_VGA, BENCH_REPEAT);
+    printf("%6s %6s %6s %9s %9s %9s\n", "packet", "count", "errors", "min_us", "avg_us",
+           "max_us");
+    for (uint16_t packetSize : BENCH_PACKET_SIZES) {
+        pCamera->setPacketSize(packetSize);
+        CameraPacketStats stats;
+        for (int i = 0; i < BENCH_REPEAT; ++i) {
+            TEST_ASSERT_TRUE(pCamera->saveCameraData(BENCH_IMG_PATH));
+            const CameraPacketStats &captureStats = pCamera->getPacketStats();
+            stats.count += captureStats.count;
+            stats.errors += captureStats.errors;
+            stats.total += captureStats.total;
+            stats.minLatency = min(stats.minLatency, captureStats.minLatency);
+            stats.maxLatency = max(stats.maxLatency, captureStats.maxLatency);
+        }
+        TEST_ASSERT_TRUE(stats.count > 0);
+        printf("%6u %6u %6u %9lu %9lu %9lu\n", packetSize, stats.count, stats.errors,
+               stats.minLatency, stats.average(), stats.maxLatency);
+    }
+}
+
+/**
+ * ビット誤りがあってもパケットの再要求で正しい画像を保存する
+ */
+void test_capture_with_bit_errors() {
+    Ov528SimConfig config;
+    config.bitErrorRate = 1e-5;
+    Ov528SimPort sim(config);
+    Camera *pCamera = beginCamera(sim);
+    TEST_ASSERT_TRUE(pCamera->initialize());
+    pCamera->setResolution(OV528_SIZE_QVGA);
+    pCamera->setPacketSize(512);
+    uint32_t packetErrors = 0;
+    for (int i = 0; i < BENCH_REPEAT; ++i) {
+        TEST_ASSERT_TRUE(pCamera->saveCameraData(BENCH_IMG_PATH));
+        TEST_ASSERT_TRUE(isSavedImage(sim.getImage(OV528_SIZE_QVGA)));
+        packetErrors += pCamera->getPacketStats().errors;
+    }
+    printf("\nbit errors:%u packet errors:%u\n", sim.getStats().bitErrors, packetErrors);
+    TEST_ASSERT_TRUE(sim.getStats().bitErrors > 0);
+    TEST_ASSERT_TRUE(packetErrors > 0);
+}
+
+/**
+ * 撮影中に撮影タスクへ届いた通知(撮影要求)で書き込み完了待ちが終わらず、通知も失われない
+ */
+void test_capture_keeps_task_notification() {
+    Ov528SimPort sim;
+    Camera *pCamera = beginCamera(sim);
+    TEST_ASSERT_TRUE(pCamera->initialize());
+    pCamera->setResolution(OV528_SIZE_VGA);
+    pCamera->setPacketSize(512);
+    TaskHandle_t captureTask = xTaskGetCurrentTaskHandle();
+    std::thread notifier([captureTask]() {
+        vTaskDelay(20);
+        xTaskNotifyGive(captureTask);
+    });
+    TEST_ASSERT_TRUE(pCamera->saveCameraData(BENCH_IMG_PATH));
+    notifier.join();
+    TEST_ASSERT_TRUE(isSavedImage(sim.getImage(OV528_SIZE_VGA)));
+    TEST_ASSERT_EQUAL_UINT32(1, ulTaskNotifyTake(pdTRUE, 0));
+}
+
+int main() {
+    SPIFFS.begin(true);
+    UNITY_BEGIN();
+    RUN_TEST(test_initialize_negotiates_fastest_baud);
+    RUN_TEST(test_initialize_respects_baud_limit);
+    RUN_TEST(test_initialize_at_previous_baud);
+    RUN_TEST(test_initialize_recovers_after_missed_baud_sync);
+    RUN_TEST(test_capture_benchmark);
+    RUN_TEST(test_packet_latency_benchmark);
+    RUN_TEST(test_capture_with_bit_errors);
+    RUN_TEST(test_capture_keeps_task_notification);
+    return UNITY_END();
+}
@@ -0,0 +1,277 @@
+/**
+ * 仮想メッシュ上のメッセージ伝搬の計測
+ * N 個の TrapModule を仮想メッシュにつないで罠モードで起動し、親モジュールの設定同期、
+ * 子モジュールのスロット毎のモジュール状態送信、同期 DeepSleep の ACK 収集を通して動かし、
+ * 伝搬時間・収束時間・メッセージ数を表示する
+ * pio test -e native -f test_mesh_sim -v
+ *
+ * 各ノードは自身のスレッドでファームウェアと同じく setupModule と update を呼ぶ
+ * シングルトン・RTC メモリ・NVS・SPIFFS はスレッド毎に持つので、ノード毎に別のモジュールになる
+ */
+
+#include "trapModule.h"
+#include <unity.h>
+
+#define SIM_LINK_LATENCY 10000 // 1 ホップの遅延[usec]
+#define SIM_LINK_JITTER 10000  // 遅延の揺らぎ[usec]
+#define SIM_MAX_CHILDREN 4     // 1 ノードに接続できる子の数
+#define SIM_BOOT_JITTER 200000 // 起動時刻のばらつき[usec]
+#define SIM_WAKE_TIME 1704088800 // 全ノードが揃って起動する時刻(2024/1/1 6:00)
+#define SIM_CONFIG_TIME 5000   // 親モジュールが設定を同期する時刻[msec]
+#define SIM_ACTIVE_START 5     // 同期する稼働開始時刻
+#define SIM_ACTIVE_END 20      // 同期する稼働終了時刻
+#define SIM_MARGIN_TIME 10000  // 稼働時間超過後に DeepSleep を待つ時間[msec]
+
+static const uint8_t SIM_NODE_NUMS[] = {10, 50, 100};
+
+/**
+ * ノード毎の結果(DeepSleep か計測終了で止まったときのもの)
+ */
+struct SimNodeResult {
+    bool hasConfig = false;       // 同期した設定が反映された
+    bool isSleep = false;         // DeepSleep した
+    uint64_t haltTime = 0;        // 止まった時刻[usec]
+    uint32_t configDelay = 0;     // 設定の伝搬時間[usec]
+    uint32_t reportCollision = 0; // 同じスロットで受信した数(親モジュール)
+    uint32_t reportedNum = 0;     // 状態を受信した子モジュール数(親モジュール)
+    uint32_t sleepAckNum = 0;     // 同期 DeepSleep の ACK を受信した子モジュール数(親モジュール)
+};
+
+/**
+ * 計測結果
+ */
+struct MeshSimResult {
+    uint8_t nodeNum = 0;
+    double loss = 0;
+    uint8_t maxHop = 0;
+    uint32_t configReached = 0; // 設定が反映された子モジュール数
+    uint32_t configDelay = 0;   // 最も遅い子モジュールの設定の伝搬時間[usec]
+    uint32_t reported = 0;
+    uint32_t reportCollision = 0;
+    uint32_t sleepAcked = 0;
+    uint32_t sleepNum = 0;   // DeepSleep したノード数
+    uint64_t sleepTime = 0;  // 最後のノードが DeepSleep するまで[usec]
+    VirtualMeshStats stats;
+};
+
+/**
+ * 罠モードの DeepSleep から起動時刻に揃って起動した状態にする
+ * 設置モードからの切り替え直後の起動とならないよう、RTC メモリに保存してから読み直させる
+ */
+static void seedModuleConfig(uint32_t parentId, uint8_t nodeNum) {
+    DynamicJsonBuffer jsonBuf;
+    JsonObject &config = jsonBuf.createObject();
+    config[KEY_TRAP_MODE] = true;
+    config[KEY_PARENT_NODE_ID] = parentId;
+    config[KEY_NODE_NUM] = nodeNum;
+    config[KEY_ACTIVE_START] = 6;
+    config[KEY_ACTIVE_END] = 18;
+    config[KEY_WAKE_TIME] = SIM_WAKE_TIME;
+    ModuleConfig::getInstance()->updateModuleConfig(config);
+    ModuleConfig::getInstance()->saveCurrentModuleConfig();
+    ModuleConfig::deleteInstance();
+}
+
+/**
+ * 止まったノードの結果を取り出し、シングルトンを破棄する
+ */
+static void collectNodeResult(bool sleep, uint64_t haltTime, SimNodeResult &result) {
+    TrapModule *trapModule = TrapModule::getInstance();
+    ModuleConfig *config = ModuleConfig::getInstance();
+    result.isSleep = sleep;
+    result.haltTime = haltTime;
+    result.hasConfig =
+        config->_activeStart == SIM_ACTIVE_START && config->_activeEnd == SIM_ACTIVE_END;
+    DynamicJsonBuffer jsonBuf;
+    JsonObject &moduleInfo = jsonBuf.createObject();
+    trapModule->collectModuleInfo(moduleInfo);
+    JsonObject &meshStats = moduleInfo[KEY_MESH_STATS].as<JsonObject &>();
+    result.configDelay = meshStats[KEY_CONFIG_DELAY];
+    result.reportCollision = meshStats[KEY_REPORT_COLLISION];
+    result.reportedNum = meshStats[KEY_REPORTED_NUM];
+    result.sleepAckNum = meshStats[KEY_SLEEP_ACK_NUM];
+    TrapModule::deleteInstance();
+    ModuleConfig::deleteInstance();
+    Camera::deleteInstance();
+    ImageStore::deleteInstance();
+}
+
+/**
+ * ノードを罠モードで起動し、全ノードが止まるか稼働時間を超えるまで動かす
+ * 先頭のノードを親モジュールとし、syncTime が 0 以外ならその時刻[usec]に設定を同期する
+ */
+static void runTrapModules(VirtualMesh &vmesh, const std::vector<uint32_t> &nodeIds,
+                           std::vector<SimNodeResult> &nodeResults, std::mt19937 &rng,
+                           uint64_t syncTime) {
+    uint32_t parentId = nodeIds[0];
+    uint8_t nodeNum = nodeIds.size();
+    nodeResults.assign(nodeNum, SimNodeResult());
+    for (size_t i = 0; i < nodeIds.size(); ++i) {
+        SimNodeResult *nodeResult = &nodeResults[i];
+        VirtualNodeProgram program;
+        program.setup = [parentId, nodeNum]() {
+            seedModuleConfig(parentId, nodeNum);
+            TrapModule::getInstance()->setupModule();
+        };
+        program.loop = []() { TrapModule::getInstance()->update(); };
+        program.halt = [&vmesh, nodeResult](bool sleep) {
+            collectNodeResult(sleep, vmesh.now(), *nodeResult);
+        };
+        uint64_t bootDelay = std::uniform_int_distribution<uint64_t>(0, SIM_BOOT_JITTER)(rng);
+        vmesh.boot(nodeIds[i], bootDelay, program);
+    }
+    // 親モジュールの Web 画面から設定を変更した場合と同じく syncConfig で全体に同期する
+    if (syncTime != 0) {
+        vmesh.post(parentId, syncTime, []() {
+            DynamicJsonBuffer jsonBuf;
+            JsonObject &config = jsonBuf.createObject();
+            config[KEY_ACTIVE_START] = SIM_ACTIVE_START;
+            config[KEY_ACTIVE_END] = SIM_ACTIVE_END;
+            TrapModule::getInstance()->syncConfig(config);
+        });
+    }
+    vmesh.run((WORK_TIME + SIM_MARGIN_TIME) * 1000ULL,
+              [&vmesh, nodeNum]() { return vmesh.getHaltedNum() == nodeNum; });
+    // 止まっていないノードはここで止めて結果を取り出す
+    for (uint32_t nodeId : nodeIds) {
+        vmesh.shutdown(nodeId);
+    }
+}
+
+static MeshSimResult runMesh(uint8_t nodeNum, double loss, unsigned int seed) {
+    MeshSimResult result;
+    result.nodeNum = nodeNum;
+    result.loss = loss;
+    VirtualMesh vmesh(seed);
+    // NodeId は ESP32 と同じく MAC アドレス由来のばらばらな値
+    std::mt19937 rng(seed);
+    std::vector<uint32_t> nodeIds;
+    while (nodeIds.size() < nodeNum) {
+        uint32_t nodeId = rng();
+        if (nodeId != DEF_NODEID &&
+            std::find(nodeIds.begin(), nodeIds.end(), nodeId) == nodeIds.end()) {
+            nodeIds.push_back(nodeId);
+        }
+    }
+    VirtualLinkConfig link;
+    link.latency = SIM_LINK_LATENCY;
+    link.jitter = SIM_LINK_JITTER;
+    link.loss = loss;
+    vmesh.makeRandomTree(nodeIds, SIM_MAX_CHILDREN, link);
+    for (uint32_t nodeId : nodeIds) {
+        result.maxHop = max(result.maxHop, vmesh.getHop(nodeIds[0], nodeId));
+    }
+    std::vector<SimNodeResult> nodeResults;
+    runTrapModules(vmesh, nodeIds, nodeResults, rng, SIM_CONFIG_TIME * 1000ULL);
+    result.stats = vmesh.getStats();
+    result.reported = nodeResults[0].reportedNum;
+    result.reportCollision = nodeResults[0].reportCollision;
+    result.sleepAcked = nodeResults[0].sleepAckNum;
+    for (size_t i = 0; i < nodeResults.size(); ++i) {
+        const SimNodeResult &nodeResult = nodeResults[i];
+        if (i != 0 && nodeResult.hasConfig) {
+            ++result.configReached;
+            result.configDelay = max(result.configDelay, nodeResult.configDelay);
+        }
+        if (nodeResult.isSleep) {
+            ++result.sleepNum;
+            result.sleepTime = max(result.sleepTime, nodeResult.haltTime);
+        }
+    }
+    return result;
+}
+
+static void printResult(const MeshSimResult &result) {
+    printf("%5u %5.2f %4u %8u %9.1f %8u %6u %9u %6u %9.1f %6u %7u %7u\n", result.nodeNum,
+           result.loss, result.maxHop, result.configReached, result.configDelay / 1000.0,
+           result.reported, result.reportCollision, result.sleepAcked, result.sleepNum,
+           result.sleepTime / 1000.0, result.stats.sent, result.stats.transmissions,
+           result.stats.dropped);
+}
+
+static void printHeader() {
+    printf("\n%5s %5s %4s %8s %9s %8s %6s %9s %6s %9s %6s %7s %7s\n", "nodes", "loss", "hop",
+           "config", "config_ms", "reported", "coll", "sleep_ack", "sleep", "sleep_ms", "sent",
+           "tx", "dropped");
+}
+
+void setUp() {}
+void tearDown() {}
+
+/**
+ * 損失が無ければ全子モジュールに設定が届き、状態と ACK が揃って全ノードが DeepSleep する
+ */
+void test_lossless_mesh_converges() {
+    printHeader();
+    for (uint8_t nodeNum : SIM_NODE_NUMS) {
+        MeshSimResult result = runMesh(nodeNum, 0, nodeNum);
+        printResult(result);
+        TEST_ASSERT_EQUAL(nodeNum - 1, result.configReached);
+        TEST_ASSERT_TRUE(result.configDelay <=
+                         (uint32_t)result.maxHop * (SIM_LINK_LATENCY + SIM_LINK_JITTER));
+        TEST_ASSERT_EQUAL(nodeNum - 1, result.reported);
+        // 子モジュール毎に別のスロットなので衝突しない
+        TEST_ASSERT_EQUAL(0, result.reportCollision);
+        TEST_ASSERT_EQUAL(nodeNum - 1, result.sleepAcked);
+        // 稼働時間の上限を待たずに全ノードが DeepSleep する
+        TEST_ASSERT_EQUAL(nodeNum, result.sleepNum);
+        TEST_ASSERT_TRUE(result.sleepTime < WORK_TIME * 1000ULL);
+    }
+}
+
+/**
+ * 損失のあるメッシュでの到達率と収束時間
+ * 失われても再送と稼働時間の上限で全ノードが DeepSleep する
+ */
+void test_lossy_mesh() {
+    printHeader();
+    for (double loss : {0.01, 0.05}) {
+        for (uint8_t nodeNum : SIM_NODE_NUMS) {
+            MeshSimResult result = runMesh(nodeNum, loss, nodeNum);
+            printResult(result);
+            TEST_ASSERT_TRUE(result.configReached <= nodeNum - 1u);
+            TEST_ASSERT_TRUE(result.stats.dropped > 0);
+            TEST_ASSERT_EQUAL(nodeNum, result.sleepNum);
+        }
+    }
+}
+
+/**
+ * 末端のノードが最初の同期 DeepSleep 通知を受け取れなくても、中継ノードが起きていて
+ * 親モジュールの再送が届く
+ */
+void test_relay_forwards_sync_sleep_resend() {
+    // 親モジュール - 中継ノード - 末端のノード の直列
+    std::vector<uint32_t> nodeIds = {3000000001, 2000000001, 1000000001};
+    uint32_t leafId = nodeIds[2];
+    VirtualMesh vmesh;
+    VirtualLinkConfig link;
+    link.latency = SIM_LINK_LATENCY;
+    vmesh.makeRandomTree(nodeIds, 1, link);
+    // 中継ノードから末端のノードへの最初の同期 DeepSleep 通知を失わせる
+    bool isDropped = false;
+    vmesh.setDropFilter([&isDropped, leafId](uint32_t, uint32_t to, const String &msg) {
+        if (isDropped || to != leafId || msg.indexOf("\"" KEY_SYNC_SLEEP "\"") < 0) {
+            return false;
+        }
+        isDropped = true;
+        return true;
+    });
+    std::mt19937 rng(1);
+    std::vector<SimNodeResult> nodeResults;
+    runTrapModules(vmesh, nodeIds, nodeResults, rng, 0);
+    TEST_ASSERT_TRUE(isDropped);
+    TEST_ASSERT_EQUAL(2, nodeResults[0].sleepAckNum);
+    for (const SimNodeResult &nodeResult : nodeResults) {
+        TEST_ASSERT_TRUE(nodeResult.isSleep);
+        TEST_ASSERT_TRUE(nodeResult.haltTime < WORK_TIME * 1000ULL);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_lossless_mesh_converges);
+    RUN_TEST(test_lossy_mesh);
+    RUN_TEST(test_relay_forwards_sync_sleep_resend);
+    return UNITY_END();
+}
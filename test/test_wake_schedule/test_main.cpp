@@ -0,0 +1,247 @@
+/**
+ * 起動スケジュール(WakeSchedule)のテスト
+ * 稼働時間帯からの次回起動時刻を、ビットマップ化する前の ModuleConfig::calcWakeTime を
+ * そのまま移した baselineWakeTime と 1 日の全分で比較する
+ * pio test -e native -f test_wake_schedule -v
+ *
+ * 以前の計算と意図して変えた点
+ * - 稼働開始時刻 0 時の 23 時台: 以前は 15 分以内の判定が逆で、23:00-23:44 は 1 時を
+ *   (23 時が稼働時間帯の外の場合)、23:45 以降は 15 分以内の 0 時を返していた
+ *   今は他の時刻と同じく 0 時(15 分以内なら 1 時)
+ * - 稼働開始時刻 > 稼働停止時刻: 以前は扱えなかったが、今は日をまたぐ時間帯として扱う
+ * - 稼働停止時刻: 以前と同じく停止時刻の正時も起動時刻に含む(fromRange で停止時刻のビットを立てる)
+ */
+
+#include "wakeSchedule.h"
+#include <unity.h>
+
+#define TEST_DAY_START ((time_t)1699920000) // 2023-11-14 00:00:00 UTC
+#define TEST_SLOT_SEC (WAKE_SCHEDULE_SLOT_MIN * SECS_PER_MIN)
+
+static time_t at(uint8_t dayOffset, uint8_t hour, uint8_t minute, uint8_t second = 0) {
+    return TEST_DAY_START + dayOffset * SECS_PER_DAY + hour * SECS_PER_HOUR +
+           minute * SECS_PER_MIN + second;
+}
+
+static void setSlot(WakeScheduleBits &schedule, uint16_t slot) {
+    schedule[slot / 32] |= 1UL << (slot % 32);
+}
+
+/**
+ * ビットマップ化する前の ModuleConfig::calcWakeTime (adjustSleepTime と now() を除く)
+ */
+static time_t baselineWakeTime(uint8_t activeStart, uint8_t activeEnd, time_t current) {
+    // 現在時刻
+    tmElements_t tNow;
+    breakTime(current, tNow);
+    int tHour = tNow.Hour;
+    int tMinute = tNow.Minute;
+    tNow.Minute = 0;
+    tNow.Second = 0;
+    time_t baseTime = makeTime(tNow);
+    // 現在時刻が稼働時間帯
+    if (activeStart <= tHour && tHour < activeEnd) {
+        // 次の起動時刻が15分以上後なら1時間後が次回起動時刻
+        if (tMinute < 60 - WAKE_TIME_SET_MIN) {
+            return baseTime + SECS_PER_HOUR;
+        }
+        // 2時間後の時刻が稼働時間帯の場合
+        if (tHour + 2 <= activeEnd) {
+            return baseTime + 2 * SECS_PER_HOUR;
+        }
+        // 2時間後の時刻が稼働時間帯ではない場合は稼働開始時刻をセット
+        return baseTime + (24 - tHour + activeStart) * SECS_PER_HOUR;
+    }
+    // 現在時刻が稼働開始時刻より早い
+    if (tHour < activeStart) {
+        // 次の稼働時刻が15分以内の場合稼働開始時刻まで停止
+        if (tHour + 1 != activeStart || tMinute < 60 - WAKE_TIME_SET_MIN) {
+            return baseTime + (activeStart - tHour) * SECS_PER_HOUR;
+        }
+        // もし15分以内に稼働開始時刻になるなら2時間後の起動時刻まで飛ばす
+        return baseTime + 2 * SECS_PER_HOUR;
+    }
+    // 現在時刻が稼働終了時刻より遅い
+    // 15分以内に稼働開始時刻になる場合2時間後まで停止(実質稼働開始時刻が 0 時の場合のみの考慮)
+    if (tMinute < 60 - WAKE_TIME_SET_MIN && tHour + 1 - 24 == activeStart) {
+        return baseTime + 2 * SECS_PER_HOUR;
+    }
+    return baseTime + (24 - tHour + activeStart) * SECS_PER_HOUR;
+}
+
+/**
+ * 1 スロットだけのスケジュールの次回起動時刻(当日のスロットが 15 分以内か過ぎていれば翌日)
+ */
+static time_t slotWakeTime(uint16_t slot, time_t current) {
+    time_t wakeTime = previousMidnight(current) + slot * TEST_SLOT_SEC;
+    while (wakeTime <= current + WAKE_TIME_SET_MIN * SECS_PER_MIN) {
+        wakeTime += SECS_PER_DAY;
+    }
+    return wakeTime;
+}
+
+void setUp() {}
+void tearDown() {}
+
+/**
+ * 1 スロットだけのスケジュールを全スロットについて、1 日の全分で確かめる
+ */
+void test_next_wake_time_every_slot() {
+    for (uint16_t slot = 0; slot < WAKE_SCHEDULE_SLOT_NUM; ++slot) {
+        WakeScheduleBits schedule = {0};
+        setSlot(schedule, slot);
+        TEST_ASSERT_EQUAL_INT16(slot, WakeSchedule::findSlot(schedule, 0));
+        TEST_ASSERT_EQUAL_INT16(slot, WakeSchedule::findSlot(schedule, slot));
+        TEST_ASSERT_EQUAL_INT16(-1, WakeSchedule::findSlot(schedule, slot + 1));
+        for (time_t current = at(0, 0, 0); current < at(1, 0, 0); current += SECS_PER_MIN) {
+            TEST_ASSERT_EQUAL_INT64(slotWakeTime(slot, current),
+                                    WakeSchedule::nextWakeTime(schedule, current));
+        }
+    }
+}
+
+/**
+ * 稼働開始時刻 < 稼働停止時刻の全組について、1 日の全分で以前の計算と一致する
+ * (稼働開始時刻 0 時の 23 時台は test_next_wake_time_baseline_midnight で確かめる)
+ */
+void test_next_wake_time_matches_baseline() {
+    for (uint8_t start = 0; start < 24; ++start) {
+        for (uint8_t end = start + 1; end <= DEF_ACTIVE_END; ++end) {
+            WakeScheduleBits schedule;
+            WakeSchedule::fromRange(start, end, schedule);
+            for (time_t current = at(0, 0, 0); current < at(1, 0, 0); current += SECS_PER_MIN) {
+                if (start == 0 && current >= at(0, 23, 0)) {
+                    continue;
+                }
+                TEST_ASSERT_EQUAL_INT64(baselineWakeTime(start, end, current),
+                                        WakeSchedule::nextWakeTime(schedule, current));
+            }
+        }
+    }
+}
+
+/**
+ * 稼働開始時刻 0 時の 23 時台は以前の計算の 15 分判定の逆転を直している
+ */
+void test_next_wake_time_baseline_midnight() {
+    for (uint8_t end = 1; end <= DEF_ACTIVE_END; ++end) {
+        WakeScheduleBits schedule;
+        WakeSchedule::fromRange(0, end, schedule);
+        // 23 時が稼働時間帯の外だと、以前は 23:30 から 0 時を飛ばして 1 時に起動していた
+        if (end < DEF_ACTIVE_END) {
+            TEST_ASSERT_EQUAL_INT64(at(1, 1, 0), baselineWakeTime(0, end, at(0, 23, 30)));
+        }
+        TEST_ASSERT_EQUAL_INT64(at(1, 0, 0), WakeSchedule::nextWakeTime(schedule, at(0, 23, 30)));
+        // 以前は 23:50 から 10 分後の 0 時に起動していた
+        TEST_ASSERT_EQUAL_INT64(at(1, 0, 0), baselineWakeTime(0, end, at(0, 23, 50)));
+        TEST_ASSERT_EQUAL_INT64(at(1, 1, 0), WakeSchedule::nextWakeTime(schedule, at(0, 23, 50)));
+    }
+}
+
+/**
+ * 日をまたぐ稼働時間帯は 0 時までと 0 時からの 2 つの時間帯を合わせたもの
+ */
+void test_from_range_wraps_midnight() {
+    for (uint8_t start = 1; start < 24; ++start) {
+        for (uint8_t end = 0; end < start; ++end) {
+            WakeScheduleBits schedule;
+            WakeScheduleBits evening;
+            WakeScheduleBits morning;
+            WakeSchedule::fromRange(start, end, schedule);
+            WakeSchedule::fromRange(start, 23, evening);
+            WakeSchedule::fromRange(0, end, morning);
+            for (uint8_t i = 0; i < WAKE_SCHEDULE_WORDS; ++i) {
+                TEST_ASSERT_EQUAL_UINT32(evening[i] | morning[i], schedule[i]);
+            }
+        }
+    }
+}
+
+/**
+ * 15 分以内の起動時刻は飛ばす(ちょうど 15 分後も飛ばす)
+ */
+void test_next_wake_time_skips_within_set_min() {
+    WakeScheduleBits schedule;
+    WakeSchedule::fromRange(0, 23, schedule);
+    TEST_ASSERT_EQUAL_INT64(at(0, 14, 0), WakeSchedule::nextWakeTime(schedule, at(0, 13, 44, 59)));
+    TEST_ASSERT_EQUAL_INT64(at(0, 15, 0), WakeSchedule::nextWakeTime(schedule, at(0, 13, 45)));
+    TEST_ASSERT_EQUAL_INT64(at(0, 15, 0), WakeSchedule::nextWakeTime(schedule, at(0, 13, 46)));
+    // 起動直後(起動時刻ちょうど)は次の正時
+    TEST_ASSERT_EQUAL_INT64(at(0, 14, 0), WakeSchedule::nextWakeTime(schedule, at(0, 13, 0)));
+}
+
+/**
+ * 23:xx から翌日 00:00 への折り返し
+ */
+void test_next_wake_time_wraps_midnight() {
+    WakeScheduleBits schedule;
+    WakeSchedule::fromRange(22, 2, schedule);
+    TEST_ASSERT_EQUAL_INT64(at(1, 0, 0), WakeSchedule::nextWakeTime(schedule, at(0, 23, 30)));
+    TEST_ASSERT_EQUAL_INT64(at(1, 1, 0), WakeSchedule::nextWakeTime(schedule, at(0, 23, 50)));
+    TEST_ASSERT_EQUAL_INT64(at(0, 22, 0), WakeSchedule::nextWakeTime(schedule, at(0, 2, 0)));
+    // 00:00 しか無い場合、23:50 からは翌日の 00:00 を飛ばして翌々日の 00:00
+    WakeScheduleBits midnight = {0};
+    setSlot(midnight, 0);
+    TEST_ASSERT_EQUAL_INT64(at(1, 0, 0), WakeSchedule::nextWakeTime(midnight, at(0, 23, 44)));
+    TEST_ASSERT_EQUAL_INT64(at(2, 0, 0), WakeSchedule::nextWakeTime(midnight, at(0, 23, 50)));
+    // 23:45 以降は当日のスロットが残っていない
+    WakeScheduleBits last = {0};
+    setSlot(last, WAKE_SCHEDULE_SLOT_NUM - 1);
+    TEST_ASSERT_EQUAL_INT64(at(1, 23, 45), WakeSchedule::nextWakeTime(last, at(0, 23, 45)));
+}
+
+void test_next_wake_time_empty() {
+    WakeScheduleBits schedule = {0};
+    TEST_ASSERT_EQUAL_INT64(0, WakeSchedule::nextWakeTime(schedule, at(0, 12, 0)));
+    TEST_ASSERT_EQUAL_INT16(-1, WakeSchedule::findSlot(schedule, 0));
+}
+
+/**
+ * スロットの 15 分間だけスケジュールに含まれる
+ */
+void test_is_scheduled_every_slot() {
+    for (uint16_t slot = 0; slot < WAKE_SCHEDULE_SLOT_NUM; ++slot) {
+        WakeScheduleBits schedule = {0};
+        setSlot(schedule, slot);
+        for (time_t t = at(0, 0, 0); t < at(1, 0, 0); t += SECS_PER_MIN) {
+            bool expected = (t - TEST_DAY_START) / TEST_SLOT_SEC == slot;
+            TEST_ASSERT_EQUAL(expected, WakeSchedule::isScheduled(schedule, t));
+        }
+    }
+}
+
+void test_from_hex() {
+    WakeScheduleBits schedule = {0};
+    WakeScheduleBits range;
+    // 1 時間毎の指定は正時のビット
+    TEST_ASSERT_TRUE(WakeSchedule::fromHex("07ffc0", schedule));
+    WakeSchedule::fromRange(6, 18, range);
+    TEST_ASSERT_EQUAL_MEMORY(range, schedule, sizeof(schedule));
+    TEST_ASSERT_TRUE(WakeSchedule::fromHex("800000", schedule));
+    TEST_ASSERT_EQUAL_INT16(23 * 4, WakeSchedule::findSlot(schedule, 0));
+    // 15 分毎の指定は 1 桁 4 スロット
+    TEST_ASSERT_TRUE(WakeSchedule::fromHex("80000000000000000000000A", schedule));
+    TEST_ASSERT_EQUAL_INT16(1, WakeSchedule::findSlot(schedule, 0));
+    TEST_ASSERT_EQUAL_INT16(3, WakeSchedule::findSlot(schedule, 2));
+    TEST_ASSERT_EQUAL_INT16(95, WakeSchedule::findSlot(schedule, 4));
+    TEST_ASSERT_EQUAL_STRING("80000000000000000000000a", WakeSchedule::toHex(schedule).c_str());
+    // 不正な指定は変更しない
+    TEST_ASSERT_FALSE(WakeSchedule::fromHex("12345g", schedule));
+    TEST_ASSERT_FALSE(WakeSchedule::fromHex("1234567", schedule));
+    TEST_ASSERT_FALSE(WakeSchedule::fromHex(NULL, schedule));
+    TEST_ASSERT_EQUAL_STRING("80000000000000000000000a", WakeSchedule::toHex(schedule).c_str());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_next_wake_time_every_slot);
+    RUN_TEST(test_next_wake_time_matches_baseline);
+    RUN_TEST(test_next_wake_time_baseline_midnight);
+    RUN_TEST(test_from_range_wraps_midnight);
+    RUN_TEST(test_next_wake_time_skips_within_set_min);
+    RUN_TEST(test_next_wake_time_wraps_midnight);
+    RUN_TEST(test_next_wake_time_empty);
+    RUN_TEST(test_is_scheduled_every_slot);
+    RUN_TEST(test_from_hex);
+    return UNITY_END();
+}